@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/options.h"
+#include "buffer/buffer_manager.h"
+
+/// Stress benchmark for `BufferManager::fix_page()` / `unfix_page()`.
+///
+/// Usage: buffer_manager_bench [--option=value ...]
+///   --threads=N          number of worker threads (default 4)
+///   --ops=N              operations per thread (default 1000000)
+///   --page_size=N        page size in bytes (default 4096)
+///   --pool_pages=N       pages the buffer manager may keep in memory (default 1024)
+///   --working_set=N      distinct pages that are accessed (default 4096)
+///   --distribution=D     `uniform` or `zipf` (default zipf)
+///   --theta=F            skew of the zipf distribution, in (0, 1) (default 0.99)
+///   --write_ratio=F      fraction of fixes that are exclusive and dirty (default 0.1)
+///   --segment=N          segment id to run on (default 0)
+///   --seed=N             seed of the random number generators (default 42)
+///   --direct_io=0|1      open the segment file with O_DIRECT (default 0)
+///   --compressed_cache=N size in bytes of the compressed page cache (default 0)
+///
+/// The segment file is created in the current working directory.
+
+namespace {
+
+using buzzdb::BufferFrame;
+using buzzdb::BufferManager;
+using buzzdb::buffer_full_error;
+
+struct Options {
+    size_t threads = 4;
+    size_t ops = 1000000;
+    size_t page_size = 4096;
+    size_t pool_pages = 1024;
+    size_t working_set = 4096;
+    std::string distribution = "zipf";
+    double theta = 0.99;
+    double write_ratio = 0.1;
+    uint16_t segment = 0;
+    uint64_t seed = 42;
+    bool direct_io = false;
+    size_t compressed_cache = 0;
+};
+
+/// Zipfian generator over [0, n) following Gray et al., "Quickly Generating
+/// Billion-Record Synthetic Databases". The constants are computed once and
+/// shared by all threads.
+class ZipfGenerator {
+ public:
+    ZipfGenerator(uint64_t n, double theta) : n(n), theta(theta) {
+        for (uint64_t i = 1; i <= n; i++) {
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    uint64_t next(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        auto value = static_cast<uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha));
+        return std::min(value, n - 1);
+    }
+
+ private:
+    uint64_t n;
+    double theta;
+    double zetan = 0.0;
+    double alpha;
+    double eta;
+};
+
+struct ThreadResult {
+    std::vector<uint64_t> latencies_ns;
+    uint64_t buffer_full = 0;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    buzzdb::bench::OptionParser parser;
+    parser.add("threads", options.threads);
+    parser.add("ops", options.ops);
+    parser.add("page_size", options.page_size);
+    parser.add("pool_pages", options.pool_pages);
+    parser.add("working_set", options.working_set);
+    parser.add("distribution", options.distribution);
+    parser.add("theta", options.theta);
+    parser.add("write_ratio", options.write_ratio);
+    parser.add("segment", options.segment);
+    parser.add("seed", options.seed);
+    parser.add("direct_io", options.direct_io);
+    parser.add("compressed_cache", options.compressed_cache);
+    parser.parse(argc, argv);
+    parser.require(options.distribution == "uniform" || options.distribution == "zipf",
+                   "distribution must be `uniform` or `zipf`");
+    parser.require(options.pool_pages > 0, "pool_pages must be positive");
+    parser.require(options.working_set > 0, "working_set must be positive");
+    parser.require(options.theta > 0.0 && options.theta < 1.0, "theta must be in (0, 1)");
+    return options;
+}
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    auto index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index] / 1000.0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+    BufferManager buffer_manager(options.page_size, options.pool_pages, options.direct_io, options.compressed_cache);
+    uint64_t segment_base = static_cast<uint64_t>(options.segment) << 48;
+
+    /// Touch every page of the working set once so that the measured run does
+    /// not include growing the segment file.
+    for (uint64_t i = 0; i < options.working_set; i++) {
+        auto& page = buffer_manager.fix_page(segment_base | i, true);
+        std::memcpy(page.get_data(), &i, sizeof(i));
+        buffer_manager.unfix_page(page, true);
+    }
+    buffer_manager.reset_statistics();
+
+    ZipfGenerator zipf(options.working_set, options.theta);
+    bool use_zipf = options.distribution == "zipf";
+    std::vector<ThreadResult> results(options.threads);
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < options.threads; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(options.seed + t);
+            std::uniform_int_distribution<uint64_t> uniform(0, options.working_set - 1);
+            std::bernoulli_distribution is_write(options.write_ratio);
+            auto& result = results[t];
+            result.latencies_ns.reserve(options.ops);
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < options.ops; i++) {
+                uint64_t page_id = segment_base | (use_zipf ? zipf.next(rng) : uniform(rng));
+                bool exclusive = is_write(rng);
+                auto begin = std::chrono::steady_clock::now();
+                try {
+                    auto& page = buffer_manager.fix_page(page_id, exclusive);
+                    auto* data = reinterpret_cast<volatile uint64_t*>(page.get_data());
+                    if (exclusive) {
+                        data[1] = data[1] + 1;
+                    } else {
+                        (void) data[0];
+                    }
+                    buffer_manager.unfix_page(page, exclusive);
+                } catch (const buffer_full_error&) {
+                    result.buffer_full++;
+                }
+                auto end = std::chrono::steady_clock::now();
+                result.latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            }
+        });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - begin).count();
+
+    std::vector<uint64_t> latencies;
+    uint64_t buffer_full = 0;
+    for (auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies_ns.begin(), result.latencies_ns.end());
+        buffer_full += result.buffer_full;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto statistics = buffer_manager.get_statistics();
+    uint64_t total_ops = options.threads * options.ops;
+    uint64_t fixes = statistics.hits + statistics.misses;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "threads=" << options.threads
+              << " distribution=" << options.distribution
+              << " write_ratio=" << options.write_ratio
+              << " pool_pages=" << options.pool_pages
+              << " working_set=" << options.working_set
+              << " page_size=" << options.page_size
+              << " direct_io=" << options.direct_io
+              << " compressed_cache=" << options.compressed_cache << "\n";
+    std::cout << "throughput_ops_per_s: " << total_ops / seconds << "\n";
+    std::cout << "latency_us p50: " << percentile(latencies, 0.50)
+              << " p95: " << percentile(latencies, 0.95)
+              << " p99: " << percentile(latencies, 0.99)
+              << " p99.9: " << percentile(latencies, 0.999)
+              << " max: " << (latencies.empty() ? 0.0 : latencies.back() / 1000.0) << "\n";
+    std::cout << "hit_ratio: " << (fixes == 0 ? 0.0 : 1.0 * statistics.hits / fixes) << "\n";
+    std::cout << "evictions: " << statistics.evictions
+              << " per_op: " << (total_ops == 0 ? 0.0 : 1.0 * statistics.evictions / total_ops)
+              << " per_s: " << statistics.evictions / seconds << "\n";
+    std::cout << "writebacks: " << statistics.writebacks << "\n";
+    std::cout << "compressed_hits: " << statistics.compressed_hits << "\n";
+    std::cout << "buffer_full_errors: " << buffer_full << std::endl;
+    return 0;
+}
@@ -1,3 +1,5 @@
+#include <cerrno>
+#include <cstdlib>
 #include <unordered_map>
 #include <system_error>
 #include <string_view>
@@ -7,9 +9,14 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <charconv>
 #include <thread>
 #include <sstream>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "buffer/buffer_manager.h"
 #include "common/macros.h"
 #include "storage/file.h"
@@ -22,14 +29,12 @@ char* BufferFrame::get_data() {
     return data; 
 }
 
-BufferFrame::BufferFrame(const uint64_t pageId, char* data, list_position  fifo_position, list_position lru_position)
- : pId(pageId), data(data), fifo_position(fifo_position), lru_position(lru_position) {}
-
 void BufferFrame::lock(const bool exclusive_lock) {
     if (!exclusive_lock) {
         shared_mutex.lock_shared();
     } else {
         shared_mutex.lock();
+        version.fetch_add(1, std::memory_order_acq_rel);
         this->exclusively_locked = true;
     }
 }
@@ -39,120 +44,331 @@ void BufferFrame::unlock() {
         shared_mutex.unlock_shared();
     } else {
         this->exclusively_locked = false;
+        version.fetch_add(1, std::memory_order_acq_rel);
         shared_mutex.unlock();
     }
 }
 
-BufferManager::BufferManager(size_t page_size, size_t page_count) :
- page_size(page_size), page_count(page_count), loaded_pages(std::make_unique<char[]>(page_count * page_size)) {}
+bool BufferFrame::upgrade() {
+    assert(!this->exclusively_locked);
+    /// No writer can hold the latch while we hold it shared, so the version
+    /// is even here and the next writer makes it odd.
+    auto expected = version.load(std::memory_order_acquire) + 1;
+    shared_mutex.unlock_shared();
+    lock(true);
+    return version.load(std::memory_order_acquire) == expected;
+}
+
+bool BufferFrame::downgrade() {
+    assert(this->exclusively_locked);
+    /// Releasing the exclusive latch makes the version even again
+    auto expected = version.load(std::memory_order_acquire) + 1;
+    unlock();
+    lock(false);
+    return version.load(std::memory_order_acquire) == expected;
+}
+
+uint64_t BufferFrame::read_optimistic() const {
+    while (true) {
+        auto current = version.load(std::memory_order_acquire);
+        if ((current & 1) == 0) {
+            return current;
+        }
+        std::this_thread::yield();
+    }
+}
+
+bool BufferFrame::validate(uint64_t expected) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == expected;
+}
+
+bool BufferFrame::upgrade_optimistic(uint64_t expected) {
+    lock(true);
+    if (version.load(std::memory_order_acquire) == expected + 1) {
+        return true;
+    }
+    unlock();
+    return false;
+}
+
+bool BufferFrame::share_optimistic(uint64_t expected) {
+    lock(false);
+    if (version.load(std::memory_order_acquire) == expected) {
+        return true;
+    }
+    unlock();
+    return false;
+}
+
+BufferManager::SegmentFile::~SegmentFile() {
+    if (direct_fd >= 0) {
+        ::close(direct_fd);
+    }
+}
+
+size_t BufferManager::SegmentFile::size() const {
+    return direct_fd >= 0 ? direct_size : file->size();
+}
+
+void BufferManager::SegmentFile::resize(size_t new_size) {
+    if (direct_fd < 0) {
+        file->resize(new_size);
+        return;
+    }
+    if (::ftruncate(direct_fd, new_size) < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot resize segment file");
+    }
+    direct_size = new_size;
+}
+
+void BufferManager::SegmentFile::read_block(size_t offset, size_t size, char* block) {
+    if (direct_fd < 0) {
+        file->read_block(offset, size, block);
+        return;
+    }
+    size_t total = 0;
+    while (total < size) {
+        auto bytes = ::pread(direct_fd, block + total, size - total, offset + total);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            throw std::system_error(bytes == 0 ? EIO : errno, std::generic_category(), "cannot read segment file");
+        }
+        total += bytes;
+    }
+}
+
+void BufferManager::SegmentFile::write_block(const char* block, size_t offset, size_t size) {
+    if (direct_fd < 0) {
+        file->write_block(block, offset, size);
+        return;
+    }
+    size_t total = 0;
+    while (total < size) {
+        auto bytes = ::pwrite(direct_fd, block + total, size - total, offset + total);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            throw std::system_error(bytes == 0 ? EIO : errno, std::generic_category(), "cannot write segment file");
+        }
+        total += bytes;
+    }
+}
+
+void BufferManager::PageDeleter::operator()(char* pages) const {
+    std::free(pages);
+}
+
+BufferManager::PageMemory BufferManager::allocate_pages(size_t size) {
+    /// aligned_alloc requires the size to be a multiple of the alignment
+    size = (size + kDirectIOAlignment - 1) / kDirectIOAlignment * kDirectIOAlignment;
+    auto* pages = static_cast<char*>(std::aligned_alloc(kDirectIOAlignment, std::max<size_t>(size, kDirectIOAlignment)));
+    if (pages == nullptr) {
+        throw std::bad_alloc();
+    }
+    return PageMemory(pages);
+}
+
+void BufferManager::FrameList::push_back(BufferFrame& frame) {
+    assert(frame.list == BufferFrame::NO_LIST);
+    frame.list = kind;
+    frame.prev = tail;
+    frame.next = nullptr;
+    if (tail != nullptr) {
+        tail->next = &frame;
+    } else {
+        head = &frame;
+    }
+    tail = &frame;
+}
+
+void BufferManager::FrameList::remove(BufferFrame& frame) {
+    assert(frame.list == kind);
+    if (frame.prev != nullptr) {
+        frame.prev->next = frame.next;
+    } else {
+        head = frame.next;
+    }
+    if (frame.next != nullptr) {
+        frame.next->prev = frame.prev;
+    } else {
+        tail = frame.prev;
+    }
+    frame.list = BufferFrame::NO_LIST;
+    frame.prev = nullptr;
+    frame.next = nullptr;
+}
+
+BufferManager::BufferManager(size_t page_size, size_t page_count, bool direct_io, size_t compressed_cache_size) :
+ page_size(page_size), page_count(page_count), direct_io(direct_io), loaded_pages(allocate_pages(page_count * page_size)),
+ frames(std::make_unique<BufferFrame[]>(page_count)), page_table(page_count),
+ writeback_buffers(allocate_pages(kWritebackBuffers * page_size)) {
+    if (direct_io && (page_size == 0 || page_size % kDirectIOAlignment != 0)) {
+        throw std::invalid_argument("page size must be a multiple of the direct I/O alignment");
+    }
+    if (compressed_cache_size != 0) {
+        compressed_cache = std::make_unique<CompressedPageCache>(page_size, compressed_cache_size);
+    }
+    for (size_t i = 0; i < page_count; i++) {
+        frames[i].data = &loaded_pages[i * page_size];
+        free_list.push_back(frames[i]);
+    }
+}
 
 BufferManager::~BufferManager() {
     std::unique_lock u_lock(global_mutex);
-    for (auto& bufferframe: bufferframes) {
-        auto& file = *segment_files.find(get_segment_id(bufferframe.second.pId))->second.file;
+    if (prefetch_thread.joinable()) {
+        prefetch_stop = true;
+        prefetch_requested.notify_one();
+        u_lock.unlock();
+        prefetch_thread.join();
+        u_lock.lock();
+    }
+    for (size_t i = 0; i < page_count; i++) {
+        auto& page = frames[i];
+        if (page.state == BufferFrame::FREE || !page.isDirty) {
+            continue;
+        }
+        auto& file = segment_files.find(get_segment_id(page.pId))->second;
         u_lock.unlock();
-        file.write_block(bufferframe.second.data, get_segment_page_id(bufferframe.second.pId) * page_size, page_size);
+        file.write_block(page.data, get_segment_page_id(page.pId) * page_size, page_size);
         u_lock.lock();
-        bufferframe.second.isDirty = false;
+        page.isDirty = false;
     }
 }
 
+void BufferManager::touch_page(BufferFrame& page) {
+    if (page.list == BufferFrame::FIFO_LIST) {
+        /// Page is in the FIFO List and being fixed again => Hot Page => move it the the LRU List
+        fifo_list.remove(page);
+    } else {
+        /// Page is in LRU List => Update it to the end of LRU List
+        assert(page.list == BufferFrame::LRU_LIST);
+        lru_list.remove(page);
+    }
+    lru_list.push_back(page);
+}
+
 BufferFrame& BufferManager::fix_page(uint64_t page_id, bool exclusive) {
+    while (true) {
+        auto& page = fix_page_optimistic(page_id);
+        /// A page in state NEW is latched exclusively by the thread that loads
+        /// it, so this waits until the data is there.
+        page.lock(exclusive);
+        if (!page.load_failed) {
+            return page;
+        }
+        /// The thread that loaded the page failed, so try to load it again
+        page.unlock();
+        unfix_page_optimistic(page);
+    }
+}
+
+BufferFrame& BufferManager::fix_page_optimistic(uint64_t page_id) {
     std::unique_lock u_lock(global_mutex);
+    BufferFrame* page;
     while (true) {
-        auto i = bufferframes.find(page_id);
-        if (i != bufferframes.end()) {
-            auto& page = i->second;
-            page.set_num_fixed(page.get_num_fixed() + 1);
-            if (page.state == BufferFrame::NEW) {
-                /// Another thread is trying to evict another page for this wait for the other thread to finish by locking the page exclusively.
-                u_lock.unlock();
-                page.lock(true);
-                page.unlock();
-                u_lock.lock();
-                if (page.state == BufferFrame::NEW) {
-                    page.set_num_fixed(page.get_num_fixed() - 1);
-                    if (page.get_num_fixed() == 0) {
-                        bufferframes.erase(i);
-                    }
-                    continue;
-                }
-            } else if (page.state == BufferFrame::EVICT) {
-                page.state = BufferFrame::RELOAD;
-            } 
-            if (page.lru_position == lru_list.end()) {
-                assert(page.fifo_position != fifo_list.end());
-                /// Page is in the FIFO List and being fixed again => Hot Page => move it the the LRU List
-                fifo_list.erase(page.fifo_position);
-                page.fifo_position = fifo_list.end();
-                page.lru_position = lru_list.insert(lru_list.end(), &page);
-            } else {
-                /// Page is in LRU List => Update it to the end of LRU List
-                lru_list.erase(page.lru_position);
-                page.lru_position = lru_list.insert(lru_list.end(), &page);
+        auto index = page_table.find(page_id);
+        if (index != PageTable::kNotFound) {
+            auto& hit = frames[index];
+            hit.set_num_fixed(hit.get_num_fixed() + 1);
+            if (hit.state == BufferFrame::EVICT) {
+                hit.state = BufferFrame::RELOAD;
             }
-            u_lock.unlock();
-            page.lock(exclusive);
-            return page;
-        } else {
+            num_hits++;
+            touch_page(hit);
+            return hit;
+        }
+        if (!free_list.empty()) {
+            page = free_list.head;
+            free_list.remove(*page);
+            break;
+        }
+        page = evict_page(u_lock);
+        if (page == nullptr) {
+            throw buffer_full_error();
+        }
+        if (page_table.find(page_id) == PageTable::kNotFound) {
             break;
         }
+        /// Another thread loaded the page while this one was writing back
+        /// the victim.
+        page->state = BufferFrame::FREE;
+        free_list.push_back(*page);
     }
-    assert(bufferframes.find(page_id) == bufferframes.end());
-    auto& page = bufferframes.emplace(
-            std::piecewise_construct,
-            std::forward_as_tuple(page_id),
-            std::forward_as_tuple(page_id, nullptr, fifo_list.end(), lru_list.end())
-            ).first->second;
-    page.set_num_fixed(page.get_num_fixed() + 1);
-    page.lock(true);
-    char* data;
-    if (bufferframes.size() - 1 >= page_count) {
-        data = evict_page(u_lock);
-        if (data == nullptr) {
-            page.set_num_fixed(page.get_num_fixed() - 1);
-            page.unlock();
-            if (page.get_num_fixed() == 0) {
-                assert(page.lru_position == lru_list.end() && page.fifo_position == fifo_list.end());
-                bufferframes.erase(page_id);
+    num_misses++;
+    page->pId = page_id;
+    page->state = BufferFrame::NEW;
+    page->isDirty = false;
+    page->load_failed = false;
+    page->set_num_fixed(1);
+    /// Nobody else references a frame that is not in the page table, so
+    /// latching it never blocks while the global mutex is held.
+    [[maybe_unused]] bool latched = page->shared_mutex.try_lock();
+    assert(latched);
+    page->version.fetch_add(1, std::memory_order_acq_rel);
+    page->exclusively_locked = true;
+    page_table.insert(page_id, static_cast<uint32_t>(page - frames.get()));
+    fifo_list.push_back(*page);
+    try {
+        /// A page in the compressed cache is as recent as the page on disk,
+        /// so try it before doing I/O.
+        bool cached = false;
+        if (compressed_cache) {
+            u_lock.unlock();
+            cached = compressed_cache->lookup(page_id, page->data);
+            u_lock.lock();
+        }
+        if (cached) {
+            num_compressed_hits++;
+        } else {
+            auto segment_id = get_segment_id(page_id);
+            auto segment_page_id = get_segment_page_id(page_id);
+            auto& file = get_segment_file(segment_id);
+            std::unique_lock file_latch{file.file_latch};
+            if (file.size() < (segment_page_id + 1) * page_size) {
+                file.resize((segment_page_id + 1) * page_size);
+                file_latch.unlock();
+                std::memset(page->data, 0, page_size);
+            } else {
+                file_latch.unlock();
+                u_lock.unlock();
+                file.read_block(segment_page_id * page_size, page_size, page->data);
+                u_lock.lock();
             }
-            throw buffer_full_error();
         }
-    } else {
-        data = &loaded_pages[(bufferframes.size() - 1) * page_size];
-    }
-    page.data = data;
-    page.state = BufferFrame::UNMOD;
-    page.fifo_position = fifo_list.insert(fifo_list.end(), &page);
-    auto segment_id = get_segment_id(page.pId);
-    auto segment_page_id = get_segment_page_id(page.pId);
-    SegmentFile* segment_file;
-    auto i = segment_files.find(segment_id);
-    if (i != segment_files.end()) {
-        segment_file = &i->second;
-    } else {
-        auto filename = std::to_string(segment_id);
-        //write dirty pages to file
-        segment_file = &segment_files.emplace(segment_id, File::open_file(filename.c_str(), File::WRITE)).first->second;
-    }
-    std::unique_lock file_latch{segment_file->file_latch};
-    auto& file = *segment_file->file;
-    if (file.size() < (segment_page_id + 1) * page_size) {
-        file.resize((segment_page_id + 1) * page_size);
-        file_latch.unlock();
-        std::memset(page.data, 0, page_size);
-    } else {
-        file_latch.unlock();
+    } catch (...) {
+        /// Give the frame back, threads that found the page in the meantime
+        /// see `load_failed` and the last of them frees the frame
+        if (!u_lock.owns_lock()) {
+            u_lock.lock();
+        }
+        page_table.erase(page_id);
+        fifo_list.remove(*page);
+        page->state = BufferFrame::FREE;
+        page->load_failed = true;
+        page->set_num_fixed(page->get_num_fixed() - 1);
+        if (page->get_num_fixed() == 0) {
+            free_list.push_back(*page);
+        }
         u_lock.unlock();
-        file.read_block(segment_page_id * page_size, page_size, page.data);
-        u_lock.lock();
+        page->unlock();
+        throw;
     }
-    page.state = BufferFrame::MOD;
-    page.isDirty = false;
-    page.unlock();
+    page->state = BufferFrame::MOD;
     u_lock.unlock();
-    page.lock(exclusive);
-    return page;
+    page->unlock();
+    return *page;
+}
+
+void BufferManager::release_frame(BufferFrame& page) {
+    page.set_num_fixed(page.get_num_fixed() - 1);
+    if (page.get_num_fixed() == 0 && page.load_failed && page.list == BufferFrame::NO_LIST) {
+        free_list.push_back(page);
+    }
 }
 
 void BufferManager::unfix_page(BufferFrame& page, bool is_dirty) {
@@ -161,12 +377,17 @@ void BufferManager::unfix_page(BufferFrame& page, bool is_dirty) {
     if (is_dirty) {
         page.isDirty = true;
     }
-    page.set_num_fixed(page.get_num_fixed() - 1);
+    release_frame(page);
+}
+
+void BufferManager::unfix_page_optimistic(BufferFrame& page) {
+    std::unique_lock u_lock(global_mutex);
+    release_frame(page);
 }
 
 std::vector<uint64_t> BufferManager::get_fifo_list() const {
     std::vector<uint64_t> v;
-    for (const auto& fifo : fifo_list) {
+    for (auto* fifo = fifo_list.head; fifo != nullptr; fifo = fifo->next) {
         v.push_back(fifo->pId);
     }
     return v;
@@ -174,28 +395,113 @@ std::vector<uint64_t> BufferManager::get_fifo_list() const {
 
 std::vector<uint64_t> BufferManager::get_lru_list() const {
     std::vector<uint64_t> v;
-    for (const auto& lru: lru_list) {
+    for (auto* lru = lru_list.head; lru != nullptr; lru = lru->next) {
         v.push_back(lru->pId);
     }
     return v;
 }
 
-char* BufferManager::evict_page(unique_lock<mutex>& latch) {
+void BufferManager::prefetch_page(uint64_t page_id) {
+    if (page_id == kInvalidPageId) {
+        return;
+    }
+    std::unique_lock u_lock(global_mutex);
+    if (page_table.find(page_id) != PageTable::kNotFound || prefetch_size == kPrefetchQueueSize) {
+        return;
+    }
+    if (!prefetch_thread.joinable()) {
+        prefetch_thread = std::thread([this] { prefetch_loop(); });
+    }
+    prefetch_queue[(prefetch_head + prefetch_size) % kPrefetchQueueSize] = page_id;
+    prefetch_size++;
+    prefetch_requested.notify_one();
+}
+
+void BufferManager::prefetch_loop() {
+    std::unique_lock u_lock(global_mutex);
+    while (true) {
+        prefetch_requested.wait(u_lock, [this] { return prefetch_stop || prefetch_size != 0; });
+        if (prefetch_stop) {
+            return;
+        }
+        uint64_t page_id = prefetch_queue[prefetch_head];
+        prefetch_head = (prefetch_head + 1) % kPrefetchQueueSize;
+        prefetch_size--;
+        u_lock.unlock();
+        /// Prefetching is only a hint, a page that cannot be loaded now is
+        /// loaded by the `fix_page()` that needs it.
+        try {
+            auto& page = fix_page_optimistic(page_id);
+            unfix_page_optimistic(page);
+        } catch (const std::exception&) {
+        }
+        u_lock.lock();
+    }
+}
+
+BufferManager::Statistics BufferManager::get_statistics() {
+    std::unique_lock u_lock(global_mutex);
+    Statistics statistics;
+    statistics.hits = num_hits;
+    statistics.misses = num_misses;
+    statistics.evictions = num_evictions;
+    statistics.writebacks = num_writebacks;
+    statistics.compressed_hits = num_compressed_hits;
+    return statistics;
+}
+
+void BufferManager::reset_statistics() {
+    std::unique_lock u_lock(global_mutex);
+    num_hits = 0;
+    num_misses = 0;
+    num_evictions = 0;
+    num_writebacks = 0;
+    num_compressed_hits = 0;
+}
+
+BufferManager::SegmentFile& BufferManager::get_segment_file(uint16_t segment_id) {
+    auto i = segment_files.find(segment_id);
+    if (i != segment_files.end()) {
+        return i->second;
+    }
+    /// The file is named after the segment id
+    char filename[8];
+    auto result = std::to_chars(filename, filename + sizeof(filename) - 1, segment_id);
+    *result.ptr = '\0';
+    if (!direct_io) {
+        return segment_files.emplace(segment_id, File::open_file(filename, File::WRITE)).first->second;
+    }
+    int fd = ::open(filename, O_RDWR | O_CREAT | O_DIRECT, 0666);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open segment file with O_DIRECT");
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) < 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot stat segment file");
+    }
+    return segment_files.emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(segment_id),
+            std::forward_as_tuple(fd, static_cast<size_t>(file_stat.st_size))
+            ).first->second;
+}
+
+BufferFrame* BufferManager::evict_page(unique_lock<mutex>& latch) {
     BufferFrame* page_to_evict;
     while (true) {
         /// Need to evict another page. If no page can be evict
-        bool found = false;
         page_to_evict = nullptr;
-        for (auto* page : fifo_list) {
+        for (auto* page = fifo_list.head; page != nullptr; page = page->next) {
             if (page->state == BufferFrame::MOD && page->get_num_fixed() == 0) {
                 page_to_evict = page;
-                found = true;
                 break;
             }
         }
         /// If FIFO list is empty or all pages in FIFO List are fixed, try to evcit in LRU List
-        if (!found) {
-            for (auto* page : lru_list) {
+        if (page_to_evict == nullptr) {
+            for (auto* page = lru_list.head; page != nullptr; page = page->next) {
                 if (page->state == BufferFrame::MOD && page->get_num_fixed() == 0) {
                     page_to_evict = page;
                     break;
@@ -205,34 +511,78 @@ char* BufferManager::evict_page(unique_lock<mutex>& latch) {
         if (page_to_evict == nullptr) {
             return nullptr;
         }
-        assert(page_to_evict->state == BufferFrame::MOD);
         page_to_evict->state = BufferFrame::EVICT;
-        if (!page_to_evict->isDirty) {
+        /// A cached copy of a clean page is identical to it, and a page
+        /// that did not compress still does not
+        if (!page_to_evict->isDirty && (!compressed_cache || compressed_cache->contains(page_to_evict->pId))) {
             break;
         }
-        /// Create a copy pf the page that is written to the file so that other threads can continue using it while it is being written
-        auto page_data = std::make_unique<char[]>(page_size);
-        std::memcpy(page_data.get(), page_to_evict->data, page_size);
-        BufferFrame page_copy{page_to_evict->pId, page_data.get(), fifo_list.end(), lru_list.end()};
-        auto& file = *segment_files.find(get_segment_id(page_copy.pId))->second.file;
-        latch.unlock();
-        file.write_block(page_copy.data, get_segment_page_id(page_copy.pId) * page_size, page_size);
-        latch.lock();
-        page_copy.isDirty = false;
+        /// Copy the page to a staging buffer that is written to the file or
+        /// compressed, so that other threads can continue using it meanwhile
+        while (writeback_buffers_used == (1u << kWritebackBuffers) - 1) {
+            writeback_buffer_released.wait(latch);
+        }
+        if (page_to_evict->state == BufferFrame::RELOAD) {
+            /// The page was fixed while waiting for a staging buffer
+            page_to_evict->state = BufferFrame::MOD;
+            continue;
+        }
+        size_t buffer = 0;
+        while (writeback_buffers_used & (1u << buffer)) {
+            buffer++;
+        }
+        writeback_buffers_used |= 1u << buffer;
+        char* page_copy = &writeback_buffers[buffer * page_size];
+        std::memcpy(page_copy, page_to_evict->data, page_size);
+        auto page_id = page_to_evict->pId;
+        if (!page_to_evict->isDirty) {
+            latch.unlock();
+            compressed_cache->insert(page_id, page_copy);
+            latch.lock();
+            writeback_buffers_used &= ~(1u << buffer);
+            writeback_buffer_released.notify_one();
+        } else {
+            /// Every exclusive latch changes the version, so an unchanged
+            /// version after the write means the copy is still the page
+            auto version = page_to_evict->version.load(std::memory_order_acquire);
+            auto& file = segment_files.find(get_segment_id(page_id))->second;
+            latch.unlock();
+            try {
+                file.write_block(page_copy, get_segment_page_id(page_id) * page_size, page_size);
+            } catch (...) {
+                /// The page stays dirty and can be evicted again later
+                latch.lock();
+                writeback_buffers_used &= ~(1u << buffer);
+                writeback_buffer_released.notify_one();
+                page_to_evict->state = BufferFrame::MOD;
+                throw;
+            }
+            /// Cache the version that is now on disk
+            if (compressed_cache) {
+                compressed_cache->insert(page_id, page_copy);
+            }
+            latch.lock();
+            writeback_buffers_used &= ~(1u << buffer);
+            writeback_buffer_released.notify_one();
+            num_writebacks++;
+            if (page_to_evict->version.load(std::memory_order_acquire) == version) {
+                page_to_evict->isDirty = false;
+            }
+        }
         assert(page_to_evict->state == BufferFrame::EVICT || page_to_evict->state == BufferFrame::RELOAD);
         if (page_to_evict->state == BufferFrame::EVICT) {
             break;
         }
         page_to_evict->state = BufferFrame::MOD;
     }
-    if (page_to_evict->lru_position == lru_list.end()) {
-        assert(page_to_evict->fifo_position != fifo_list.end());
-        fifo_list.erase(page_to_evict->fifo_position);
+    if (page_to_evict->list == BufferFrame::FIFO_LIST) {
+        fifo_list.remove(*page_to_evict);
     } else {
-        lru_list.erase(page_to_evict->lru_position);
+        lru_list.remove(*page_to_evict);
     }
-    char* data = page_to_evict->data;
-    bufferframes.erase(page_to_evict->pId);
-    return data;
+    page_table.erase(page_to_evict->pId);
+    page_to_evict->state = BufferFrame::FREE;
+    num_evictions++;
+    return page_to_evict;
+}
 }
-}
\ No newline at end of file
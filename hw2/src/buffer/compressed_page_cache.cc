@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "buffer/compressed_page_cache.h"
+
+namespace buzzdb {
+
+namespace {
+
+/// Shortest match that is encoded as a back reference.
+constexpr size_t kMinMatch = 4;
+/// Number of bits of the match finder's hash table.
+constexpr int kHashLog = 12;
+/// Largest distance a back reference can span.
+constexpr size_t kMaxOffset = 65535;
+
+uint32_t hash_sequence(const char* data) {
+    uint32_t sequence;
+    std::memcpy(&sequence, data, sizeof(sequence));
+    return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+/// Returns a buffer of at least `size` bytes that is private to the calling
+/// thread, so that pages are compressed and decompressed without holding the
+/// latch of the cache.
+char* scratch_buffer(size_t size) {
+    thread_local std::vector<char> buffer;
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+/// Writes the remainder of a length that did not fit into its 4 bit token
+/// field as a run of 255 bytes and a final byte.
+bool write_length(size_t length, char* dst, size_t& op, size_t capacity) {
+    while (length >= 255) {
+        if (op >= capacity) {
+            return false;
+        }
+        dst[op++] = static_cast<char>(255);
+        length -= 255;
+    }
+    if (op >= capacity) {
+        return false;
+    }
+    dst[op++] = static_cast<char>(length);
+    return true;
+}
+
+/// Reads a length written by `write_length()`.
+bool read_length(const char* src, size_t& ip, size_t size, size_t& length) {
+    while (true) {
+        if (ip >= size) {
+            return false;
+        }
+        auto byte = static_cast<uint8_t>(src[ip++]);
+        length += byte;
+        if (byte != 255) {
+            return true;
+        }
+    }
+}
+
+/// Emits one sequence: literals followed by an optional back reference
+/// (`match_length` is 0 for the last sequence).
+bool write_sequence(const char* literals, size_t literal_length, size_t offset, size_t match_length,
+                    char* dst, size_t& op, size_t capacity) {
+    if (op >= capacity) {
+        return false;
+    }
+    size_t token_op = op++;
+    uint8_t token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15 && !write_length(literal_length - 15, dst, op, capacity)) {
+        return false;
+    }
+    if (op + literal_length > capacity) {
+        return false;
+    }
+    std::memcpy(dst + op, literals, literal_length);
+    op += literal_length;
+    if (match_length != 0) {
+        size_t length = match_length - kMinMatch;
+        token |= static_cast<uint8_t>(std::min<size_t>(length, 15));
+        if (op + 2 > capacity) {
+            return false;
+        }
+        dst[op++] = static_cast<char>(offset & 0xff);
+        dst[op++] = static_cast<char>(offset >> 8);
+        if (length >= 15 && !write_length(length - 15, dst, op, capacity)) {
+            return false;
+        }
+    }
+    dst[token_op] = static_cast<char>(token);
+    return true;
+}
+
+}  // namespace
+
+size_t CompressedPageCache::compress(const char* src, size_t size, char* dst, size_t capacity) {
+    uint32_t table[1 << kHashLog];
+    std::fill(std::begin(table), std::end(table), kNone);
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    while (ip + kMinMatch <= size) {
+        uint32_t hash = hash_sequence(src + ip);
+        uint32_t ref = table[hash];
+        table[hash] = static_cast<uint32_t>(ip);
+        if (ref == kNone || ip - ref > kMaxOffset || std::memcmp(src + ref, src + ip, kMinMatch) != 0) {
+            ip++;
+            continue;
+        }
+        size_t match_length = kMinMatch;
+        while (ip + match_length < size && src[ref + match_length] == src[ip + match_length]) {
+            match_length++;
+        }
+        if (!write_sequence(src + anchor, ip - anchor, ip - ref, match_length, dst, op, capacity)) {
+            return 0;
+        }
+        ip += match_length;
+        anchor = ip;
+    }
+    if (!write_sequence(src + anchor, size - anchor, 0, 0, dst, op, capacity)) {
+        return 0;
+    }
+    return op;
+}
+
+bool CompressedPageCache::decompress(const char* src, size_t size, char* dst, size_t dst_size) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < size) {
+        auto token = static_cast<uint8_t>(src[ip++]);
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(src, ip, size, literal_length)) {
+            return false;
+        }
+        if (ip + literal_length > size || op + literal_length > dst_size) {
+            return false;
+        }
+        std::memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == size) {
+            break;
+        }
+        if (ip + 2 > size) {
+            return false;
+        }
+        size_t offset = static_cast<uint8_t>(src[ip]) | (static_cast<size_t>(static_cast<uint8_t>(src[ip + 1])) << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(src, ip, size, match_length)) {
+            return false;
+        }
+        match_length += kMinMatch;
+        if (offset == 0 || offset > op || op + match_length > dst_size) {
+            return false;
+        }
+        if (offset >= match_length) {
+            std::memcpy(dst + op, dst + op - offset, match_length);
+        } else {
+            /// Overlapping match, e.g. a run of a repeated byte
+            for (size_t i = 0; i < match_length; i++) {
+                dst[op + i] = dst[op - offset + i];
+            }
+        }
+        op += match_length;
+    }
+    return op == dst_size;
+}
+
+size_t CompressedPageCache::chunk_count(size_t capacity) {
+    /// The memory usage grows with the number of chunks, binary search the
+    /// largest number that fits
+    size_t low = 1;
+    size_t high = std::max<size_t>(capacity / kChunkSize, 1);
+    while (low < high) {
+        size_t middle = low + (high - low + 1) / 2;
+        if (memory_usage(middle) <= capacity) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+size_t CompressedPageCache::memory_usage(size_t num_chunks) {
+    size_t num_entries = std::max<size_t>(num_chunks / kChunksPerEntry, 1);
+    return num_chunks * (kChunkSize + sizeof(uint32_t)) + num_entries * sizeof(Entry) +
+        PageTable::memory_usage(num_entries);
+}
+
+CompressedPageCache::CompressedPageCache(size_t page_size, size_t capacity)
+    : page_size(page_size), num_chunks(chunk_count(capacity)),
+      num_entries(std::max<size_t>(num_chunks / kChunksPerEntry, 1)),
+      chunks(std::make_unique<char[]>(num_chunks * kChunkSize)),
+      chunk_next(std::make_unique<uint32_t[]>(num_chunks)),
+      entries(std::make_unique<Entry[]>(num_entries)),
+      page_table(num_entries) {
+    for (size_t i = num_chunks; i-- > 0;) {
+        chunk_next[i] = free_chunk;
+        free_chunk = static_cast<uint32_t>(i);
+    }
+    num_free_chunks = num_chunks;
+    for (size_t i = num_entries; i-- > 0;) {
+        entries[i].next = free_entry;
+        free_entry = static_cast<uint32_t>(i);
+    }
+}
+
+bool CompressedPageCache::lookup(uint64_t page_id, char* data) {
+    char* compressed = scratch_buffer(page_size);
+    size_t compressed_size;
+    {
+        std::unique_lock lock(latch);
+        auto index = page_table.find(page_id);
+        if (index == PageTable::kNotFound || entries[index].first_chunk == kNone) {
+            return false;
+        }
+        auto& entry = entries[index];
+        /// Gather the chunks, the entry may be dropped once the latch is
+        /// released
+        compressed_size = entry.compressed_size;
+        size_t copied = 0;
+        for (uint32_t chunk = entry.first_chunk; chunk != kNone; chunk = chunk_next[chunk]) {
+            size_t length = std::min(kChunkSize, compressed_size - copied);
+            std::memcpy(&compressed[copied], &chunks[chunk * kChunkSize], length);
+            copied += length;
+        }
+    }
+    /// A malformed copy is treated as a miss, the caller then reads the page
+    /// from disk
+    return decompress(compressed, compressed_size, data, page_size);
+}
+
+bool CompressedPageCache::contains(uint64_t page_id) {
+    std::unique_lock lock(latch);
+    return page_table.find(page_id) != PageTable::kNotFound;
+}
+
+void CompressedPageCache::insert(uint64_t page_id, const char* data) {
+    char* compressed = scratch_buffer(page_size);
+    size_t compressed_size = compress(data, page_size, compressed, page_size / 4 * 3);
+    size_t needed = (compressed_size + kChunkSize - 1) / kChunkSize;
+    if (needed > num_chunks) {
+        compressed_size = 0;
+        needed = 0;
+    }
+    std::unique_lock lock(latch);
+    auto index = page_table.find(page_id);
+    if (index != PageTable::kNotFound) {
+        remove_entry(index);
+    }
+    while (num_free_chunks < needed || free_entry == kNone) {
+        remove_entry(oldest);
+    }
+    /// Take the entry and the chunks from their free lists
+    uint32_t entry_index = free_entry;
+    auto& entry = entries[entry_index];
+    free_entry = entry.next;
+    entry.page_id = page_id;
+    entry.compressed_size = static_cast<uint32_t>(compressed_size);
+    entry.first_chunk = needed == 0 ? kNone : free_chunk;
+    uint32_t chunk = free_chunk;
+    for (size_t i = 0; i < needed; i++) {
+        size_t offset = i * kChunkSize;
+        std::memcpy(&chunks[chunk * kChunkSize], &compressed[offset], std::min(kChunkSize, compressed_size - offset));
+        if (i + 1 == needed) {
+            free_chunk = chunk_next[chunk];
+            chunk_next[chunk] = kNone;
+        } else {
+            chunk = chunk_next[chunk];
+        }
+    }
+    num_free_chunks -= needed;
+    /// Append to the insertion order list
+    entry.prev = newest;
+    entry.next = kNone;
+    if (newest != kNone) {
+        entries[newest].next = entry_index;
+    } else {
+        oldest = entry_index;
+    }
+    newest = entry_index;
+    page_table.insert(page_id, entry_index);
+}
+
+void CompressedPageCache::erase(uint64_t page_id) {
+    std::unique_lock lock(latch);
+    auto index = page_table.find(page_id);
+    if (index != PageTable::kNotFound) {
+        remove_entry(index);
+    }
+}
+
+void CompressedPageCache::remove_entry(uint32_t entry_index) {
+    auto& entry = entries[entry_index];
+    if (entry.prev != kNone) {
+        entries[entry.prev].next = entry.next;
+    } else {
+        oldest = entry.next;
+    }
+    if (entry.next != kNone) {
+        entries[entry.next].prev = entry.prev;
+    } else {
+        newest = entry.prev;
+    }
+    page_table.erase(entry.page_id);
+    /// Give the chunks back
+    if (entry.first_chunk != kNone) {
+        uint32_t last = entry.first_chunk;
+        size_t count = 1;
+        while (chunk_next[last] != kNone) {
+            last = chunk_next[last];
+            count++;
+        }
+        chunk_next[last] = free_chunk;
+        free_chunk = entry.first_chunk;
+        num_free_chunks += count;
+    }
+    entry.first_chunk = kNone;
+    entry.prev = kNone;
+    entry.next = free_entry;
+    free_entry = entry_index;
+}
+
+}  // namespace buzzdb
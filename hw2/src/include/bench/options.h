@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace buzzdb {
+namespace bench {
+
+/// Parses the `--name=value` command line arguments of the benchmarks into
+/// the variables registered with `add()`. Unknown options and values that
+/// do not parse end the program with an error message.
+class OptionParser {
+ public:
+    /// Registers the option `--name=value` that is stored in `target`.
+    /// Integers, floating point numbers, `bool` (`0` or `1`) and strings are
+    /// supported.
+    template<typename T>
+    void add(const char* name, T& target) {
+        options.emplace_back(name, [&target](const std::string& value) {
+            if constexpr (std::is_same_v<T, bool>) {
+                target = std::stoul(value) != 0;
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                target = value;
+            } else if constexpr (std::is_floating_point_v<T>) {
+                target = static_cast<T>(std::stod(value));
+            } else {
+                static_assert(std::is_integral_v<T> && std::is_unsigned_v<T>, "unsupported option type");
+                target = static_cast<T>(std::stoull(value));
+            }
+        });
+    }
+
+    /// Parses all arguments but the program name.
+    void parse(int argc, char** argv) const {
+        for (int i = 1; i < argc; i++) {
+            parse(argv[i]);
+        }
+    }
+
+    /// Ends the program with `message` unless `condition` holds.
+    static void require(bool condition, const char* message) {
+        if (!condition) {
+            std::cerr << message << std::endl;
+            std::exit(1);
+        }
+    }
+
+ private:
+    void parse(const char* arg) const {
+        for (auto& [name, store] : options) {
+            if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name.c_str(), name.size()) != 0 ||
+                arg[2 + name.size()] != '=') {
+                continue;
+            }
+            try {
+                store(arg + 3 + name.size());
+            } catch (const std::exception&) {
+                require(false, ("invalid value: " + std::string(arg)).c_str());
+            }
+            return;
+        }
+        require(false, ("unknown option: " + std::string(arg)).c_str());
+    }
+
+    /// The registered options and how their values are stored.
+    std::vector<std::pair<std::string, std::function<void(const std::string&)>>> options;
+};
+
+}  // namespace bench
+}  // namespace buzzdb
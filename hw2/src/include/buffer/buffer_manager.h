@@ -1,17 +1,22 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
 #include <vector>
 #include <memory>
-#include <list>
 #include <shared_mutex>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <unordered_map>
 #include <string>
 
+#include "buffer/compressed_page_cache.h"
+#include "buffer/page_table.h"
 #include "common/macros.h"
 #include "storage/file.h"
 
@@ -23,29 +28,47 @@ class BufferFrame {
 private:
     friend class BufferManager;
 
-    using list_position = std::list<BufferFrame*>::iterator;
-
     enum BufferFrameState {
-        NEW,
-        UNMOD,      /// data loaded and unmodified => not to flush to dish
-        MOD,	    /// data loaded and modified => flush to disk
-        EVICT,
-        RELOAD
+        FREE,       /// frame holds no page and is in the free list
+        NEW,        /// page is being loaded, the loading thread holds the latch exclusively
+        MOD,        /// data loaded, the frame may be evicted when it is unfixed
+        EVICT,      /// a copy of the page is being written back before eviction
+        RELOAD      /// the page was fixed again during the write back => keep it
+    };
+
+    /// The replacement list the frame is linked into.
+    enum ListKind {
+        NO_LIST,
+        FREE_LIST,
+        FIFO_LIST,
+        LRU_LIST
     };
-    BufferFrameState state = NEW;
-    uint64_t pId;
-    char* data;
+
+    BufferFrameState state = FREE;
+    uint64_t pId = 0;
+    char* data = nullptr;
     std::shared_mutex shared_mutex;
 
+    /// Incremented when the frame is latched exclusively and again when the
+    /// exclusive latch is released, so it is odd while a writer holds the
+    /// latch and changes whenever the page may have been modified.
+    std::atomic<uint64_t> version{0};
+
     /// How many times page has been fixed
     size_t num_fixed = 0;
 
     bool exclusively_locked = false;
     bool isDirty = false;
 
-    /// Position of BufferFrame in the FIFO List
-    list_position  fifo_position;
-    list_position lru_position;
+    /// Set by the thread that loads the page when the load fails. The frame
+    /// then holds no page and is freed by the last unfix, threads that
+    /// waited for the page load it again.
+    bool load_failed = false;
+
+    /// Intrusive links of the replacement list the frame is in
+    ListKind list = NO_LIST;
+    BufferFrame* prev = nullptr;
+    BufferFrame* next = nullptr;
 
     void lock(const bool exclusive_lock);
     void unlock();
@@ -62,15 +85,53 @@ private:
     void set_num_fixed(size_t num_fixed) { 
         this->num_fixed = num_fixed;
     }
-    /**
-     * Open the file associated with the BufferFrame, create if necessary.
-     * Allocate enough memory and filesize
-     * (and read the data from the file into an internal buffer) <- not here
-     * @param pageId the page ID of the frame
-     * @param size how much space is needed
-     * @throws runtime_error, if the file can't be opened, created or stated
-     */
-     BufferFrame(const uint64_t pageId, char* data, list_position  fifo_position, list_position lru_position);
+
+    /// Returns the version of the frame's latch. It is odd while the frame is
+    /// latched exclusively.
+    uint64_t get_version() const {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /// Upgrades the shared latch of a fixed page to an exclusive latch.
+    /// `std::shared_mutex` cannot upgrade atomically, so the shared latch is
+    /// released first and another writer may latch the page in between.
+    /// The page is latched exclusively when this returns.
+    /// @return true if no other writer latched the page in between, i.e.
+    ///         everything read under the shared latch is still valid.
+    bool upgrade();
+
+    /// Downgrades the exclusive latch of a fixed page to a shared latch.
+    /// The page is latched shared when this returns.
+    /// @return true if no other writer latched the page in between.
+    bool downgrade();
+
+    /// Starts an optimistic read of a page that was fixed with
+    /// `BufferManager::fix_page_optimistic()`. Waits until no writer holds
+    /// the latch and returns the version to pass to `validate()`.
+    uint64_t read_optimistic() const;
+
+    /// Returns whether no writer latched the page since `read_optimistic()`
+    /// returned `version`, i.e. whether the data read in between is
+    /// consistent.
+    bool validate(uint64_t version) const;
+
+    /// Latches a page that was fixed with `fix_page_optimistic()`
+    /// exclusively, if it did not change since `read_optimistic()` returned
+    /// `version`. Otherwise the page is left unlatched.
+    /// @return whether the page is latched.
+    bool upgrade_optimistic(uint64_t version);
+
+    /// Latches a page that was fixed with `fix_page_optimistic()` shared, if
+    /// it did not change since `read_optimistic()` returned `version`.
+    /// Otherwise the page is left unlatched.
+    /// @return whether the page is latched.
+    bool share_optimistic(uint64_t version);
+
+    /// Frames are preallocated by the buffer manager and reused for different
+    /// pages, they are not constructed per page.
+    BufferFrame() = default;
+    BufferFrame(const BufferFrame&) = delete;
+    BufferFrame& operator=(const BufferFrame&) = delete;
     };
 
 
@@ -84,34 +145,164 @@ private:
 
     struct SegmentFile {
         std::mutex file_latch;
+        /// The file of the segment when it uses the OS page cache.
         std::unique_ptr<File> file;
+        /// The descriptor of the segment when it was opened with O_DIRECT,
+        /// -1 otherwise.
+        int direct_fd = -1;
+        /// The size of the direct file in bytes.
+        size_t direct_size = 0;
+
         explicit SegmentFile(std::unique_ptr<File> file) : file(std::move(file)) {}
+        SegmentFile(int direct_fd, size_t direct_size) : direct_fd(direct_fd), direct_size(direct_size) {}
+        ~SegmentFile();
+
+        /// Returns the size of the segment file in bytes.
+        size_t size() const;
+        /// Resizes the segment file.
+        void resize(size_t new_size);
+        /// Reads `size` bytes at `offset` into `block`. For direct files
+        /// `block`, `offset` and `size` must be aligned to
+        /// `kDirectIOAlignment`.
+        void read_block(size_t offset, size_t size, char* block);
+        /// Writes `size` bytes from `block` at `offset`. Same alignment
+        /// requirements as `read_block()`.
+        void write_block(const char* block, size_t offset, size_t size);
+    };
+
+    /// Frees memory returned by `allocate_pages()`.
+    struct PageDeleter {
+        void operator()(char* pages) const;
     };
+    using PageMemory = std::unique_ptr<char[], PageDeleter>;
+
+    /// Doubly linked list threaded through the frames, so moving frames
+    /// between lists never allocates.
+    struct FrameList {
+        BufferFrame::ListKind kind;
+        BufferFrame* head = nullptr;
+        BufferFrame* tail = nullptr;
+
+        explicit FrameList(BufferFrame::ListKind kind) : kind(kind) {}
+        bool empty() const { return head == nullptr; }
+        void push_back(BufferFrame& frame);
+        void remove(BufferFrame& frame);
+    };
+
+    /// Number of staging buffers evicted pages are copied to while they are
+    /// written back or compressed.
+    static constexpr size_t kWritebackBuffers = 4;
 
     const size_t page_size;
 
     const size_t page_count;
-    std::list<BufferFrame*> fifo_list;
-    std::list<BufferFrame*> lru_list;
+
+    /// Bypass the OS page cache for all segment files.
+    const bool direct_io;
 
     std::mutex global_mutex;
-    std::unique_ptr<char[]> loaded_pages;
+    PageMemory loaded_pages;
+    std::unique_ptr<BufferFrame[]> frames;
+    /// Maps page ids to the index of their frame in `frames`.
+    PageTable page_table;
+    FrameList free_list{BufferFrame::FREE_LIST};
+    FrameList fifo_list{BufferFrame::FIFO_LIST};
+    FrameList lru_list{BufferFrame::LRU_LIST};
     std::unordered_map<uint16_t, SegmentFile> segment_files;
-    std::unordered_map<uint64_t, BufferFrame> bufferframes;
+
+    /// Compressed copies of evicted pages, nullptr when disabled.
+    std::unique_ptr<CompressedPageCache> compressed_cache;
+
+    /// Staging buffers for write back and compression, a set bit in `writeback_buffers_used`
+    /// marks a buffer as taken. Protected by the global mutex.
+    PageMemory writeback_buffers;
+    uint32_t writeback_buffers_used = 0;
+    std::condition_variable writeback_buffer_released;
+
+    /// Maximum number of pages waiting to be prefetched.
+    static constexpr size_t kPrefetchQueueSize = 64;
+
+    /// Ring buffer of the page ids passed to `prefetch_page()`, protected by
+    /// the global mutex. The prefetch thread is started on first use.
+    std::array<uint64_t, kPrefetchQueueSize> prefetch_queue;
+    size_t prefetch_head = 0;
+    size_t prefetch_size = 0;
+    bool prefetch_stop = false;
+    std::condition_variable prefetch_requested;
+    std::thread prefetch_thread;
+
+    /// Counters for `get_statistics()`, protected by the global mutex.
+    uint64_t num_hits = 0;
+    uint64_t num_misses = 0;
+    uint64_t num_evictions = 0;
+    uint64_t num_writebacks = 0;
+    uint64_t num_compressed_hits = 0;
 
     /**
      * Evicts a page from the buffer
      * @param latch must be the locked directory latch
-     * @return the data pointer to the evicted page. When no page can be evicted, return nullptr
+     * @return the frame of the evicted page. When no page can be evicted, return nullptr
      */
-    char* evict_page(std::unique_lock<std::mutex>& latch);
+    BufferFrame* evict_page(std::unique_lock<std::mutex>& latch);
+
+    /// Loads the pages queued by `prefetch_page()` until the buffer manager
+    /// is destroyed.
+    void prefetch_loop();
+
+    /// Unfixes a page. A frame whose load failed is put into the free list
+    /// by its last unfix. The global mutex must be held.
+    void release_frame(BufferFrame& page);
+
+    /// Moves a frame that was hit to the tail of the LRU list.
+    void touch_page(BufferFrame& page);
+
+    /// Returns the file of a segment, opens it if necessary. The global
+    /// mutex must be held.
+    SegmentFile& get_segment_file(uint16_t segment_id);
+
+    /// Allocates `size` bytes of page memory. The memory is aligned to
+    /// `kDirectIOAlignment` so that it can be used for direct I/O.
+    static PageMemory allocate_pages(size_t size);
 
 public:
+    /// A page id that no page has. Data structures use it for missing links,
+    /// e.g. the neighbor of the last leaf of a B+-tree.
+    static constexpr uint64_t kInvalidPageId = UINT64_MAX;
+
+    /// Alignment of page memory, page sizes and file offsets that direct I/O
+    /// requires.
+    static constexpr size_t kDirectIOAlignment = 4096;
+
+    /// Counters describing the work done by the buffer manager since it was
+    /// created or since the last call to `reset_statistics()`.
+    struct Statistics {
+        /// Calls to `fix_page()` that found the page in memory.
+        uint64_t hits = 0;
+        /// Calls to `fix_page()` that had to load the page.
+        uint64_t misses = 0;
+        /// Pages that were evicted to make room for another page.
+        uint64_t evictions = 0;
+        /// Dirty pages that were written to disk during eviction.
+        uint64_t writebacks = 0;
+        /// Misses that were served from the compressed page cache instead of
+        /// reading the page from disk.
+        uint64_t compressed_hits = 0;
+    };
+
     /// Constructor.
     /// @param[in] page_size  Size in bytes that all pages will have.
     /// @param[in] page_count Maximum number of pages that should reside in
     ///                       memory at the same time.
-    BufferManager(size_t page_size, size_t page_count);
+    /// @param[in] direct_io  Open segment files with O_DIRECT so that pages
+    ///                       are only cached in the buffer manager and not
+    ///                       additionally in the OS page cache. `page_size`
+    ///                       must then be a multiple of `kDirectIOAlignment`,
+    ///                       otherwise `std::invalid_argument` is thrown.
+    /// @param[in] compressed_cache_size
+    ///                       Memory budget in bytes of a second-tier cache
+    ///                       that keeps evicted pages compressed in memory.
+    ///                       0 disables the cache.
+    BufferManager(size_t page_size, size_t page_count, bool direct_io = false, size_t compressed_cache_size = 0);
 
     /// Destructor. Writes all dirty pages to disk.
     ~BufferManager();
@@ -129,11 +320,29 @@ public:
     ///                      non-exclusively (shared).
     BufferFrame& fix_page(uint64_t page_id, bool exclusive);
 
+    /// Like `fix_page()` but does not latch the page. The page stays in
+    /// memory until it is released with `unfix_page_optimistic()`, or with
+    /// `unfix_page()` after `BufferFrame::upgrade_optimistic()` succeeded.
+    /// Readers detect concurrent writers with `BufferFrame::read_optimistic()`
+    /// and `BufferFrame::validate()`.
+    BufferFrame& fix_page_optimistic(uint64_t page_id);
+
     /// Takes a `BufferFrame` reference that was returned by an earlier call to
     /// `fix_page()` and unfixes it. When `is_dirty` is / true, the page is
     /// written back to disk eventually.
     void unfix_page(BufferFrame& page, bool is_dirty);
 
+    /// Releases a page that was fixed with `fix_page_optimistic()` and is not
+    /// latched.
+    void unfix_page_optimistic(BufferFrame& page);
+
+    /// Asks a background thread to load the page if it is not in memory, so
+    /// that a later `fix_page()` is likely to hit. Returns immediately. The
+    /// request is dropped when too many prefetches are pending, the page
+    /// cannot be loaded or `page_id` is `kInvalidPageId`.
+    /// Is thread-safe.
+    void prefetch_page(uint64_t page_id);
+
     /// Returns the page ids of all pages (fixed and unfixed) that are in the
     /// FIFO list in FIFO order.
     /// Is not thread-safe.
@@ -144,6 +353,14 @@ public:
     /// Is not thread-safe.
     std::vector<uint64_t> get_lru_list() const;
 
+    /// Returns a snapshot of the counters.
+    /// Is thread-safe.
+    Statistics get_statistics();
+
+    /// Sets all counters to zero.
+    /// Is thread-safe.
+    void reset_statistics();
+
     /// Returns the segment id for a given page id which is contained in the 16
     /// most significant bits of the page id.
     static constexpr uint16_t get_segment_id(uint64_t page_id) { return page_id >> 48; }
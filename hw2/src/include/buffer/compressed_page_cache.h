@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "buffer/page_table.h"
+
+namespace buzzdb {
+
+/// Second-tier cache for pages that were evicted from the buffer manager.
+/// Pages are kept LZ4-style compressed in a fixed memory budget, so a miss in
+/// the buffer pool that hits here costs a decompression instead of a read.
+///
+/// The cache only holds copies of pages whose current version is also on
+/// disk, so entries can be dropped at any time without writing them back.
+/// Compressed pages are stored in chains of fixed-size chunks and the oldest
+/// pages are dropped first when the budget is exhausted. Pages that do not
+/// compress well are remembered with an entry without chunks, so that they
+/// are not compressed again on every eviction. All memory of the cache is
+/// allocated up front, compression and decompression run outside of its
+/// latch. Is thread-safe.
+class CompressedPageCache {
+ public:
+    /// Constructor.
+    /// @param[in] page_size Size in bytes of the pages that are cached.
+    /// @param[in] capacity  Memory budget in bytes for the compressed pages
+    ///                      and the metadata of the cache.
+    CompressedPageCache(size_t page_size, size_t capacity);
+
+    /// Decompresses the page into `data` when a copy of it is cached.
+    /// @return whether `data` holds the page.
+    bool lookup(uint64_t page_id, char* data);
+
+    /// Returns whether the cache knows the current version of the page: it
+    /// holds a copy of it, or it knows that the page does not compress.
+    bool contains(uint64_t page_id);
+
+    /// Stores a compressed copy of the page, replacing an older copy. Pages
+    /// that do not compress to at most 3/4 of their size are only
+    /// remembered as incompressible.
+    void insert(uint64_t page_id, const char* data);
+
+    /// Removes the page if it is cached.
+    void erase(uint64_t page_id);
+
+    /// Compresses `size` bytes from `src` into `dst`.
+    /// @return the compressed size or 0 if it would exceed `capacity`.
+    static size_t compress(const char* src, size_t size, char* dst, size_t capacity);
+
+    /// Decompresses `size` bytes from `src` into exactly `dst_size` bytes.
+    /// @return false if the input is malformed.
+    static bool decompress(const char* src, size_t size, char* dst, size_t dst_size);
+
+ private:
+    /// Chunk size in bytes of the compressed page storage.
+    static constexpr size_t kChunkSize = 128;
+    /// Chunks per entry. Compressed pages take several chunks, so this only
+    /// limits the number of cached pages that do not compress.
+    static constexpr size_t kChunksPerEntry = 4;
+
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Entry {
+        uint64_t page_id = 0;
+        /// `kNone` for a page that does not compress.
+        uint32_t first_chunk = kNone;
+        uint32_t compressed_size = 0;
+        /// Links of the insertion order list, or of the free list.
+        uint32_t prev = kNone;
+        uint32_t next = kNone;
+    };
+
+    /// Returns the largest number of chunks whose storage and metadata fit
+    /// into `capacity` bytes.
+    static size_t chunk_count(size_t capacity);
+
+    /// Returns the bytes allocated by a cache with `num_chunks` chunks.
+    static size_t memory_usage(size_t num_chunks);
+
+    /// Unlinks the entry from the insertion order list and frees it together
+    /// with its chunks.
+    void remove_entry(uint32_t entry);
+
+    const size_t page_size;
+    const size_t num_chunks;
+    const size_t num_entries;
+
+    std::mutex latch;
+    std::unique_ptr<char[]> chunks;
+    /// Next chunk of the same page, or of the free list.
+    std::unique_ptr<uint32_t[]> chunk_next;
+    uint32_t free_chunk = kNone;
+    size_t num_free_chunks = 0;
+
+    std::unique_ptr<Entry[]> entries;
+    uint32_t free_entry = kNone;
+    /// Oldest and newest cached page.
+    uint32_t oldest = kNone;
+    uint32_t newest = kNone;
+    /// Maps page ids to the index of their entry.
+    PageTable page_table;
+};
+
+}  // namespace buzzdb
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace buzzdb {
+
+/// Fixed-capacity hash table that maps page ids to slot indexes (e.g. the
+/// index of a buffer frame). Uses open addressing with linear probing and
+/// backward-shift deletion, so lookups, inserts and erases never allocate.
+/// Not thread-safe.
+class PageTable {
+ public:
+    /// Returned by `find()` when the page id is not in the table.
+    static constexpr uint32_t kNotFound = std::numeric_limits<uint32_t>::max();
+
+    /// Constructor.
+    /// @param[in] max_entries The maximum number of entries that will be in
+    ///                        the table at the same time. The table keeps its
+    ///                        load factor at or below 50%.
+    explicit PageTable(size_t max_entries) {
+        capacity = slot_count(max_entries);
+        mask = capacity - 1;
+        slots = std::make_unique<Slot[]>(capacity);
+    }
+
+    /// Returns the bytes that a table for `max_entries` entries allocates.
+    static size_t memory_usage(size_t max_entries) {
+        return slot_count(max_entries) * sizeof(Slot);
+    }
+
+    /// Returns the slot index stored for `page_id`, or `kNotFound`.
+    uint32_t find(uint64_t page_id) const {
+        for (size_t i = home(page_id);; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.value == kNotFound) {
+                return kNotFound;
+            }
+            if (slot.page_id == page_id) {
+                return slot.value;
+            }
+        }
+    }
+
+    /// Inserts `page_id` which must not be in the table yet.
+    void insert(uint64_t page_id, uint32_t value) {
+        assert(value != kNotFound);
+        assert(size < capacity / 2);
+        size_t i = home(page_id);
+        while (slots[i].value != kNotFound) {
+            assert(slots[i].page_id != page_id);
+            i = (i + 1) & mask;
+        }
+        slots[i].page_id = page_id;
+        slots[i].value = value;
+        size++;
+    }
+
+    /// Removes `page_id` from the table if it is present.
+    void erase(uint64_t page_id) {
+        size_t i = home(page_id);
+        while (true) {
+            if (slots[i].value == kNotFound) {
+                return;
+            }
+            if (slots[i].page_id == page_id) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        /// Shift back the following entries of the probe sequence that would
+        /// otherwise become unreachable.
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (slots[j].value == kNotFound) {
+                break;
+            }
+            size_t k = home(slots[j].page_id);
+            bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].value = kNotFound;
+        size--;
+    }
+
+    /// Returns the number of entries.
+    size_t get_size() const { return size; }
+
+ private:
+    struct Slot {
+        uint64_t page_id = 0;
+        uint32_t value = kNotFound;
+    };
+
+    static size_t slot_count(size_t max_entries) {
+        size_t count = 16;
+        while (count < 2 * max_entries) {
+            count *= 2;
+        }
+        return count;
+    }
+
+    size_t home(uint64_t page_id) const {
+        /// Page ids are dense within a segment, mix them so that neighbouring
+        /// pages do not form long probe sequences.
+        page_id ^= page_id >> 33;
+        page_id *= 0xff51afd7ed558ccdull;
+        page_id ^= page_id >> 33;
+        return page_id & mask;
+    }
+
+    size_t capacity;
+    size_t mask;
+    size_t size = 0;
+    std::unique_ptr<Slot[]> slots;
+};
+
+}  // namespace buzzdb
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bench/options.h"
+#include "buffer/buffer_manager.h"
+#include "index/btree.h"
+#include "index/buffered_btree.h"
+
+/// Throughput and latency of `BTree` lookups, inserts, scans and erases for
+/// different key distributions and page sizes, together with the shape of
+/// the tree and the page fixes and write backs per operation. Meant for
+/// tuning node sizes and for spotting regressions between two builds. With
+/// `--tree=buffered` the write-optimized `BufferedBTree` is measured
+/// instead, it has no scans.
+///
+/// Usage: btree_bench [--option=value ...]
+///   --keys=N             keys inserted into the tree (default 1000000)
+///   --operations=N       lookups and scans per run (default 1000000)
+///   --distribution=D     `sequential`, `random` or `zipfian` (default random)
+///   --zipf_theta=X       skew of the zipfian distribution (default 0.99)
+///   --scan_length=N      entries read per scan (default 100)
+///   --page_size=N        one of 1024, 4096, 16384, 65536 or 0 for all (default 0)
+///   --tree=T             `btree` or `buffered` (default btree)
+///   --leaf_layout=L      `flat` or `for` (frame of reference) leaves of `btree` (default flat)
+///   --pool_bytes=N       memory of the buffer manager in bytes (default 268435456)
+///   --seed=N             seed of the random number generator (default 42)
+///
+/// Keys are inserted and erased once each, in ascending order for
+/// `sequential` and shuffled otherwise. Lookups and scans start at keys
+/// drawn from the distribution; `zipfian` draws key ranks with the given
+/// skew, the ranks are scattered over the key range. Every tree and leaf
+/// layout runs on its own segments, their files are created in the current
+/// working directory and removed after the run.
+
+namespace {
+
+using buzzdb::BufferManager;
+
+struct Options {
+    size_t keys = 1000000;
+    size_t operations = 1000000;
+    std::string distribution = "random";
+    double zipf_theta = 0.99;
+    size_t scan_length = 100;
+    size_t page_size = 0;
+    std::string tree = "btree";
+    std::string leaf_layout = "flat";
+    size_t pool_bytes = 256 << 20;
+    uint64_t seed = 42;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    buzzdb::bench::OptionParser parser;
+    parser.add("keys", options.keys);
+    parser.add("operations", options.operations);
+    parser.add("distribution", options.distribution);
+    parser.add("zipf_theta", options.zipf_theta);
+    parser.add("scan_length", options.scan_length);
+    parser.add("page_size", options.page_size);
+    parser.add("tree", options.tree);
+    parser.add("leaf_layout", options.leaf_layout);
+    parser.add("pool_bytes", options.pool_bytes);
+    parser.add("seed", options.seed);
+    parser.parse(argc, argv);
+    parser.require(options.distribution == "sequential" || options.distribution == "random" ||
+                       options.distribution == "zipfian",
+                   "distribution must be `sequential`, `random` or `zipfian`");
+    parser.require(options.keys > 0 && options.operations > 0 && options.scan_length > 0,
+                   "keys, operations and scan_length must be positive");
+    parser.require(options.zipf_theta > 0.0 && options.zipf_theta < 1.0, "zipf_theta must be in (0, 1)");
+    parser.require(options.page_size == 0 || options.page_size == 1024 || options.page_size == 4096 ||
+                       options.page_size == 16384 || options.page_size == 65536,
+                   "page_size must be 1024, 4096, 16384, 65536 or 0");
+    parser.require(options.tree == "btree" || options.tree == "buffered", "tree must be `btree` or `buffered`");
+    parser.require(options.leaf_layout == "flat" || options.leaf_layout == "for",
+                   "leaf_layout must be `flat` or `for`");
+    return options;
+}
+
+/// Draws ranks in [0, n) where rank i has a probability proportional to
+/// 1 / (i + 1)^theta, following Gray et al., "Quickly Generating
+/// Billion-Record Synthetic Databases".
+class ZipfianGenerator {
+    public:
+    ZipfianGenerator(uint64_t n, double theta) : n(n), theta(theta) {
+        double zeta2 = 1.0 + std::pow(0.5, theta);
+        for (uint64_t i = 1; i <= n; i++) {
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    uint64_t operator()(std::mt19937_64& random) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        return std::min<uint64_t>(n - 1, static_cast<uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+    }
+
+    private:
+    uint64_t n;
+    double theta;
+    double zetan = 0.0;
+    double alpha;
+    double eta;
+};
+
+/// The keys of a run. The tree holds the even keys 0, 2, ..., so that
+/// scans and lookups of odd keys fall between entries.
+struct Workload {
+    /// Every key once, in insert and erase order.
+    std::vector<uint64_t> keys;
+    /// Start keys of lookups and scans.
+    std::vector<uint64_t> operation_keys;
+};
+
+Workload make_workload(const Options& options) {
+    Workload workload;
+    std::mt19937_64 random(options.seed);
+    workload.keys.resize(options.keys);
+    for (size_t i = 0; i < options.keys; i++) {
+        workload.keys[i] = 2 * i;
+    }
+    if (options.distribution != "sequential") {
+        std::shuffle(workload.keys.begin(), workload.keys.end(), random);
+    }
+    workload.operation_keys.resize(options.operations);
+    if (options.distribution == "sequential") {
+        for (size_t i = 0; i < options.operations; i++) {
+            workload.operation_keys[i] = 2 * (i % options.keys);
+        }
+    } else if (options.distribution == "random") {
+        std::uniform_int_distribution<uint64_t> uniform(0, options.keys - 1);
+        for (auto& key : workload.operation_keys) {
+            key = 2 * uniform(random);
+        }
+    } else {
+        /// The shuffled keys scatter the popular ranks over the key range
+        ZipfianGenerator zipfian(options.keys, options.zipf_theta);
+        for (auto& key : workload.operation_keys) {
+            key = workload.keys[zipfian(random)];
+        }
+    }
+    return workload;
+}
+
+/// Runs `operation` for every key, measures the throughput, the latency
+/// of single operations and the page fixes per operation, and prints them.
+void measure(const char* name, const std::vector<uint64_t>& keys, BufferManager& buffer_manager,
+             const std::function<void(uint64_t)>& operation) {
+    std::vector<uint64_t> latencies(keys.size());
+    buffer_manager.reset_statistics();
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto operationBegin = std::chrono::steady_clock::now();
+        operation(keys[i]);
+        latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - operationBegin).count();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    auto statistics = buffer_manager.get_statistics();
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  " << name << ": ops_per_s=" << keys.size() / seconds
+              << " p50_ns=" << percentile(0.5)
+              << " p99_ns=" << percentile(0.99)
+              << " max_ns=" << latencies.back()
+              << " fixes_per_op=" << static_cast<double>(statistics.hits + statistics.misses) / keys.size()
+              << " misses_per_op=" << static_cast<double>(statistics.misses) / keys.size()
+              << " writebacks_per_op=" << static_cast<double>(statistics.writebacks) / keys.size() << "\n";
+}
+
+template<typename StatisticsT>
+void print_shape(const StatisticsT& statistics) {
+    std::cout << "  shape: height=" << statistics.height
+              << " average_fill=" << statistics.average_fill
+              << " allocated_pages=" << statistics.allocated_pages << "\n";
+    for (size_t level = 0; level < statistics.height; level++) {
+        std::cout << "    level " << level << ": nodes=" << statistics.nodes_per_level[level]
+                  << " entries=" << statistics.entries_per_level[level]
+                  << " fill=" << statistics.fill_per_level[level] << "\n";
+    }
+}
+
+template<size_t PageSize, typename LeafLayoutT>
+void run(const Options& options, const Workload& workload, uint16_t segment) {
+    using Tree = buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, PageSize, buzzdb::FlatInnerLayout, LeafLayoutT>;
+    BufferManager buffer_manager(PageSize, std::max<size_t>(options.pool_bytes / PageSize, 64));
+    Tree tree(segment, buffer_manager);
+    std::cout << "page_size=" << PageSize
+              << " leaf_capacity=" << Tree::LeafNode::kCapacity
+              << " inner_capacity=" << Tree::InnerNode::kCapacity << "\n";
+
+    measure("insert", workload.keys, buffer_manager, [&](uint64_t key) { tree.insert(key, key); });
+    print_shape(tree.get_statistics());
+
+    size_t found = 0;
+    measure("lookup", workload.operation_keys, buffer_manager, [&](uint64_t key) {
+        found += tree.lookup(key).has_value();
+    });
+    measure("lookup_miss", workload.operation_keys, buffer_manager, [&](uint64_t key) {
+        found += tree.lookup(key + 1).has_value();
+    });
+    size_t scanned = 0;
+    measure("scan", workload.operation_keys, buffer_manager, [&](uint64_t key) {
+        size_t remaining = options.scan_length;
+        tree.scan(key, std::numeric_limits<uint64_t>::max(), [&](const uint64_t&, const uint64_t&) {
+            scanned++;
+            return --remaining > 0;
+        });
+    });
+    measure("erase", workload.keys, buffer_manager, [&](uint64_t key) { tree.erase(key); });
+    print_shape(tree.get_statistics());
+
+    if (found != workload.operation_keys.size()) {
+        std::cerr << "wrong lookup results" << std::endl;
+        std::exit(1);
+    }
+    std::cout << "  scanned_entries=" << scanned << std::endl;
+}
+
+template<size_t PageSize>
+void run_buffered(const Options& options, const Workload& workload, uint16_t segment) {
+    using Tree = buzzdb::BufferedBTree<uint64_t, uint64_t, std::less<uint64_t>, PageSize>;
+    BufferManager buffer_manager(PageSize, std::max<size_t>(options.pool_bytes / PageSize, 64));
+    Tree tree(segment, buffer_manager);
+    std::cout << "page_size=" << PageSize
+              << " fanout=" << Tree::kFanout
+              << " message_capacity=" << Tree::kMessageCapacity << "\n";
+
+    measure("insert", workload.keys, buffer_manager, [&](uint64_t key) { tree.insert(key, key); });
+    size_t found = 0;
+    measure("lookup", workload.operation_keys, buffer_manager, [&](uint64_t key) {
+        found += tree.lookup(key).has_value();
+    });
+    measure("lookup_miss", workload.operation_keys, buffer_manager, [&](uint64_t key) {
+        found += tree.lookup(key + 1).has_value();
+    });
+    measure("erase", workload.keys, buffer_manager, [&](uint64_t key) { tree.erase(key); });
+
+    if (found != workload.operation_keys.size()) {
+        std::cerr << "wrong lookup results" << std::endl;
+        std::exit(1);
+    }
+}
+
+/// Calls `run` for every page size selected by `--page_size`, with the page
+/// size as `std::integral_constant` and one segment per page size starting
+/// at `first_segment`. The segment file is removed before and after the run,
+/// so that no run opens the tree of an earlier one.
+template<typename RunT>
+void run_page_sizes(const Options& options, uint16_t first_segment, const RunT& run) {
+    auto run_on_fresh_segment = [&](auto pageSize, uint16_t segment) {
+        auto filename = std::to_string(segment);
+        std::remove(filename.c_str());
+        run(pageSize, segment);
+        std::remove(filename.c_str());
+    };
+    if (options.page_size == 0 || options.page_size == 1024) {
+        run_on_fresh_segment(std::integral_constant<size_t, 1024>(), first_segment);
+    }
+    if (options.page_size == 0 || options.page_size == 4096) {
+        run_on_fresh_segment(std::integral_constant<size_t, 4096>(), first_segment + 1);
+    }
+    if (options.page_size == 0 || options.page_size == 16384) {
+        run_on_fresh_segment(std::integral_constant<size_t, 16384>(), first_segment + 2);
+    }
+    if (options.page_size == 0 || options.page_size == 65536) {
+        run_on_fresh_segment(std::integral_constant<size_t, 65536>(), first_segment + 3);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+    Workload workload = make_workload(options);
+    std::cout << "keys=" << options.keys << " operations=" << options.operations
+              << " distribution=" << options.distribution << " tree=" << options.tree
+              << " leaf_layout=" << options.leaf_layout << "\n";
+    if (options.tree == "buffered") {
+        run_page_sizes(options, 5, [&](auto pageSize, uint16_t segment) {
+            run_buffered<decltype(pageSize)::value>(options, workload, segment);
+        });
+    } else if (options.leaf_layout == "for") {
+        run_page_sizes(options, 9, [&](auto pageSize, uint16_t segment) {
+            run<decltype(pageSize)::value, buzzdb::FrameOfReferenceLeafLayout>(options, workload, segment);
+        });
+    } else {
+        run_page_sizes(options, 1, [&](auto pageSize, uint16_t segment) {
+            run<decltype(pageSize)::value, buzzdb::FlatLeafLayout>(options, workload, segment);
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/options.h"
+#include "buffer/buffer_manager.h"
+#include "index/btree.h"
+
+/// Insert throughput of `BTree` for different page sizes, for the node
+/// routines alone and for whole-tree inserts.
+///
+/// Usage: btree_insert_bench [--option=value ...]
+///   --keys=N             keys inserted into the tree (default 1000000)
+///   --distribution=D     `random` or `sequential` key order (default random)
+///   --pool_bytes=N       memory of the buffer manager in bytes (default 268435456)
+///   --node_rounds=N      times each node is filled in the node benchmark (default 2000)
+///   --seed=N             seed of the random number generator (default 42)
+///
+/// Every page size runs on its own segment, the segment files are created
+/// in the current working directory and removed after the run.
+
+namespace {
+
+using buzzdb::BufferManager;
+
+struct Options {
+    size_t keys = 1000000;
+    std::string distribution = "random";
+    size_t pool_bytes = 256 << 20;
+    size_t node_rounds = 2000;
+    uint64_t seed = 42;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    buzzdb::bench::OptionParser parser;
+    parser.add("keys", options.keys);
+    parser.add("distribution", options.distribution);
+    parser.add("pool_bytes", options.pool_bytes);
+    parser.add("node_rounds", options.node_rounds);
+    parser.add("seed", options.seed);
+    parser.parse(argc, argv);
+    parser.require(options.distribution == "random" || options.distribution == "sequential",
+                   "distribution must be `random` or `sequential`");
+    return options;
+}
+
+/// Returns the keys 0, ..., count - 1 in the order of the distribution.
+std::vector<uint64_t> make_keys(size_t count, const Options& options, uint64_t seed) {
+    std::vector<uint64_t> keys(count);
+    std::iota(keys.begin(), keys.end(), 0);
+    if (options.distribution == "random") {
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+    }
+    return keys;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template<size_t PageSize>
+void run(const Options& options, uint16_t segment) {
+    using Tree = buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, PageSize>;
+    using LeafNode = typename Tree::LeafNode;
+    using InnerNode = typename Tree::InnerNode;
+
+    /// Fill single nodes up to their capacity, without a buffer manager.
+    auto buffer = std::make_unique<std::byte[]>(PageSize);
+    auto leafKeys = make_keys(LeafNode::kCapacity, options, options.seed);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < options.node_rounds; round++) {
+        auto leafNode = new (buffer.get()) LeafNode();
+        for (auto key : leafKeys) {
+            leafNode->insert(key, key);
+        }
+    }
+    double leafSeconds = seconds_since(begin);
+
+    auto innerKeys = make_keys(InnerNode::kCapacity - 1, options, options.seed);
+    begin = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < options.node_rounds; round++) {
+        auto innerNode = new (buffer.get()) InnerNode();
+        innerNode->level = 1;
+        innerNode->count = 1;
+        innerNode->children[0] = 0;
+        for (auto key : innerKeys) {
+            innerNode->insert(key, key);
+        }
+    }
+    double innerSeconds = seconds_since(begin);
+
+    /// Insert into a whole tree.
+    BufferManager buffer_manager(PageSize, std::max<size_t>(options.pool_bytes / PageSize, 64));
+    Tree tree(segment, buffer_manager);
+    auto treeKeys = make_keys(options.keys, options, options.seed + 1);
+    begin = std::chrono::steady_clock::now();
+    for (auto key : treeKeys) {
+        tree.insert(key, key);
+    }
+    double treeSeconds = seconds_since(begin);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "page_size=" << PageSize
+              << " leaf_capacity=" << LeafNode::kCapacity
+              << " inner_capacity=" << InnerNode::kCapacity << "\n";
+    std::cout << "  leaf_node_inserts_per_s: " << options.node_rounds * leafKeys.size() / leafSeconds << "\n";
+    std::cout << "  inner_node_inserts_per_s: " << options.node_rounds * innerKeys.size() / innerSeconds << "\n";
+    std::cout << "  tree_inserts_per_s: " << treeKeys.size() / treeSeconds << std::endl;
+}
+
+/// Runs on a segment whose file is removed before and after the run, so
+/// that no run opens the tree of an earlier one.
+template<size_t PageSize>
+void run_on_fresh_segment(const Options& options, uint16_t segment) {
+    auto filename = std::to_string(segment);
+    std::remove(filename.c_str());
+    run<PageSize>(options, segment);
+    std::remove(filename.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+    std::cout << "keys=" << options.keys << " distribution=" << options.distribution << "\n";
+    run_on_fresh_segment<1024>(options, 1);
+    run_on_fresh_segment<4096>(options, 2);
+    run_on_fresh_segment<16384>(options, 3);
+    run_on_fresh_segment<65536>(options, 4);
+    return 0;
+}
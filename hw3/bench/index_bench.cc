@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/options.h"
+#include "buffer/buffer_manager.h"
+#include "index/adaptive_radix_tree.h"
+#include "index/btree.h"
+
+/// Compares `BTree` on the buffer manager with the in-memory
+/// `AdaptiveRadixTree` under the same key workload: inserts, lookups of
+/// present and absent keys, and erases.
+///
+/// Usage: index_bench [--option=value ...]
+///   --keys=N             keys inserted into each index (default 1000000)
+///   --distribution=D     `random`, `sequential` or `sparse` keys (default random)
+///   --threads=N          threads running the lookups (default 1)
+///   --pool_bytes=N       memory of the buffer manager in bytes (default 268435456)
+///   --seed=N             seed of the random number generator (default 42)
+///
+/// `random` shuffles the keys 0, ..., keys - 1, `sparse` draws them from
+/// the whole 64 bit range. Lookups of both indexes run without latches, so
+/// their throughput can be compared for any number of threads. The segment
+/// file of the B+-tree is created in the current working directory and
+/// removed before and after the run.
+
+namespace {
+
+using buzzdb::BufferManager;
+
+constexpr size_t kPageSize = 4096;
+
+struct Options {
+    size_t keys = 1000000;
+    std::string distribution = "random";
+    size_t threads = 1;
+    size_t pool_bytes = 256 << 20;
+    uint64_t seed = 42;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    buzzdb::bench::OptionParser parser;
+    parser.add("keys", options.keys);
+    parser.add("distribution", options.distribution);
+    parser.add("threads", options.threads);
+    parser.add("pool_bytes", options.pool_bytes);
+    parser.add("seed", options.seed);
+    parser.parse(argc, argv);
+    parser.require(options.distribution == "random" || options.distribution == "sequential" ||
+                       options.distribution == "sparse",
+                   "distribution must be `random`, `sequential` or `sparse`");
+    options.threads = std::max<size_t>(options.threads, 1);
+    return options;
+}
+
+/// The workload: keys to insert in insert order and absent keys.
+struct Workload {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> missing_keys;
+};
+
+Workload make_workload(const Options& options) {
+    Workload workload;
+    std::mt19937_64 random(options.seed);
+    if (options.distribution == "sparse") {
+        /// Even keys are inserted, odd keys are missing
+        for (size_t i = 0; i < options.keys; i++) {
+            workload.keys.push_back(random() & ~1ull);
+            workload.missing_keys.push_back(random() | 1);
+        }
+        return workload;
+    }
+    workload.keys.resize(options.keys);
+    std::iota(workload.keys.begin(), workload.keys.end(), 0);
+    workload.missing_keys.resize(options.keys);
+    std::iota(workload.missing_keys.begin(), workload.missing_keys.end(), options.keys);
+    if (options.distribution == "random") {
+        std::shuffle(workload.keys.begin(), workload.keys.end(), random);
+        std::shuffle(workload.missing_keys.begin(), workload.missing_keys.end(), random);
+    }
+    return workload;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// Runs `lookup` for all keys, split among the threads.
+/// @return the number of keys found.
+size_t run_lookups(const std::vector<uint64_t>& keys, size_t threadCount,
+                   const std::function<bool(uint64_t)>& lookup) {
+    std::vector<size_t> found(threadCount);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < keys.size(); i += threadCount) {
+                found[t] += lookup(keys[i]);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return std::accumulate(found.begin(), found.end(), size_t(0));
+}
+
+/// Runs the workload against an index and prints the throughput.
+template<typename IndexT>
+void run(const char* name, IndexT& index, const Workload& workload, const Options& options) {
+    auto begin = std::chrono::steady_clock::now();
+    for (auto key : workload.keys) {
+        index.insert(key, key);
+    }
+    double insertSeconds = seconds_since(begin);
+
+    auto lookup = [&](uint64_t key) { return index.lookup(key).has_value(); };
+    begin = std::chrono::steady_clock::now();
+    size_t hits = run_lookups(workload.keys, options.threads, lookup);
+    double hitSeconds = seconds_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    size_t misses = workload.missing_keys.size() - run_lookups(workload.missing_keys, options.threads, lookup);
+    double missSeconds = seconds_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    for (auto key : workload.keys) {
+        index.erase(key);
+    }
+    double eraseSeconds = seconds_since(begin);
+
+    if (hits != workload.keys.size() || misses != workload.missing_keys.size()) {
+        std::cerr << name << ": wrong lookup results" << std::endl;
+        std::exit(1);
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << name << "\n";
+    std::cout << "  inserts_per_s: " << workload.keys.size() / insertSeconds << "\n";
+    std::cout << "  hit_lookups_per_s: " << workload.keys.size() / hitSeconds << "\n";
+    std::cout << "  miss_lookups_per_s: " << workload.missing_keys.size() / missSeconds << "\n";
+    std::cout << "  erases_per_s: " << workload.keys.size() / eraseSeconds << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+    Workload workload = make_workload(options);
+    std::cout << "keys=" << options.keys << " distribution=" << options.distribution
+              << " threads=" << options.threads << "\n";
+    /// The tree must not open one that an earlier run left in its segment
+    const uint16_t segment = 1;
+    auto filename = std::to_string(segment);
+    std::remove(filename.c_str());
+    {
+        BufferManager buffer_manager(kPageSize, std::max<size_t>(options.pool_bytes / kPageSize, 64));
+        buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, kPageSize> tree(segment, buffer_manager);
+        run("btree", tree, workload, options);
+    }
+    std::remove(filename.c_str());
+    {
+        buzzdb::AdaptiveRadixTree<uint64_t, uint64_t> tree;
+        run("adaptive_radix_tree", tree, workload, options);
+    }
+    return 0;
+}
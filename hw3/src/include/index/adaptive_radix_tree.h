@@ -0,0 +1,666 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "index/epoch_announcements.h"
+
+namespace buzzdb {
+
+/// Adaptive radix tree over integer keys that lives in memory only, for
+/// indexes whose data fits into RAM. It has the `lookup`, `insert` and
+/// `erase` interface of `BTree`, but does not go through the buffer manager.
+/// Inner nodes grow from 4 to 16, 48 and 256 children and shrink again as
+/// children are erased. Common key bytes are stored once as the prefix of a
+/// node, and leaves hold the whole entry.
+/// Writers are serialized by a tree latch. Lookups take no latch: like the
+/// optimistic lock coupling of `BTree`, they validate the version of every
+/// node they read and restart if a writer changed it meanwhile. Writers
+/// make the version of a node odd while they change it and leave replaced
+/// nodes odd. Replaced nodes are freed once all lookups that started before
+/// they were unlinked are done, see `EpochAnnouncements`.
+template<typename KeyT, typename ValueT>
+struct AdaptiveRadixTree {
+    static_assert(std::is_integral_v<KeyT>, "keys must be integers");
+
+    /// The number of bytes of a key, one byte per level.
+    static constexpr uint32_t kKeyLength = sizeof(KeyT);
+
+    using KeyBytes = std::array<uint8_t, kKeyLength>;
+
+    enum NodeType : uint8_t { kNode4, kNode16, kNode48, kNode256, kLeaf };
+
+    struct Node {
+        /// Odd while a writer changes the node or once it was replaced.
+        std::atomic<uint64_t> version{0};
+        NodeType type;
+        /// The number of bytes in `prefix`.
+        uint8_t prefix_length = 0;
+        /// The number of children.
+        uint16_t count = 0;
+        /// The key bytes all children have in common.
+        uint8_t prefix[kKeyLength];
+
+        explicit Node(NodeType type) : type(type) {}
+    };
+
+    struct Leaf: public Node {
+        KeyT key;
+        ValueT value;
+
+        Leaf(const KeyT &key, const ValueT &value) : Node(kLeaf), key(key), value(value) {}
+    };
+
+    /// Up to 4 children, ordered by their key byte.
+    struct Node4: public Node {
+        uint8_t keys[4];
+        Node* children[4] = {};
+
+        Node4() : Node(kNode4) {}
+    };
+
+    /// Up to 16 children, ordered by their key byte.
+    struct Node16: public Node {
+        uint8_t keys[16];
+        Node* children[16] = {};
+
+        Node16() : Node(kNode16) {}
+    };
+
+    /// Up to 48 children, indexed by a byte map.
+    struct Node48: public Node {
+        /// Position of the child plus one for every key byte, 0 if none.
+        uint8_t child_index[256] = {};
+        Node* children[48] = {};
+
+        Node48() : Node(kNode48) {}
+    };
+
+    /// One child for every key byte.
+    struct Node256: public Node {
+        Node* children[256] = {};
+
+        Node256() : Node(kNode256) {}
+    };
+
+    /// Constructor.
+    AdaptiveRadixTree() = default;
+
+    AdaptiveRadixTree(const AdaptiveRadixTree&) = delete;
+    AdaptiveRadixTree& operator=(const AdaptiveRadixTree&) = delete;
+
+    /// Destructor.
+    ~AdaptiveRadixTree() {
+        free_node(root);
+        for (auto node : retired) {
+            delete_node(node);
+        }
+    }
+
+    /// Lookup an entry in the tree.
+    /// @param[in] key      The key that should be searched.
+    std::optional<ValueT> lookup(const KeyT &key) {
+        EpochAnnouncements::Announcement announcement(lookups);
+        KeyBytes bytes = key_bytes(key);
+        std::optional<ValueT> result;
+        while (!lookup_optimistic(key, bytes, result)) {
+        }
+        return result;
+    }
+
+    /// Inserts a new entry into the tree or replaces the value of an
+    /// existing one.
+    /// @param[in] key      The key that should be inserted.
+    /// @param[in] value    The value that should be inserted.
+    void insert(const KeyT &key, const ValueT &value) {
+        std::unique_lock lock(tree_latch);
+        KeyBytes bytes = key_bytes(key);
+        /// The version of the node that holds `slot`
+        std::atomic<uint64_t>* slotVersion = &root_version;
+        Node** slot = &root;
+        uint32_t depth = 0;
+        while (true) {
+            Node* node = *slot;
+            if (!node) {
+                store_child(*slotVersion, slot, new Leaf(key, value));
+                return;
+            }
+            if (node->type == kLeaf) {
+                auto leaf = static_cast<Leaf*>(node);
+                if (leaf->key == key) {
+                    lock_version(leaf->version);
+                    leaf->value = value;
+                    unlock_version(leaf->version);
+                    return;
+                }
+                /// Both leaves go below a new node at the first differing byte
+                KeyBytes leafBytes = key_bytes(leaf->key);
+                uint32_t mismatch = depth;
+                while (leafBytes[mismatch] == bytes[mismatch]) {
+                    mismatch++;
+                }
+                auto newNode = new Node4();
+                newNode->prefix_length = mismatch - depth;
+                std::memcpy(newNode->prefix, &bytes[depth], newNode->prefix_length);
+                add_child(*newNode, leafBytes[mismatch], leaf);
+                add_child(*newNode, bytes[mismatch], new Leaf(key, value));
+                store_child(*slotVersion, slot, newNode);
+                return;
+            }
+            uint32_t mismatch = prefix_mismatch(*node, bytes, depth);
+            if (mismatch < node->prefix_length) {
+                /// The prefix is split, the new node takes the common part
+                auto newNode = new Node4();
+                newNode->prefix_length = mismatch;
+                std::memcpy(newNode->prefix, node->prefix, mismatch);
+                add_child(*newNode, node->prefix[mismatch], node);
+                add_child(*newNode, bytes[depth + mismatch], new Leaf(key, value));
+                lock_version(node->version);
+                node->prefix_length -= mismatch + 1;
+                std::memmove(node->prefix, &node->prefix[mismatch + 1], node->prefix_length);
+                store_child(*slotVersion, slot, newNode);
+                unlock_version(node->version);
+                return;
+            }
+            depth += node->prefix_length;
+            Node** child = find_child(*node, bytes[depth]);
+            if (!child) {
+                if (is_full(*node)) {
+                    Node* grown = grow(*node);
+                    add_child(*grown, bytes[depth], new Leaf(key, value));
+                    lock_version(node->version);
+                    store_child(*slotVersion, slot, grown);
+                    retire(node);
+                } else {
+                    lock_version(node->version);
+                    add_child(*node, bytes[depth], new Leaf(key, value));
+                    unlock_version(node->version);
+                }
+                return;
+            }
+            slotVersion = &node->version;
+            slot = child;
+            depth++;
+        }
+    }
+
+    /// Erase an entry in the tree.
+    /// @param[in] key      The key that should be erased.
+    void erase(const KeyT &key) {
+        std::unique_lock lock(tree_latch);
+        KeyBytes bytes = key_bytes(key);
+        /// The versions of the nodes that hold `slot` and `parentSlot`
+        std::atomic<uint64_t>* slotVersion = &root_version;
+        std::atomic<uint64_t>* parentSlotVersion = nullptr;
+        Node** slot = &root;
+        Node** parentSlot = nullptr;
+        uint32_t depth = 0;
+        while (*slot) {
+            Node* node = *slot;
+            if (node->type == kLeaf) {
+                if (static_cast<Leaf*>(node)->key != key) {
+                    return;
+                }
+                if (parentSlot) {
+                    remove_child(*parentSlotVersion, parentSlot, bytes[depth - 1]);
+                } else {
+                    store_child(root_version, &root, nullptr);
+                }
+                lock_version(node->version);
+                retire(node);
+                return;
+            }
+            if (prefix_mismatch(*node, bytes, depth) < node->prefix_length) {
+                return;
+            }
+            depth += node->prefix_length;
+            Node** child = find_child(*node, bytes[depth]);
+            if (!child) {
+                return;
+            }
+            parentSlotVersion = slotVersion;
+            parentSlot = slot;
+            slotVersion = &node->version;
+            slot = child;
+            depth++;
+        }
+    }
+
+    private:
+    /// The number of replaced nodes that are freed together.
+    static constexpr size_t kRetiredBatch = 64;
+
+    /// The root, a leaf while the tree holds one entry.
+    Node* root = nullptr;
+    /// The version of `root`, like the version of a node for its children.
+    std::atomic<uint64_t> root_version{0};
+    /// Serializes writers.
+    std::mutex tree_latch;
+    /// Lookups announce themselves, writers wait for the lookups that may
+    /// still read the retired nodes before they free them.
+    EpochAnnouncements lookups;
+    /// Nodes that were replaced or removed, but may still be read by
+    /// lookups. Protected by `tree_latch`.
+    std::vector<Node*> retired;
+
+    /// Runs a lookup without latches.
+    /// @param[out] result The value of the key, if it is found.
+    /// @return false if a writer changed a node meanwhile, the lookup has to
+    ///         be restarted then.
+    bool lookup_optimistic(const KeyT &key, const KeyBytes &bytes, std::optional<ValueT> &result) {
+        uint64_t parentVersion = root_version.load(std::memory_order_acquire);
+        if (parentVersion & 1) {
+            return false;
+        }
+        Node* node = root;
+        const std::atomic<uint64_t>* parent = &root_version;
+        uint32_t depth = 0;
+        while (node) {
+            /// Reading the version of the node before validating the parent
+            /// makes sure that the node was still linked into the tree
+            uint64_t version = node->version.load(std::memory_order_acquire);
+            if ((version & 1) || !validate_version(*parent, parentVersion)) {
+                return false;
+            }
+            if (node->type == kLeaf) {
+                auto leaf = static_cast<Leaf*>(node);
+                KeyT leafKey = leaf->key;
+                ValueT value = leaf->value;
+                if (!validate_version(node->version, version)) {
+                    return false;
+                }
+                result = leafKey == key ? std::optional<ValueT>(value) : std::nullopt;
+                return true;
+            }
+            if (depth >= kKeyLength) {
+                return false;
+            }
+            /// A node that is being changed may hold any prefix length
+            uint32_t prefixLength = std::min<uint32_t>(node->prefix_length, kKeyLength - 1 - depth);
+            Node* child = nullptr;
+            if (std::memcmp(node->prefix, &bytes[depth], prefixLength) == 0) {
+                Node** slot = find_child(*node, bytes[depth + prefixLength]);
+                child = slot ? *slot : nullptr;
+            }
+            if (!validate_version(node->version, version)) {
+                return false;
+            }
+            parent = &node->version;
+            parentVersion = version;
+            node = child;
+            depth += prefixLength + 1;
+        }
+        if (!validate_version(*parent, parentVersion)) {
+            return false;
+        }
+        result = std::nullopt;
+        return true;
+    }
+
+    /// Makes the version odd, optimistic readers of the node restart until
+    /// `unlock_version()`.
+    static void lock_version(std::atomic<uint64_t> &version) {
+        version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void unlock_version(std::atomic<uint64_t> &version) {
+        version.fetch_add(1, std::memory_order_release);
+    }
+
+    static bool validate_version(const std::atomic<uint64_t> &version, uint64_t expected) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_relaxed) == expected;
+    }
+
+    /// Stores a child into `slot`, which belongs to the node with `version`.
+    static void store_child(std::atomic<uint64_t> &version, Node** slot, Node* child) {
+        lock_version(version);
+        *slot = child;
+        unlock_version(version);
+    }
+
+    /// Frees a node that was unlinked once no lookup can read it anymore.
+    /// The version of the node must be locked, it stays odd so that the
+    /// lookups that still read it restart.
+    void retire(Node* node) {
+        retired.push_back(node);
+        if (retired.size() < kRetiredBatch) {
+            return;
+        }
+        lookups.advance();
+        for (auto retiredNode : retired) {
+            delete_node(retiredNode);
+        }
+        retired.clear();
+    }
+
+    /// Returns the bytes of a key, such that comparing them byte by byte
+    /// orders the keys like integers.
+    static KeyBytes key_bytes(KeyT key) {
+        using UnsignedT = std::make_unsigned_t<KeyT>;
+        auto bits = static_cast<UnsignedT>(key);
+        if constexpr (std::is_signed_v<KeyT>) {
+            bits ^= UnsignedT(1) << (8 * kKeyLength - 1);
+        }
+        KeyBytes bytes;
+        for (uint32_t i = 0; i < kKeyLength; i++) {
+            bytes[i] = static_cast<uint8_t>(bits >> (8 * (kKeyLength - 1 - i)));
+        }
+        return bytes;
+    }
+
+    /// Returns the number of prefix bytes of `node` that match the key
+    /// starting at `depth`.
+    static uint32_t prefix_mismatch(const Node &node, const KeyBytes &bytes, uint32_t depth) {
+        uint32_t i = 0;
+        while (i < node.prefix_length && node.prefix[i] == bytes[depth + i]) {
+            i++;
+        }
+        return i;
+    }
+
+    /// Returns the slot of the child for the key byte, nullptr if there is
+    /// none. Counts and indexes are bounded, optimistic readers may see them
+    /// while a writer changes them.
+    static Node** find_child(Node &node, uint8_t byte) {
+        switch (node.type) {
+            case kNode4: {
+                auto& node4 = static_cast<Node4&>(node);
+                uint32_t count = std::min<uint32_t>(node4.count, 4);
+                for (uint32_t i = 0; i < count; i++) {
+                    if (node4.keys[i] == byte) {
+                        return &node4.children[i];
+                    }
+                }
+                return nullptr;
+            }
+            case kNode16: {
+                auto& node16 = static_cast<Node16&>(node);
+#if defined(__SSE2__)
+                auto matches = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(node16.keys)));
+                uint32_t mask = _mm_movemask_epi8(matches) & ((1u << std::min<uint32_t>(node16.count, 16)) - 1);
+                return mask ? &node16.children[__builtin_ctz(mask)] : nullptr;
+#else
+                uint32_t count = std::min<uint32_t>(node16.count, 16);
+                for (uint32_t i = 0; i < count; i++) {
+                    if (node16.keys[i] == byte) {
+                        return &node16.children[i];
+                    }
+                }
+                return nullptr;
+#endif
+            }
+            case kNode48: {
+                auto& node48 = static_cast<Node48&>(node);
+                uint8_t index = node48.child_index[byte];
+                return index && index <= 48 ? &node48.children[index - 1] : nullptr;
+            }
+            case kNode256: {
+                auto& node256 = static_cast<Node256&>(node);
+                return node256.children[byte] ? &node256.children[byte] : nullptr;
+            }
+            default:
+                return nullptr;
+        }
+    }
+
+    static bool is_full(const Node &node) {
+        switch (node.type) {
+            case kNode4: return node.count == 4;
+            case kNode16: return node.count == 16;
+            case kNode48: return node.count == 48;
+            default: return false;
+        }
+    }
+
+    /// Adds a child for a key byte that has none, the node must not be full.
+    static void add_child(Node &node, uint8_t byte, Node* child) {
+        switch (node.type) {
+            case kNode4:
+                insert_sorted(static_cast<Node4&>(node).keys, static_cast<Node4&>(node).children, node.count, byte, child);
+                break;
+            case kNode16:
+                insert_sorted(static_cast<Node16&>(node).keys, static_cast<Node16&>(node).children, node.count, byte, child);
+                break;
+            case kNode48: {
+                auto& node48 = static_cast<Node48&>(node);
+                uint32_t index = 0;
+                while (node48.children[index]) {
+                    index++;
+                }
+                node48.children[index] = child;
+                node48.child_index[byte] = index + 1;
+                break;
+            }
+            case kNode256:
+                static_cast<Node256&>(node).children[byte] = child;
+                break;
+            default:
+                break;
+        }
+        node.count++;
+    }
+
+    /// Inserts a child into the ordered arrays of a `Node4` or `Node16`.
+    static void insert_sorted(uint8_t* keys, Node** children, uint32_t count, uint8_t byte, Node* child) {
+        uint32_t index = 0;
+        while (index < count && keys[index] < byte) {
+            index++;
+        }
+        std::memmove(&keys[index + 1], &keys[index], count - index);
+        std::memmove(&children[index + 1], &children[index], sizeof(Node*) * (count - index));
+        keys[index] = byte;
+        children[index] = child;
+    }
+
+    /// Copies the header of a node into a node of another type.
+    static void copy_header(Node &to, const Node &from) {
+        to.prefix_length = from.prefix_length;
+        to.count = from.count;
+        std::memcpy(to.prefix, from.prefix, from.prefix_length);
+    }
+
+    /// Returns a copy of a full node with the next larger type. The caller
+    /// retires the full node.
+    static Node* grow(Node &node) {
+        switch (node.type) {
+            case kNode4: {
+                auto& node4 = static_cast<Node4&>(node);
+                auto node16 = new Node16();
+                copy_header(*node16, node4);
+                std::memcpy(node16->keys, node4.keys, node4.count);
+                std::memcpy(node16->children, node4.children, sizeof(Node*) * node4.count);
+                return node16;
+            }
+            case kNode16: {
+                auto& node16 = static_cast<Node16&>(node);
+                auto node48 = new Node48();
+                copy_header(*node48, node16);
+                for (uint32_t i = 0; i < node16.count; i++) {
+                    node48->child_index[node16.keys[i]] = i + 1;
+                    node48->children[i] = node16.children[i];
+                }
+                return node48;
+            }
+            default: {
+                auto& node48 = static_cast<Node48&>(node);
+                auto node256 = new Node256();
+                copy_header(*node256, node48);
+                for (uint32_t byte = 0; byte < 256; byte++) {
+                    if (node48.child_index[byte]) {
+                        node256->children[byte] = node48.children[node48.child_index[byte] - 1];
+                    }
+                }
+                return node256;
+            }
+        }
+    }
+
+    /// Removes the child for a key byte from the node in `slot`, which
+    /// belongs to the node with `slotVersion`. Nodes shrink to the next
+    /// smaller type below a quarter of their capacity, a node left with one
+    /// child is replaced by it.
+    void remove_child(std::atomic<uint64_t> &slotVersion, Node** slot, uint8_t byte) {
+        Node* node = *slot;
+        lock_version(node->version);
+        switch (node->type) {
+            case kNode4: {
+                auto node4 = static_cast<Node4*>(node);
+                remove_sorted(node4->keys, node4->children, node4->count, byte);
+                node4->count--;
+                if (node4->count == 1) {
+                    /// The child takes over the prefix and the key byte
+                    Node* child = node4->children[0];
+                    if (child->type != kLeaf) {
+                        lock_version(child->version);
+                        uint8_t prefix[kKeyLength];
+                        std::memcpy(prefix, node4->prefix, node4->prefix_length);
+                        prefix[node4->prefix_length] = node4->keys[0];
+                        std::memcpy(&prefix[node4->prefix_length + 1], child->prefix, child->prefix_length);
+                        child->prefix_length += node4->prefix_length + 1;
+                        std::memcpy(child->prefix, prefix, child->prefix_length);
+                        unlock_version(child->version);
+                    }
+                    store_child(slotVersion, slot, child);
+                    retire(node4);
+                    return;
+                }
+                break;
+            }
+            case kNode16: {
+                auto node16 = static_cast<Node16*>(node);
+                remove_sorted(node16->keys, node16->children, node16->count, byte);
+                node16->count--;
+                if (node16->count == 3) {
+                    auto node4 = new Node4();
+                    copy_header(*node4, *node16);
+                    std::memcpy(node4->keys, node16->keys, 3);
+                    std::memcpy(node4->children, node16->children, sizeof(Node*) * 3);
+                    store_child(slotVersion, slot, node4);
+                    retire(node16);
+                    return;
+                }
+                break;
+            }
+            case kNode48: {
+                auto node48 = static_cast<Node48*>(node);
+                node48->children[node48->child_index[byte] - 1] = nullptr;
+                node48->child_index[byte] = 0;
+                node48->count--;
+                if (node48->count == 12) {
+                    auto node16 = new Node16();
+                    copy_header(*node16, *node48);
+                    uint32_t index = 0;
+                    for (uint32_t b = 0; b < 256; b++) {
+                        if (node48->child_index[b]) {
+                            node16->keys[index] = b;
+                            node16->children[index] = node48->children[node48->child_index[b] - 1];
+                            index++;
+                        }
+                    }
+                    store_child(slotVersion, slot, node16);
+                    retire(node48);
+                    return;
+                }
+                break;
+            }
+            case kNode256: {
+                auto node256 = static_cast<Node256*>(node);
+                node256->children[byte] = nullptr;
+                node256->count--;
+                if (node256->count == 37) {
+                    auto node48 = new Node48();
+                    copy_header(*node48, *node256);
+                    uint32_t index = 0;
+                    for (uint32_t b = 0; b < 256; b++) {
+                        if (node256->children[b]) {
+                            node48->child_index[b] = index + 1;
+                            node48->children[index] = node256->children[b];
+                            index++;
+                        }
+                    }
+                    store_child(slotVersion, slot, node48);
+                    retire(node256);
+                    return;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        unlock_version(node->version);
+    }
+
+    /// Removes a child from the ordered arrays of a `Node4` or `Node16`.
+    static void remove_sorted(uint8_t* keys, Node** children, uint32_t count, uint8_t byte) {
+        uint32_t index = 0;
+        while (keys[index] != byte) {
+            index++;
+        }
+        std::memmove(&keys[index], &keys[index + 1], count - index - 1);
+        std::memmove(&children[index], &children[index + 1], sizeof(Node*) * (count - index - 1));
+    }
+
+    /// Frees a node and everything below it.
+    static void free_node(Node* node) {
+        if (!node) {
+            return;
+        }
+        switch (node->type) {
+            case kNode4: {
+                auto node4 = static_cast<Node4*>(node);
+                for (uint32_t i = 0; i < node4->count; i++) {
+                    free_node(node4->children[i]);
+                }
+                break;
+            }
+            case kNode16: {
+                auto node16 = static_cast<Node16*>(node);
+                for (uint32_t i = 0; i < node16->count; i++) {
+                    free_node(node16->children[i]);
+                }
+                break;
+            }
+            case kNode48:
+                for (auto child : static_cast<Node48*>(node)->children) {
+                    free_node(child);
+                }
+                break;
+            case kNode256:
+                for (auto child : static_cast<Node256*>(node)->children) {
+                    free_node(child);
+                }
+                break;
+            case kLeaf:
+                break;
+        }
+        delete_node(node);
+    }
+
+    /// Frees a single node.
+    static void delete_node(Node* node) {
+        switch (node->type) {
+            case kNode4: delete static_cast<Node4*>(node); break;
+            case kNode16: delete static_cast<Node16*>(node); break;
+            case kNode48: delete static_cast<Node48*>(node); break;
+            case kNode256: delete static_cast<Node256*>(node); break;
+            case kLeaf: delete static_cast<Leaf*>(node); break;
+        }
+    }
+};
+
+}  // namespace buzzdb
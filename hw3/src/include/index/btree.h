@@ -1,22 +1,47 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstring>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "buffer/buffer_manager.h"
 #include "common/defer.h"
 #include "common/macros.h"
+#include "index/epoch_announcements.h"
+#include "index/leaf_layout.h"
+#include "index/node_search.h"
 #include "storage/segment.h"
 
 #define UNUSED(p)  ((void)(p))
 
 namespace buzzdb {
 
-template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize>
+/// B+-tree index on a segment.
+/// `InnerLayoutT` selects how the keys of inner nodes are laid out and
+/// searched, see `FlatInnerLayout` and `SampledInnerLayout`. `LeafLayoutT`
+/// selects how leaves store their entries, see `FlatLeafLayout` and
+/// `FrameOfReferenceLeafLayout`.
+template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize, typename InnerLayoutT = FlatInnerLayout,
+         typename LeafLayoutT = FlatLeafLayout>
 struct BTree : public Segment {
+    /// Marks the absence of a page.
+    static constexpr uint64_t kInvalidPageId = BufferManager::kInvalidPageId;
+
     struct Node {
 
         /// The level in the tree.
@@ -25,20 +50,29 @@ struct BTree : public Segment {
         /// The number of children.
         uint16_t count;
 
+        /// The epoch of the last modification, see `snapshot()`.
+        uint32_t epoch = 0;
+
         // Constructor
         Node(uint16_t level, uint16_t count)
             : level(level), count(count) {}
 
         /// Is the node a leaf node?
         bool is_leaf() const { return level == 0; }
-
-        std::optional<uint64_t> parentPageId;
     };
 
-    struct InnerNode: public Node {
+    /// The capacity of inner nodes.
+    static constexpr uint32_t kInnerCapacity = InnerLayoutT::template capacity<KeyT>(PageSize - sizeof(Node));
+    /// The search index of inner nodes.
+    using InnerIndex = typename InnerLayoutT::template Index<KeyT, ComparatorT, kInnerCapacity>;
+
+    struct InnerNode: public Node, public InnerIndex {
         /// The capacity of a node.
-        /// TODO think about the capacity that the nodes have.
-        static constexpr uint32_t kCapacity = (PageSize - sizeof(Node)) / (sizeof(KeyT) + sizeof(ValueT));;
+        static constexpr uint32_t kCapacity = kInnerCapacity;
+        /// Nodes with at most this many children are rebalanced on erase.
+        static constexpr uint32_t kMinCount = std::max<uint32_t>(kCapacity / 4, 1);
+        /// Siblings with at most this many children in total are merged.
+        static constexpr uint32_t kMergeCount = std::max<uint32_t>(kCapacity / 4 * 3, kMinCount + 1);
 
         /// The keys.
         KeyT keys[kCapacity];
@@ -51,508 +85,2003 @@ struct BTree : public Segment {
 
         /// Get the index of the first key that is not less than than a provided key.
         /// @param[in] key          The key that should be searched.
+        /// Only the first `count - 1` keys are separators, a key that is
+        /// greater than all of them belongs to the last child.
         std::pair<uint32_t, bool> lower_bound(const KeyT &key) {
-	      // TODO: remove the below lines of code 
-    	      // and add your implementation here
-            int low = 0;
-            int high = this->count - 1;
-            const ComparatorT comparator = ComparatorT();
-            if (!comparator(this->keys[0], key) && high == 1) {
-                return {0, true};
-            }
-            std::optional<uint32_t> index;
-            while (low <= high) {
-                if (key > this->keys[low + (high - low) / 2]) {
-                    low = (low + (high - low) / 2) + 1;
-                } else if (key < this->keys[low + (high - low) / 2]) {
-                    index = (low + (high - low) / 2);
-                    high = (low + (high - low) / 2) - 1;
-                } else {
-                    return {static_cast<uint32_t>(low + (high - low) / 2), true};
-                }
-            }
-            if (!index) {
-                return {0, false};
-            }
-            return {*index, true};
+            /// Optimistic readers may see a count that is being modified
+            uint32_t numKeys = std::min<uint32_t>(std::max<uint32_t>(this->count, 1), kCapacity) - 1;
+            uint32_t index = this->find(this->keys, numKeys, key);
+            return {index, index < numKeys};
+        }
+
+        /// Rebuilds the search index, must be called after the keys changed.
+        void update_index() {
+            this->update(this->keys, this->count - 1);
         }
 
-        /// Insert a key.
+        /// Insert a separator and the child right of it.
         /// @param[in] key          The separator that should be inserted.
         /// @param[in] split_page   The id of the split page that should be inserted.
         void insert(const KeyT &key, uint64_t split_page) {
- 	      // TODO: remove the below lines of code 
-    	      // and add your implementation here
-	    //   UNUSED(key);
-	    //   UNUSED(split_page);
-            std::optional<int> index;
-            std::vector<uint64_t> tempChildren;
-            std::vector<KeyT> tempKeys;
-            int i = 0;
-            int lastElement = this->count - 1;
-            while(i < lastElement) {
-                tempChildren.push_back(this->children[i]);
-                tempKeys.push_back(this->keys[i]);
-                const ComparatorT comparator = ComparatorT();
-                if(!(index || comparator(this->keys[i], key))) {
-                    index = i;
-                }
-                this->children[i] = 0;
-                this->keys[i] = 0;
-                i++;
-            }
-            tempChildren.push_back(this->children[lastElement]);
-            this->children[lastElement] = 0;
-            if (index) {
-                tempKeys.insert(tempKeys.begin() + *index, key);
-                index = *index + 1;
-                tempChildren.insert(tempChildren.begin() + *index, split_page);
-            } else {
-                tempKeys.insert(tempKeys.begin() + (this->count - 1), key);
-                tempChildren.insert(tempChildren.begin() + this->count, split_page);
-            }
+            uint32_t index = lower_bound(key).first;
+            uint32_t numKeys = this->count - 1;
+            std::memmove(&this->keys[index + 1], &this->keys[index], sizeof(KeyT) * (numKeys - index));
+            std::memmove(&this->children[index + 2], &this->children[index + 1], sizeof(uint64_t) * (numKeys - index));
+            this->keys[index] = key;
+            this->children[index + 1] = split_page;
             this->count++;
-            i = 0;
-            while (i < static_cast<int>(tempChildren.size())) {
-                this->children[i] = tempChildren[i];
-                i++;
-            }
-            i = 0;
-            while (i < static_cast<int>(tempKeys.size())) {
-                this->keys[i] = tempKeys[i];
-                i++;
-            }
+            update_index();
         }
 
         /// Split the node.
         /// @param[in] buffer       The buffer for the new page.
         /// @return                 The separator key.
         KeyT split(std::byte* buffer) {
-            // TODO: remove the below lines of code 
-    	      // and add your implementation here
-		//UNUSED(buffer);
             auto newInnerNode = reinterpret_cast<InnerNode*>(buffer);
-            int startIndex = 0;
-            auto separatorKey = static_cast<int>((this->keys[((this->kCapacity - 1) / 2) + 1] + this->keys[((this->kCapacity - 1) / 2)]) / 2);
-            int i = ((this->kCapacity - 1) / 2) + 1;
-            while (i < static_cast<int>(this->kCapacity) + 1) {
-                if (startIndex != 0) {
-                    newInnerNode->keys[startIndex - 1] = this->keys[i - 1];
-                    this->keys[i - 1] = 0;
-                } else {
-                    newInnerNode->keys[startIndex] = this->keys[i];
-                    newInnerNode->children[startIndex] = this->children[i];
-                    this->keys[i] = 0;
-                    this->children[i] = 0;
-                    this->count--;
-                    startIndex++;
-                    i++;
-                }
-                newInnerNode->children[startIndex] = this->children[i];
-                this->children[i] = 0;
-                this->count--;
-                startIndex++;
-                i++;
-            }
-            newInnerNode->count = startIndex;
+            /// The left node keeps the first half of the children, the key
+            /// between both halves moves up into the parent.
+            uint32_t leftCount = (this->count + 1) / 2;
+            uint32_t rightCount = this->count - leftCount;
+            KeyT separatorKey = this->keys[leftCount - 1];
+            std::memcpy(newInnerNode->keys, &this->keys[leftCount], sizeof(KeyT) * (rightCount - 1));
+            std::memcpy(newInnerNode->children, &this->children[leftCount], sizeof(uint64_t) * rightCount);
+            newInnerNode->level = this->level;
+            newInnerNode->count = rightCount;
+            newInnerNode->update_index();
+            this->count = leftCount;
+            update_index();
             return separatorKey;
         }
 
+        /// Removes the separator at `index` and the child right of it.
+        void remove(uint32_t index) {
+            std::memmove(&this->keys[index], &this->keys[index + 1], sizeof(KeyT) * (this->count - 2 - index));
+            std::memmove(&this->children[index + 1], &this->children[index + 2], sizeof(uint64_t) * (this->count - 2 - index));
+            this->count--;
+            update_index();
+        }
+
+        /// Appends all children of the right sibling.
+        /// @param[in] right        The right sibling.
+        /// @param[in] separator    The separator of both nodes in the parent.
+        void merge(InnerNode& right, const KeyT &separator) {
+            this->keys[this->count - 1] = separator;
+            std::memcpy(&this->keys[this->count], right.keys, sizeof(KeyT) * (right.count - 1));
+            std::memcpy(&this->children[this->count], right.children, sizeof(uint64_t) * right.count);
+            this->count += right.count;
+            update_index();
+        }
+
+        /// Moves children between this node and its right sibling so that
+        /// both have the same number of children.
+        /// @param[in] right        The right sibling.
+        /// @param[in] separator    The separator of both nodes in the parent.
+        /// @return                 The new separator.
+        KeyT balance(InnerNode& right, const KeyT &separator) {
+            uint32_t leftCount = (this->count + right.count) / 2;
+            KeyT newSeparator;
+            if (this->count > leftCount) {
+                /// rotate the last children of this node to the right
+                uint32_t moved = this->count - leftCount;
+                std::memmove(&right.keys[moved], right.keys, sizeof(KeyT) * (right.count - 1));
+                std::memmove(&right.children[moved], right.children, sizeof(uint64_t) * right.count);
+                right.keys[moved - 1] = separator;
+                std::memcpy(right.keys, &this->keys[leftCount], sizeof(KeyT) * (moved - 1));
+                std::memcpy(right.children, &this->children[leftCount], sizeof(uint64_t) * moved);
+                newSeparator = this->keys[leftCount - 1];
+                right.count += moved;
+            } else {
+                /// rotate the first children of the right node to the left
+                uint32_t moved = leftCount - this->count;
+                this->keys[this->count - 1] = separator;
+                std::memcpy(&this->keys[this->count], right.keys, sizeof(KeyT) * (moved - 1));
+                std::memcpy(&this->children[this->count], right.children, sizeof(uint64_t) * moved);
+                newSeparator = right.keys[moved - 1];
+                std::memmove(right.keys, &right.keys[moved], sizeof(KeyT) * (right.count - 1 - moved));
+                std::memmove(right.children, &right.children[moved], sizeof(uint64_t) * (right.count - moved));
+                right.count -= moved;
+            }
+            this->count = leftCount;
+            update_index();
+            right.update_index();
+            return newSeparator;
+        }
+
         /// Returns the keys.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<KeyT> get_key_vector() {
-            // TODO
-            return {keys.begin(), keys.begin() + (this->count - 1)}; 
+            return {keys, keys + (this->count - 1)};
         }
 
         /// Returns the child page ids.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<uint64_t> get_child_vector() {
-            // TODO
-	    //return std::vector<uint64_t>();
-            return {children.begin(), children.begin() + this->count}; 
+            return {children, children + this->count};
         }
     };
 
+    /// The entries of leaves, behind the node header and the links to the
+    /// neighbouring leaves.
+    using LeafEntries = typename LeafLayoutT::template Entries<KeyT, ValueT, ComparatorT, PageSize - 3 * sizeof(uint64_t)>;
+
     struct LeafNode: public Node {
         /// The capacity of a node.
-        /// TODO think about the capacity that the nodes have.
-        static constexpr uint32_t kCapacity = (PageSize - sizeof(Node)) / (sizeof(KeyT) + sizeof(ValueT));
+        static constexpr uint32_t kCapacity = LeafEntries::kCapacity;
+        /// Nodes with at most this many entries are rebalanced on erase.
+        static constexpr uint32_t kMinCount = kCapacity / 4;
+        /// Siblings with at most this many entries in total are merged. The
+        /// merged node must hold them whatever their keys are.
+        static constexpr uint32_t kMergeCount =
+            std::max<uint32_t>(std::min<uint32_t>(kCapacity / 4 * 3, LeafEntries::kMinCapacity), kMinCount + 1);
 
-        /// The keys.
-        KeyT keys[kCapacity];
+        /// The leaves to the left and to the right, `kInvalidPageId` at the
+        /// ends of the tree.
+        uint64_t prev_leaf = kInvalidPageId;
+        uint64_t next_leaf = kInvalidPageId;
 
-        /// The values.
-        ValueT values[kCapacity];
+        /// The keys and values.
+        LeafEntries entries;
 
         /// Constructor.
         LeafNode() : Node(0, 0) {}
 
-        std::pair<uint32_t, bool> lower_bound(const KeyT& key) {
-            if (this->count == 0) {
-                return {0, false}; 
-            }
-            uint32_t first = 0;
-            uint32_t cnt = this->count;
-            while (cnt > 0) {
-                uint32_t idx = first;
-                idx += cnt / 2;
-                const ComparatorT comparator = ComparatorT();
-                if (!comparator(keys[idx], key)) {
-                    cnt /= 2;
-                } else {
-                    first = ++idx;
-                    cnt -= cnt / 2 + 1;
-                }
-            }
-            return {first, (keys[first] == key && first < this->count)};
+        /// The key at a position.
+        KeyT key(uint32_t index) const { return entries.key(index); }
+
+        /// The value at a position.
+        ValueT& value(uint32_t index) { return entries.value(index); }
+        const ValueT& value(uint32_t index) const { return entries.value(index); }
+
+        /// Whether `key` can be inserted without a split.
+        bool has_room(const KeyT &key) const { return entries.has_room(this->count, key); }
+
+        /// Get the index of the first key that is not less than a provided
+        /// key and whether it is equal to the key.
+        /// @param[in] key          The key that should be searched.
+        std::pair<uint32_t, bool> lower_bound(const KeyT& key) const {
+            /// Optimistic readers may see a count that is being modified
+            uint32_t count = std::min<uint32_t>(this->count, kCapacity);
+            uint32_t index = entries.lower_bound(0, count, key);
+            const ComparatorT comparator = ComparatorT();
+            return {index, index < count && !comparator(key, entries.key(index))};
         }
-        /// Insert a key.
+
+        /// Insert a key, or replace the value if the key exists. A new key
+        /// requires `has_room()`.
         /// @param[in] key          The key that should be inserted.
         /// @param[in] value        The value that should be inserted.
         void insert(const KeyT &key, const ValueT &value) {
-            //TODO
-            // UNUSED(key);
-            // UNUSED(value);
-            if (this->count == 0) {
-                keys[0] = key;
-                values[0] = value;
-            } else {
-                if (lower_bound(key).second) {
-                    values[lower_bound(key).first] = value;
-                    return;
-                }
-                std::memmove(&keys[lower_bound(key).first + 1], &keys[lower_bound(key).first], sizeof(KeyT) * (this->count - lower_bound(key).first));
-                std::memmove(&values[lower_bound(key).first + 1], &values[lower_bound(key).first], sizeof(ValueT) * (this->count - lower_bound(key).first));
-                keys[lower_bound(key).first] = key;
-                values[lower_bound(key).first] = value;
+            auto [index, found] = lower_bound(key);
+            if (found) {
+                entries.value(index) = value;
+                return;
             }
+            entries.insert(index, this->count, key, value);
             this->count++;
         }
 
         /// Erase a key.
-        void erase(const KeyT &key) {
-            //TODO
-            if (this->count == 0) {
-                return; 
-            }
-            if (!lower_bound(key).second) {
-                return;
+        /// @return whether the key was found.
+        bool erase(const KeyT &key) {
+            auto [index, found] = lower_bound(key);
+            if (!found) {
+                return false;
             }
-            const uint32_t num_to_copy = (this->count - 1) - lower_bound(key).first;
-            std::memmove(&values[lower_bound(key).first], &values[lower_bound(key).first + 1], sizeof(ValueT) * num_to_copy);
-            std::memmove(&keys[lower_bound(key).first], &keys[lower_bound(key).first + 1], sizeof(KeyT) * num_to_copy);
+            entries.erase(index, this->count);
             this->count--;
+            return true;
         }
 
         /// Split the node.
         /// @param[in] buffer       The buffer for the new page.
         /// @return                 The separator key.
         KeyT split(std::byte* buffer) {
-            // TODO
-            int startIndex = 0;
-            int i = ((this->kCapacity - 1) / 2) + 1;
-            while (i < static_cast<int>(this->kCapacity)) {
-                reinterpret_cast<LeafNode*>(buffer)->keys[startIndex] = this->keys[i];
-                reinterpret_cast<LeafNode*>(buffer)->values[startIndex] = this->values[i];
-                startIndex++;
-                this->count--;
-                this->keys[i] = 0;
-                this->values[i] = 0;
-                i++;
-            }
-            reinterpret_cast<LeafNode*>(buffer)->count = startIndex;
-            return this->keys[startIndex - 1];
+            auto newLeafNode = reinterpret_cast<LeafNode*>(buffer);
+            /// The left node keeps the larger half of the entries
+            return entries.split(this->count, newLeafNode->entries, newLeafNode->count);
+        }
+
+        /// Appends all entries of the right sibling.
+        void merge(LeafNode& right) {
+            entries.merge(this->count, right.entries, right.count);
+        }
+
+        /// Moves entries between this node and its right sibling so that
+        /// both have the same number of entries.
+        /// @return                 The new separator.
+        KeyT balance(LeafNode& right) {
+            return entries.balance(this->count, right.entries, right.count);
         }
 
         /// Returns the keys.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<KeyT> get_key_vector() {
-            // TODO
-            return {keys.begin(), keys.begin() + this->count};
+            std::vector<KeyT> keys;
+            for (uint32_t i = 0; i < this->count; i++) {
+                keys.push_back(key(i));
+            }
+            return keys;
         }
 
         /// Returns the values.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<ValueT> get_value_vector() {
-            // TODO
-            return {values.begin(), values.begin() + this->count};
+            std::vector<ValueT> values;
+            for (uint32_t i = 0; i < this->count; i++) {
+                values.push_back(value(i));
+            }
+            return values;
         }
     };
 
-    /// The root.
-    std::optional<uint64_t> root;
+    static_assert(sizeof(InnerNode) <= PageSize, "inner nodes must fit into a page");
+    static_assert(sizeof(LeafNode) <= PageSize, "leaf nodes must fit into a page");
+
+    /// The first page of the segment. It describes the tree, so that the
+    /// tree can be opened again from its segment without a rebuild.
+    struct MetaPage {
+        /// `kMetaMagic` once the page was written.
+        uint64_t magic;
+        /// The layout of the tree, checked when the tree is opened.
+        uint32_t page_size;
+        uint16_t key_size;
+        uint16_t value_size;
+        /// The root, `kInvalidPageId` while the tree is empty.
+        uint64_t root;
+        /// The next page number that was never used.
+        uint64_t next_page_id;
+        /// The last freed page, the free pages are linked through
+        /// `FreeNode::next_free`.
+        uint64_t free_pages_head;
+        /// The level of the root.
+        uint16_t root_level;
+        /// The `kId` of the leaf layout.
+        uint16_t leaf_layout;
+        /// The current epoch, the nodes carry the epochs of their last
+        /// modification.
+        uint32_t epoch;
+        /// The `kId` of the inner layout.
+        uint32_t inner_layout;
+    };
+
+    /// Identifies the meta page of a B+-tree.
+    static constexpr uint64_t kMetaMagic = 0x45455254425a5542;  // "BUZBTREE"
+
+    /// A page in the free list.
+    struct FreeNode: public Node {
+        /// The page that was freed before this one, `kInvalidPageId` for the
+        /// first one.
+        uint64_t next_free;
+    };
+
+    /// The shape of the tree, see `get_statistics()`.
+    struct Statistics {
+        /// The number of levels, 0 for an empty tree.
+        uint16_t height = 0;
+        /// The number of nodes of every level, leaves first.
+        std::vector<uint64_t> nodes_per_level;
+        /// The number of entries of every level, leaves first. Entries of
+        /// inner nodes are their children.
+        std::vector<uint64_t> entries_per_level;
+        /// The fraction of the node capacity that is used, per level and
+        /// over all nodes.
+        std::vector<double> fill_per_level;
+        double average_fill = 0.0;
+        /// Pages allocated from the segment, including the meta page and
+        /// free pages.
+        uint64_t allocated_pages = 0;
+        /// Pages in the free list.
+        uint64_t free_pages = 0;
+    };
+
+    /// The root, `kInvalidPageId` while the tree is empty.
+    std::atomic<uint64_t> root{kInvalidPageId};
+    /// The level of the root. Protected by `root_latch`.
     uint16_t rootLevel = 0;
-    bool isTreeEmpty;
-    std::map<KeyT, bool> deletedKeys;
+    /// Serializes creating the root, splitting it, collapsing it and writing
+    /// the meta page. Readers do not take it: they validate the root page's
+    /// version after checking `root`.
+    std::mutex root_latch;
 
-    /// Next page id.
-    /// You don't need to worry about about the page allocation.
-    /// Just increment the next_page_id whenever you need a new page.
-    uint64_t next_page_id;
+    /// Pages that were freed by merges and can be reused. The last one is
+    /// the head of the free list on disk.
+    std::vector<uint64_t> free_pages;
+    std::mutex free_pages_latch;
 
-    /// Constructor.
+    /// Next page number within the segment. Page 0 is the meta page.
+    std::atomic<uint64_t> next_page_id{1};
+
+    /// The epoch that modifications stamp into the nodes they modify. A
+    /// snapshot sees the modifications of its own and all earlier epochs.
+    std::atomic<uint32_t> epoch{1};
+    /// Writers announce the epoch they run in for a whole operation.
+    /// `snapshot()` advances it and waits for the writers of the older
+    /// epoch, writers of the new epoch wait until `epoch` reaches it.
+    EpochAnnouncements writers{1};
+    /// Serializes `snapshot()`.
+    std::mutex snapshot_latch;
+
+    /// Constructor. Opens the tree that is stored on the segment, or
+    /// initializes an empty tree if the segment holds none. Throws
+    /// `std::invalid_argument` if the segment holds a tree with other key or
+    /// value types, another page size or another leaf or inner layout.
     BTree(uint16_t segment_id, BufferManager &buffer_manager)
         : Segment(segment_id, buffer_manager) {
-        // TODO
-        //next_page_id = 1;
-        this->isTreeEmpty = true;
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), false);
+        MetaPage meta;
+        std::memcpy(&meta, metaPage.get_data(), sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, false);
+        if (meta.magic != kMetaMagic) {
+            std::unique_lock lock(root_latch);
+            write_meta();
+            return;
+        }
+        if (meta.page_size != PageSize || meta.key_size != sizeof(KeyT) || meta.value_size != sizeof(ValueT) ||
+            meta.leaf_layout != LeafLayoutT::kId || meta.inner_layout != InnerLayoutT::kId) {
+            throw std::invalid_argument("segment holds a B+-tree with a different layout");
+        }
+        root.store(meta.root);
+        rootLevel = meta.root_level;
+        next_page_id.store(meta.next_page_id);
+        epoch.store(std::max<uint32_t>(meta.epoch, 1));
+        writers.set_epoch(epoch.load());
+        for (auto pageId = meta.free_pages_head; pageId != kInvalidPageId;) {
+            free_pages.push_back(pageId);
+            auto& page = this->buffer_manager.fix_page(pageId, false);
+            pageId = reinterpret_cast<FreeNode*>(page.get_data())->next_free;
+            this->buffer_manager.unfix_page(page, false);
+        }
+        std::reverse(free_pages.begin(), free_pages.end());
+    }
+
+    /// Destructor. Writes the meta page, the buffer manager writes it back.
+    /// All snapshots must be released before.
+    ~BTree() {
+        reuse_retired_pages(std::numeric_limits<uint32_t>::max());
+        std::unique_lock lock(root_latch);
+        write_meta();
     }
 
     /// Lookup an entry in the tree.
+    /// Uses optimistic lock coupling: nodes are read without latches and
+    /// their versions are validated, the lookup restarts on conflicts.
     /// @param[in] key      The key that should be searched.
     std::optional<ValueT> lookup(const KeyT &key) {
-        // TODO
-	// UNUSED(key);
-	// return std::optional<ValueT>();
-        bool found = false;
-        std::optional<ValueT> foundKey;
-        if (!this->root) {
-            return foundKey;
-        }
-        if (this->deletedKeys.find(key) != this->deletedKeys.end()) {
-            return foundKey;
-        }
-        auto currentPageId = *this->root;
-        int next = 0;
-        uint64_t previousParentPageId = currentPageId;
-        while (!found) {
-            auto& currentPage = this->buffer_manager.fix_page(currentPageId, false);
-            auto currentNode = reinterpret_cast<Node*>(currentPage.get_data());
-            if (!currentNode->is_leaf()) {
-                auto innerNode = reinterpret_cast<InnerNode*>(currentNode);
-                if (currentNode->parentPageId) {
-                    previousParentPageId = *currentNode->parentPageId;
-                }
-                if (!innerNode->lower_bound(key).second) {
-                    currentPageId = innerNode->children[innerNode->count - 1];
-                } else {
-                    if (innerNode->count >= next) {
-                        currentPageId = innerNode->children[innerNode->lower_bound(key).first + next];
-                        next = 0;
-                    } else {
-                        return foundKey;
-                    }
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                return std::nullopt;
+            }
+            if (!descend(key, pageId, page, version, nullptr)) {
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            std::optional<ValueT> value;
+            auto [index, found] = leafNode->lower_bound(key);
+            if (found) {
+                value = leafNode->value(index);
+            }
+            bool valid = page->validate(version);
+            this->buffer_manager.unfix_page_optimistic(*page);
+            if (valid) {
+                return value;
+            }
+        }
+    }
+
+    /// Erase an entry in the tree.
+    /// Underfull nodes are rebalanced with a sibling on the way down, by
+    /// moving entries over or by merging both nodes. A root with a single
+    /// child is replaced by the child.
+    /// @param[in] key      The key that should be searched.
+    void erase(const KeyT &key) {
+        EpochAnnouncements::Announcement writer(writers);
+        wait_for_epoch(writer.get_epoch());
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                return;
+            }
+            Parent parent;
+            if (!descend(key, pageId, page, version, &parent, false)) {
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            if (parent.page && leafNode->count <= LeafNode::kMinCount) {
+                rebalance(page, version, pageId, parent);
+                continue;
+            }
+            if (parent.page) {
+                this->buffer_manager.unfix_page_optimistic(*parent.page);
+            }
+            /// Only the leaf is modified, it is the only node that is latched
+            if (!page->upgrade_optimistic(version)) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                continue;
+            }
+            bool found = leafNode->lower_bound(key).second;
+            if (found) {
+                prepare_write(*page, pageId);
+                leafNode->erase(key);
+            }
+            this->buffer_manager.unfix_page(*page, found);
+            return;
+        }
+    }
+
+    /// Inserts a new entry into the tree.
+    /// Full nodes are split eagerly on the way down, so a split only needs
+    /// the latches of the node and its parent. The insert restarts after
+    /// every split and whenever a node changed under it.
+    /// @param[in] key      The key that should be inserted.
+    /// @param[in] value    The value that should be inserted.
+    void insert(const KeyT &key, const ValueT &value) {
+        EpochAnnouncements::Announcement writer(writers);
+        wait_for_epoch(writer.get_epoch());
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                create_root();
+                continue;
+            }
+            Parent parent;
+            if (!descend(key, pageId, page, version, &parent)) {
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            if (leafNode->has_room(key)) {
+                if (parent.page) {
+                    this->buffer_manager.unfix_page_optimistic(*parent.page);
                 }
-            } else {
-                int i = 0;
-                while (i < reinterpret_cast<LeafNode*>(currentNode)->count) {
-                    if (reinterpret_cast<LeafNode*>(currentNode)->keys[i] == key) {
-                        foundKey = reinterpret_cast<LeafNode*>(currentNode)->values[i];
-                        return foundKey;
-                    }
-                    i++;
+                if (!page->upgrade_optimistic(version)) {
+                    this->buffer_manager.unfix_page_optimistic(*page);
+                    continue;
                 }
-                if (next == 2) {
-                    return foundKey;
+                prepare_write(*page, pageId);
+                leafNode->insert(key, value);
+                this->buffer_manager.unfix_page(*page, true);
+                return;
+            }
+            split(page, version, pageId, parent);
+        }
+    }
+
+    /// Looks up a batch of keys, e.g. the probe side of an index join.
+    /// The keys are processed in sorted order, so keys that fall into the
+    /// same subtree share the descent to it: the fixed path from the root is
+    /// kept and only the nodes whose key range ends before the next key are
+    /// left. All keys of a leaf are searched with a single fix, each search
+    /// starting at the position of the previous key. The leaves below a
+    /// parent are searched in groups, see `search_leaves()`, so that their
+    /// cache misses overlap.
+    /// @param[in] keys     The keys that should be searched.
+    /// @return the value of each key, in the order of `keys`.
+    std::vector<std::optional<ValueT>> lookup_batch(const std::vector<KeyT> &keys) {
+        std::vector<std::optional<ValueT>> values(keys.size());
+        auto order = sorted_order(keys);
+        const ComparatorT comparator = ComparatorT();
+        /// An optimistically fixed inner node on the path to the current
+        /// leaf and the largest key it covers, nullopt for the rightmost
+        /// nodes.
+        struct PathEntry {
+            BufferFrame* page;
+            uint64_t version;
+            std::optional<KeyT> upper;
+        };
+        std::vector<PathEntry> path;
+        auto release_path = [&]() {
+            for (auto& entry : path) {
+                this->buffer_manager.unfix_page_optimistic(*entry.page);
+            }
+            path.clear();
+        };
+        size_t next = 0;
+        while (next < order.size()) {
+            const KeyT& key = keys[order[next]];
+            while (!path.empty() && path.back().upper && comparator(*path.back().upper, key)) {
+                this->buffer_manager.unfix_page_optimistic(*path.back().page);
+                path.pop_back();
+            }
+            if (path.empty()) {
+                uint64_t pageId;
+                BufferFrame* page;
+                uint64_t version;
+                if (!fix_root(pageId, page, version)) {
+                    break;
+                }
+                path.push_back({page, version, std::nullopt});
+            }
+            auto [page, version, upper] = path.back();
+            auto node = reinterpret_cast<Node*>(page->get_data());
+            if (node->is_leaf() || node->level == 1) {
+                if (!search_leaves(*page, version, upper, keys, order, next, values)) {
+                    release_path();
                 }
-                currentPageId = previousParentPageId;
-                next++;
+                continue;
+            }
+            auto innerNode = static_cast<InnerNode*>(node);
+            uint32_t count = innerNode->count;
+            if (count == 0 || count > InnerNode::kCapacity) {
+                /// Torn read of a node that is being modified
+                release_path();
+                continue;
+            }
+            auto [index, found] = innerNode->lower_bound(key);
+            auto childPageId = innerNode->children[found ? index : count - 1];
+            auto childUpper = found ? std::optional<KeyT>(innerNode->keys[index]) : upper;
+            if (!page->validate(version)) {
+                release_path();
+                continue;
             }
-            this->buffer_manager.unfix_page(currentPage, false);
+            auto& childPage = this->buffer_manager.fix_page_optimistic(childPageId);
+            auto childVersion = childPage.read_optimistic();
+            if (!page->validate(version)) {
+                this->buffer_manager.unfix_page_optimistic(childPage);
+                release_path();
+                continue;
+            }
+            path.push_back({&childPage, childVersion, childUpper});
         }
-        return foundKey;
+        release_path();
+        return values;
     }
 
+    /// Inserts a batch of entries. The entries are inserted in key order and
+    /// all entries that fall into the same leaf are inserted with a single
+    /// descent and a single latch of the leaf. When a key occurs more than
+    /// once, the entry that comes last in the batch is kept.
+    /// @param[in] keys     The keys that should be inserted.
+    /// @param[in] values   The values that should be inserted, one per key.
+    void insert_batch(const std::vector<KeyT> &keys, const std::vector<ValueT> &values) {
+        if (keys.size() != values.size()) {
+            throw std::invalid_argument("insert_batch needs one value per key");
+        }
+        auto order = sorted_order(keys);
+        const ComparatorT comparator = ComparatorT();
+        EpochAnnouncements::Announcement writer(writers);
+        wait_for_epoch(writer.get_epoch());
+        size_t next = 0;
+        while (next < order.size()) {
+            const KeyT& key = keys[order[next]];
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                create_root();
+                continue;
+            }
+            Parent parent;
+            std::optional<KeyT> upper;
+            if (!descend(key, pageId, page, version, &parent, true, &upper)) {
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            if (!leafNode->has_room(key)) {
+                split(page, version, pageId, parent);
+                continue;
+            }
+            if (parent.page) {
+                this->buffer_manager.unfix_page_optimistic(*parent.page);
+            }
+            if (!page->upgrade_optimistic(version)) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                continue;
+            }
+            prepare_write(*page, pageId);
+            /// The leaf is split by the next descent once it is full
+            for (; next < order.size(); next++) {
+                const KeyT& leafKey = keys[order[next]];
+                if ((upper && comparator(*upper, leafKey)) || !leafNode->has_room(leafKey)) {
+                    break;
+                }
+                leafNode->insert(leafKey, values[order[next]]);
+            }
+            this->buffer_manager.unfix_page(*page, true);
+        }
+    }
 
-    /// Erase an entry in the tree.
+    /// Calls `reader` with the value of `key` while its leaf is latched
+    /// shared, so that the value and data that hangs off it, like overflow
+    /// pages, do not change while it is read. `reader` must not modify the
+    /// tree.
     /// @param[in] key      The key that should be searched.
-    void erase(const KeyT &key) {
-        // TODO
-	//UNUSED(key);
-        if (this->root) {
-            bool found = false;
-            auto currentPageId = *this->root;
-            int next = 0;
-            uint64_t previousParentPageId = currentPageId;
-            while (!found) {
-                auto& currentPage = this->buffer_manager.fix_page(currentPageId, true);
-                auto currentNode = reinterpret_cast<Node*>(currentPage.get_data());
-                if (!currentNode->is_leaf()) {
-                    auto innerNode = reinterpret_cast<InnerNode*>(currentNode);
-                    if (currentNode->parentPageId) {
-                        previousParentPageId = *currentNode->parentPageId;
-                    }
-                    if (!innerNode->lower_bound(key).second) {
-                        currentPageId = innerNode->children[innerNode->count - 1];
+    /// @param[in] reader   Receives the value.
+    /// @return whether the key was found.
+    bool read(const KeyT &key, const std::function<void(const ValueT&)> &reader) {
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                return false;
+            }
+            if (!descend(key, pageId, page, version, nullptr)) {
+                continue;
+            }
+            if (!page->share_optimistic(version)) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            auto [index, found] = leafNode->lower_bound(key);
+            try {
+                if (found) {
+                    reader(leafNode->value(index));
+                }
+            } catch (...) {
+                this->buffer_manager.unfix_page(*page, false);
+                throw;
+            }
+            this->buffer_manager.unfix_page(*page, false);
+            return found;
+        }
+    }
+
+    /// Inserts, modifies or erases the entry of `key` while its leaf is
+    /// latched exclusively. `updater` receives the value and whether the key
+    /// exists, a default value if not, and modifies the value in place. It
+    /// returns whether the entry should be kept, an entry that is not kept is
+    /// erased or not inserted. `updater` must not modify the tree but may
+    /// allocate, modify and free pages that belong to the value.
+    /// Unlike `erase()`, an erased entry does not rebalance the leaf.
+    /// @param[in] key      The key of the entry.
+    /// @param[in] updater  Modifies the value.
+    void update(const KeyT &key, const std::function<bool(ValueT&, bool)> &updater) {
+        EpochAnnouncements::Announcement writer(writers);
+        wait_for_epoch(writer.get_epoch());
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                create_root();
+                continue;
+            }
+            Parent parent;
+            if (!descend(key, pageId, page, version, &parent)) {
+                continue;
+            }
+            auto leafNode = reinterpret_cast<LeafNode*>(page->get_data());
+            auto [index, found] = leafNode->lower_bound(key);
+            /// A new key must fit before `updater` runs, it runs only once
+            if (!found && !leafNode->has_room(key)) {
+                split(page, version, pageId, parent);
+                continue;
+            }
+            if (parent.page) {
+                this->buffer_manager.unfix_page_optimistic(*parent.page);
+            }
+            /// The position stays valid if the leaf did not change
+            if (!page->upgrade_optimistic(version)) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                continue;
+            }
+            ValueT value = found ? leafNode->value(index) : ValueT();
+            bool keep;
+            try {
+                keep = updater(value, found);
+            } catch (...) {
+                this->buffer_manager.unfix_page(*page, false);
+                throw;
+            }
+            if (keep || found) {
+                prepare_write(*page, pageId);
+            }
+            if (keep) {
+                leafNode->insert(key, value);
+            } else if (found) {
+                leafNode->erase(key);
+            }
+            this->buffer_manager.unfix_page(*page, keep || found);
+            return;
+        }
+    }
+
+    /// Position in the leaf level for range scans.
+    /// A cursor keeps no page fixed but works on a copy of its current leaf,
+    /// so the tree can be modified while cursors are open. When the leaves
+    /// changed before the cursor moves on from its copy, it searches the
+    /// tree again. Every key is returned at most once and in order; keys
+    /// that are inserted or erased concurrently may or may not be seen.
+    class Cursor {
+        public:
+        /// Is the cursor on an entry?
+        bool valid() const { return index < leaf()->count; }
+
+        /// The key of the current entry. The cursor must be valid.
+        KeyT key() const { return leaf()->key(index); }
+
+        /// The value of the current entry. The cursor must be valid.
+        const ValueT& value() const { return leaf()->value(index); }
+
+        /// Moves to the next entry. Moving past the last entry makes the
+        /// cursor invalid, `prev()` then returns to the last entry.
+        void next() {
+            if (index == kBeforeBegin) {
+                index = 0;
+                move_right(std::nullopt, false);
+                return;
+            }
+            if (index == leaf()->count) {
+                return;
+            }
+            KeyT last = leaf()->key(index);
+            index++;
+            move_right(last, true);
+        }
+
+        /// Moves to the previous entry. Moving before the first entry makes
+        /// the cursor invalid, `next()` then returns to the first entry.
+        void prev() {
+            if (index == kBeforeBegin) {
+                return;
+            }
+            if (index != 0) {
+                index--;
+                return;
+            }
+            if (leaf()->count == 0) {
+                move_left(std::nullopt);
+            } else {
+                move_left(leaf()->key(0));
+            }
+        }
+
+        private:
+        friend struct BTree;
+
+        /// Position before the first entry of the tree.
+        static constexpr uint32_t kBeforeBegin = std::numeric_limits<uint32_t>::max();
+
+        explicit Cursor(BTree& tree) : tree(&tree), buffer(std::make_unique<std::byte[]>(PageSize)) {
+            new (buffer.get()) LeafNode();
+        }
+
+        LeafNode* leaf() const { return reinterpret_cast<LeafNode*>(buffer.get()); }
+
+        /// Returns the position of the first entry in the copy that is not
+        /// less than `bound`, or greater than `bound` if `after` is set.
+        uint32_t find(const std::optional<KeyT>& bound, bool after) const {
+            if (!bound) {
+                return 0;
+            }
+            auto [position, found] = leaf()->lower_bound(*bound);
+            return position + (after && found);
+        }
+
+        /// Copies the leaf that covers `bound` from the tree. No bound copies
+        /// the leftmost leaf, or the rightmost one if `rightmost` is set.
+        void seek(const std::optional<KeyT>& bound, bool rightmost = false) {
+            pageId = bound ? tree->copy_leaf(*bound, buffer.get()) : tree->copy_outer_leaf(rightmost, buffer.get());
+            if (pageId == kInvalidPageId) {
+                new (buffer.get()) LeafNode();
+            }
+        }
+
+        /// Moves right to the first entry after `bound` if the current copy
+        /// has no such entry. No bound moves to the first entry.
+        void move_right(const std::optional<KeyT>& bound, bool after) {
+            while (index == leaf()->count) {
+                uint64_t nextPageId = leaf()->next_leaf;
+                if (nextPageId == kInvalidPageId) {
+                    return;
+                }
+                if (!tree->copy_page(nextPageId, buffer.get()) || leaf()->prev_leaf != pageId) {
+                    /// The leaves changed since the copy was taken
+                    seek(bound);
+                } else {
+                    pageId = nextPageId;
+                    tree->prefetch_leaf(leaf()->next_leaf);
+                }
+                index = find(bound, after);
+            }
+        }
+
+        /// Moves left to the last entry before `bound`. No bound moves to
+        /// the last entry.
+        void move_left(const std::optional<KeyT>& bound) {
+            while (true) {
+                uint64_t prevPageId = leaf()->prev_leaf;
+                if (prevPageId == kInvalidPageId) {
+                    index = kBeforeBegin;
+                    return;
+                }
+                if (!tree->copy_page(prevPageId, buffer.get()) || leaf()->next_leaf != pageId) {
+                    seek(bound, true);
+                } else {
+                    pageId = prevPageId;
+                    tree->prefetch_leaf(leaf()->prev_leaf);
+                }
+                uint32_t position = bound ? find(bound, false) : leaf()->count;
+                if (position != 0) {
+                    index = position - 1;
+                    return;
+                }
+            }
+        }
+
+        BTree* tree;
+        /// The page of the leaf that was copied into `buffer`.
+        uint64_t pageId = kInvalidPageId;
+        std::unique_ptr<std::byte[]> buffer;
+        uint32_t index = 0;
+    };
+
+    /// Returns a cursor on the first entry with a key that is not less than
+    /// `key`. The cursor is invalid if there is no such entry.
+    /// @param[in] key      The key that should be searched.
+    Cursor lower_bound(const KeyT &key) {
+        Cursor cursor(*this);
+        cursor.seek(key);
+        cursor.index = cursor.find(key, false);
+        cursor.move_right(key, false);
+        if (cursor.valid()) {
+            prefetch_leaf(cursor.leaf()->next_leaf);
+        }
+        return cursor;
+    }
+
+    /// Calls `callback` with every entry whose key is in [from, to], in key
+    /// order, until the callback returns false.
+    /// @param[in] from     The smallest key of the range.
+    /// @param[in] to       The largest key of the range.
+    /// @param[in] callback Receives the key and the value of an entry.
+    void scan(const KeyT &from, const KeyT &to, const std::function<bool(const KeyT&, const ValueT&)> &callback) {
+        const ComparatorT comparator = ComparatorT();
+        for (auto cursor = lower_bound(from); cursor.valid() && !comparator(to, cursor.key()); cursor.next()) {
+            if (!callback(cursor.key(), cursor.value())) {
+                return;
+            }
+        }
+    }
+
+    /// Builds the tree bottom-up from entries in strictly increasing key
+    /// order, e.g. the output of `external_sort()`. Leaves are written
+    /// first, left to right on consecutive pages, then every inner level
+    /// above them, so all pages are written sequentially and each page is
+    /// fixed only once.
+    /// The tree must be empty and must not be used concurrently during the
+    /// bulk load. Throws `std::invalid_argument` on unsorted input, the tree
+    /// is left empty then and the leaves written so far are freed.
+    /// @param[in] next_entry  Stores the next entry in its arguments and
+    ///                        returns false at the end of the input.
+    /// @param[in] fill_factor Fraction in (0, 1] of each node's capacity
+    ///                        that is filled, the rest is left free for
+    ///                        later inserts.
+    void bulk_load(const std::function<bool(KeyT&, ValueT&)> &next_entry, double fill_factor = 1.0) {
+        if (!(fill_factor > 0.0 && fill_factor <= 1.0)) {
+            throw std::invalid_argument("fill factor must be in (0, 1]");
+        }
+        if (root.load() != kInvalidPageId) {
+            throw std::invalid_argument("bulk load requires an empty tree");
+        }
+        const ComparatorT comparator = ComparatorT();
+        auto leafFill = std::max<uint32_t>(1, static_cast<uint32_t>(LeafNode::kCapacity * fill_factor));
+        auto innerFill = std::max<uint32_t>(2, static_cast<uint32_t>(InnerNode::kCapacity * fill_factor));
+
+        /// The largest key and the page of every node of the level that was
+        /// built last.
+        std::vector<std::pair<KeyT, uint64_t>> level;
+        KeyT key;
+        KeyT lastKey;
+        ValueT value;
+        BufferFrame* page = nullptr;
+        LeafNode* leafNode = nullptr;
+        uint64_t pageId = kInvalidPageId;
+        while (next_entry(key, value)) {
+            if (leafNode && !comparator(lastKey, key)) {
+                /// Give the leaves written so far back, the tree stays empty
+                free_page(*page, pageId);
+                for (auto& [leafKey, leafPageId] : level) {
+                    free_page(this->buffer_manager.fix_page(leafPageId, true), leafPageId);
+                }
+                throw std::invalid_argument("bulk load input is not sorted");
+            }
+            if (!leafNode || leafNode->count == leafFill || !leafNode->has_room(key)) {
+                uint64_t newPageId = allocate_page();
+                if (leafNode) {
+                    leafNode->next_leaf = newPageId;
+                    level.emplace_back(leafNode->key(leafNode->count - 1), pageId);
+                    this->buffer_manager.unfix_page(*page, true);
+                }
+                page = &this->buffer_manager.fix_page(newPageId, true);
+                std::memset(page->get_data(), 0, PageSize);
+                leafNode = new (page->get_data()) LeafNode();
+                leafNode->prev_leaf = pageId;
+                pageId = newPageId;
+            }
+            leafNode->entries.insert(leafNode->count, leafNode->count, key, value);
+            leafNode->count++;
+            lastKey = key;
+        }
+        if (!leafNode) {
+            return;
+        }
+        level.emplace_back(leafNode->key(leafNode->count - 1), pageId);
+        this->buffer_manager.unfix_page(*page, true);
+
+        uint16_t height = 0;
+        while (level.size() > 1) {
+            level = build_inner_level(level, ++height, innerFill, 1);
+        }
+        std::unique_lock lock(root_latch);
+        rootLevel = height;
+        root.store(level.front().second);
+        write_meta();
+    }
+
+    /// Builds the tree from sorted entries with several threads, the result
+    /// is the same tree `bulk_load()` builds. Each level is cut into one
+    /// contiguous range of nodes per thread, so every thread builds the
+    /// leaves and inner nodes of its own key range. The page ids of a level
+    /// are reserved with a single `next_page_id` increment and the threads
+    /// fill disjoint parts of that range, so a node's page id and its leaf
+    /// neighbours are known without coordination. Levels with fewer nodes
+    /// than threads are built by the calling thread.
+    /// The tree must be empty and must not be used concurrently during the
+    /// bulk load. Throws `std::invalid_argument` on unsorted input or if
+    /// `keys` and `values` differ in size, the tree is left empty then.
+    /// @param[in] keys        The keys in ascending order.
+    /// @param[in] values      The value of every key.
+    /// @param[in] threads     The number of threads that build the tree.
+    /// @param[in] fill_factor See `bulk_load()`.
+    void bulk_load_parallel(const std::vector<KeyT> &keys, const std::vector<ValueT> &values, size_t threads,
+                            double fill_factor = 1.0) {
+        if (keys.size() != values.size()) {
+            throw std::invalid_argument("keys and values differ in size");
+        }
+        if (!(fill_factor > 0.0 && fill_factor <= 1.0)) {
+            throw std::invalid_argument("fill factor must be in (0, 1]");
+        }
+        if (root.load() != kInvalidPageId) {
+            throw std::invalid_argument("bulk load requires an empty tree");
+        }
+        if (keys.empty()) {
+            return;
+        }
+        threads = std::max<size_t>(threads, 1);
+        const ComparatorT comparator = ComparatorT();
+        std::atomic<bool> sorted{true};
+        parallel_for(keys.size() - 1, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end && sorted.load(std::memory_order_relaxed); i++) {
+                if (!comparator(keys[i], keys[i + 1])) {
+                    sorted.store(false, std::memory_order_relaxed);
+                }
+            }
+        });
+        if (!sorted.load()) {
+            throw std::invalid_argument("bulk load input is not sorted");
+        }
+        auto leafFill = std::max<uint32_t>(1, static_cast<uint32_t>(LeafNode::kCapacity * fill_factor));
+        auto innerFill = std::max<uint32_t>(2, static_cast<uint32_t>(InnerNode::kCapacity * fill_factor));
+        /// Leaves have a fixed number of entries, so that every thread knows
+        /// where its leaves start. With compressed keys, a leaf that does not
+        /// hold its share shrinks the share of all leaves to what always fits.
+        std::atomic<bool> fits{true};
+        parallel_for((keys.size() + leafFill - 1) / leafFill, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end && fits.load(std::memory_order_relaxed); i++) {
+                size_t count = std::min<size_t>(leafFill, keys.size() - i * leafFill);
+                if (!LeafEntries::fits(&keys[i * leafFill], count)) {
+                    fits.store(false, std::memory_order_relaxed);
+                }
+            }
+        });
+        if (!fits.load()) {
+            leafFill = std::min(leafFill, LeafEntries::kMinCapacity);
+        }
+
+        size_t numLeaves = (keys.size() + leafFill - 1) / leafFill;
+        uint64_t firstPageId = next_page_id.fetch_add(numLeaves);
+        std::vector<std::pair<KeyT, uint64_t>> level(numLeaves);
+        parallel_for(numLeaves, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                size_t first = i * leafFill;
+                size_t count = std::min<size_t>(leafFill, keys.size() - first);
+                uint64_t pageId = segment_page(firstPageId + i);
+                auto& page = this->buffer_manager.fix_page(pageId, true);
+                std::memset(page.get_data(), 0, PageSize);
+                auto leafNode = new (page.get_data()) LeafNode();
+                if (i > 0) {
+                    leafNode->prev_leaf = segment_page(firstPageId + i - 1);
+                }
+                if (i + 1 < numLeaves) {
+                    leafNode->next_leaf = segment_page(firstPageId + i + 1);
+                }
+                leafNode->entries.assign(&keys[first], &values[first], count);
+                leafNode->count = static_cast<uint16_t>(count);
+                level[i] = {keys[first + count - 1], pageId};
+                this->buffer_manager.unfix_page(page, true);
+            }
+        });
+
+        uint16_t height = 0;
+        while (level.size() > 1) {
+            level = build_inner_level(level, ++height, innerFill, threads);
+        }
+        std::unique_lock lock(root_latch);
+        rootLevel = height;
+        root.store(level.front().second);
+        write_meta();
+    }
+
+    /// Walks the tree level by level and returns its shape. Nodes are
+    /// visited one at a time under a shared latch, so the result is only
+    /// exact if no writer runs at the same time.
+    /// The number of page fixes per operation is counted by the buffer
+    /// manager, see `BufferManager::get_statistics()`.
+    Statistics get_statistics() {
+        Statistics statistics;
+        {
+            std::unique_lock lock(free_pages_latch);
+            statistics.free_pages = free_pages.size();
+        }
+        statistics.allocated_pages = next_page_id.load();
+        std::vector<uint64_t> level{root.load()};
+        if (level.front() == kInvalidPageId) {
+            return statistics;
+        }
+        /// Levels are collected from the root down and reversed at the end
+        uint64_t totalEntries = 0;
+        uint64_t totalCapacity = 0;
+        while (!level.empty()) {
+            std::vector<uint64_t> children;
+            uint64_t nodes = 0;
+            uint64_t entries = 0;
+            uint64_t capacity = 0;
+            for (auto pageId : level) {
+                auto& page = this->buffer_manager.fix_page(pageId, false);
+                auto node = reinterpret_cast<Node*>(page.get_data());
+                if (node->level != kFreeLevel) {
+                    nodes++;
+                    entries += node->count;
+                    if (node->is_leaf()) {
+                        capacity += LeafNode::kCapacity;
                     } else {
-                        if (innerNode->count >= next) {
-                            currentPageId = innerNode->children[innerNode->lower_bound(key).first + next];
-                            next = 0;
-                        } else {
-                            found = true;
-                        }
+                        capacity += InnerNode::kCapacity;
+                        auto innerNode = reinterpret_cast<InnerNode*>(node);
+                        children.insert(children.end(), innerNode->children, innerNode->children + innerNode->count);
                     }
-                } else {
-                    auto leafNode = reinterpret_cast<LeafNode*>(currentNode);
-                    int i = 0;
-                    while (i < leafNode->count) {
-                        if (leafNode->keys[i] == key) {
-                            found = true;
-                            leafNode->erase(key);
-                            this->deletedKeys.insert(std::pair<KeyT,bool>(key,true));
-                            break;
-                        }
-                        i++;
+                }
+                this->buffer_manager.unfix_page(page, false);
+            }
+            statistics.nodes_per_level.push_back(nodes);
+            statistics.entries_per_level.push_back(entries);
+            statistics.fill_per_level.push_back(capacity ? static_cast<double>(entries) / capacity : 0.0);
+            totalEntries += entries;
+            totalCapacity += capacity;
+            level = std::move(children);
+        }
+        std::reverse(statistics.nodes_per_level.begin(), statistics.nodes_per_level.end());
+        std::reverse(statistics.entries_per_level.begin(), statistics.entries_per_level.end());
+        std::reverse(statistics.fill_per_level.begin(), statistics.fill_per_level.end());
+        statistics.height = statistics.nodes_per_level.size();
+        statistics.average_fill = totalCapacity ? static_cast<double>(totalEntries) / totalCapacity : 0.0;
+        return statistics;
+    }
+
+    /// Returns a new page id of the segment, reuses freed pages first. Also
+    /// used for pages that hang off entries, e.g. overflow pages of values.
+    uint64_t allocate_page() {
+        {
+            std::unique_lock lock(free_pages_latch);
+            if (!free_pages.empty()) {
+                auto pageId = free_pages.back();
+                free_pages.pop_back();
+                return pageId;
+            }
+        }
+        return segment_page(next_page_id.fetch_add(1));
+    }
+
+    /// Frees the exclusively latched page and unfixes it. Optimistic readers
+    /// that still have the page fixed fail their validation, cursors do not
+    /// take it for a leaf anymore. Pages from `allocate_page()` that are no
+    /// nodes are freed the same way.
+    /// While snapshots are open, the page is only reused once the
+    /// snapshots that may still read it are released.
+    void free_page(BufferFrame& page, uint64_t pageId) {
+        prepare_write(page, pageId);
+        auto node = reinterpret_cast<FreeNode*>(page.get_data());
+        node->level = kFreeLevel;
+        node->count = 0;
+        node->next_free = kInvalidPageId;
+        if (newest_snapshot.load() != 0) {
+            std::unique_lock lock(versions_latch);
+            if (!snapshot_epochs.empty()) {
+                retired_pages.emplace_back(node->epoch, pageId);
+                lock.unlock();
+                this->buffer_manager.unfix_page(page, true);
+                return;
+            }
+        }
+        push_free_page(*node, pageId);
+        this->buffer_manager.unfix_page(page, true);
+    }
+
+    /// A read-only view of the tree as it was when `snapshot()` was called.
+    /// Reads do not block writers: nodes are copied optimistically, and
+    /// nodes that were modified since the snapshot are read from the copies
+    /// the writers kept of them, which are looked up under `versions_latch`. Values are returned as
+    /// they were stored, pages that hang off values are not versioned.
+    /// A snapshot is used by one thread at a time and must be released,
+    /// i.e. destroyed, before the tree.
+    class Snapshot {
+        public:
+        Snapshot(Snapshot&& other) noexcept
+            : tree(std::exchange(other.tree, nullptr)), epoch(other.epoch), root(other.root),
+              buffer(std::move(other.buffer)) {}
+        Snapshot& operator=(Snapshot&& other) {
+            if (this != &other) {
+                if (tree) {
+                    tree->release_snapshot(epoch);
+                }
+                tree = std::exchange(other.tree, nullptr);
+                epoch = other.epoch;
+                root = other.root;
+                buffer = std::move(other.buffer);
+            }
+            return *this;
+        }
+
+        /// Destructor. Releases the node copies and the freed pages that
+        /// only this snapshot still needs.
+        ~Snapshot() {
+            if (tree) {
+                tree->release_snapshot(epoch);
+            }
+        }
+
+        /// Lookup an entry in the snapshot.
+        /// @param[in] key      The key that should be searched.
+        std::optional<ValueT> lookup(const KeyT &key) {
+            auto leafNode = seek(key);
+            if (!leafNode) {
+                return std::nullopt;
+            }
+            auto [index, found] = leafNode->lower_bound(key);
+            if (!found) {
+                return std::nullopt;
+            }
+            return leafNode->value(index);
+        }
+
+        /// Calls `callback` with every entry of the snapshot whose key is in
+        /// [from, to], in key order, until the callback returns false.
+        /// @param[in] from     The smallest key of the range.
+        /// @param[in] to       The largest key of the range.
+        /// @param[in] callback Receives the key and the value of an entry.
+        void scan(const KeyT &from, const KeyT &to, const std::function<bool(const KeyT&, const ValueT&)> &callback) {
+            const ComparatorT comparator = ComparatorT();
+            auto leafNode = seek(from);
+            if (!leafNode) {
+                return;
+            }
+            uint32_t index = leafNode->lower_bound(from).first;
+            while (true) {
+                for (; index < leafNode->count; index++) {
+                    KeyT key = leafNode->key(index);
+                    if (comparator(to, key) || !callback(key, leafNode->value(index))) {
+                        return;
                     }
-                    currentPageId = previousParentPageId;
-                    next++;
                 }
-                this->buffer_manager.unfix_page(currentPage, true);
+                if (leafNode->next_leaf == kInvalidPageId) {
+                    return;
+                }
+                tree->copy_snapshot_page(leafNode->next_leaf, epoch, buffer.get());
+                index = 0;
+            }
+        }
+
+        private:
+        friend struct BTree;
+
+        Snapshot(BTree& tree, uint32_t epoch, uint64_t root)
+            : tree(&tree), epoch(epoch), root(root), buffer(std::make_unique<std::byte[]>(PageSize)) {}
+
+        /// Copies the leaf that covers `key` into `buffer`.
+        /// @return the leaf or nullptr if the snapshot is empty.
+        LeafNode* seek(const KeyT &key) {
+            for (uint64_t pageId = root; pageId != kInvalidPageId;) {
+                tree->copy_snapshot_page(pageId, epoch, buffer.get());
+                auto node = reinterpret_cast<Node*>(buffer.get());
+                if (node->is_leaf()) {
+                    return static_cast<LeafNode*>(node);
+                }
+                auto innerNode = static_cast<InnerNode*>(node);
+                auto [index, found] = innerNode->lower_bound(key);
+                pageId = innerNode->children[found ? index : innerNode->count - 1];
             }
+            return nullptr;
         }
+
+        BTree* tree;
+        /// The snapshot sees the modifications up to this epoch.
+        uint32_t epoch;
+        /// The root when the snapshot was taken.
+        uint64_t root;
+        /// The node that was copied last.
+        std::unique_ptr<std::byte[]> buffer;
+    };
+
+    /// Takes a snapshot of the tree for long reads that must see a
+    /// consistent tree, e.g. reports. Starts a new epoch and waits until
+    /// the writes of the old epoch are done, writes that start meanwhile
+    /// wait for the new epoch. From then on, writers copy every node before
+    /// they modify it for the first time in the new epoch, and freed pages
+    /// are not reused while the snapshot is open. The copies are dropped
+    /// when the snapshots that need them are released.
+    Snapshot snapshot() {
+        std::unique_lock lock(snapshot_latch);
+        uint32_t snapshotEpoch = epoch.load();
+        {
+            std::unique_lock versionsLock(versions_latch);
+            snapshot_epochs.insert(snapshotEpoch);
+            newest_snapshot.store(snapshotEpoch);
+        }
+        writers.advance();
+        uint64_t snapshotRoot = root.load();
+        epoch.store(snapshotEpoch + 1);
+        return Snapshot(*this, snapshotEpoch, snapshotRoot);
     }
 
-    /// Inserts a new entry into the tree.
-    /// @param[in] key      The key that should be inserted.
-    /// @param[in] value    The value that should be inserted.
-    void insert(const KeyT &key, const ValueT &value) {
-        // TODO
-	    // new root
-	    if (this->isTreeEmpty) {
-            this->isTreeEmpty = false;
-            this->next_page_id = 1;
-            this->root = 0;
-        }
-        auto currentNodePageId = *this->root;
-        bool KeyInserted = false;
-        while (!KeyInserted) {
-            auto& currentPage = this->buffer_manager.fix_page(currentNodePageId, true);
-            auto currentNode = reinterpret_cast<Node*>(currentPage.get_data());
-            if (!currentNode->is_leaf()) {
-                    auto innerNode = static_cast<InnerNode*>(currentNode);
-                /// create new inner node if current inner node is full
-                if (innerNode->count == (innerNode->kCapacity + 1)) {
-                    /// create new inner node
-                    auto newInnerNodePageId = this->next_page_id;
-                    this->next_page_id++;
-                    auto& newInnerNodePage = this->buffer_manager.fix_page(newInnerNodePageId, true);
-                    KeyT separatorKey = innerNode->split(reinterpret_cast<std::byte *>(newInnerNodePage.get_data()));
-                    auto newNode = reinterpret_cast<Node*>(newInnerNodePage.get_data());
-                    auto newInnerNode = static_cast<InnerNode*>(newNode);
-                    newInnerNode->level = innerNode->level;
-                    /// set the new parent id of the children
-                    int i = 0;
-                    while (i < newInnerNode->count) {
-                        auto& child = this->buffer_manager.fix_page(newInnerNode->children[i], true);
-                        auto child_node = reinterpret_cast<Node*>(child.get_data());
-                        auto child_innerNode = static_cast<InnerNode*>(child_node);
-                        child_innerNode->parentPageId = newInnerNodePageId;
-                        i++;
+    private:
+    /// The content of a node before a modification.
+    struct NodeVersion {
+        /// The node had this content in the epochs [from, to).
+        uint32_t from;
+        uint32_t to;
+        std::unique_ptr<std::byte[]> data;
+    };
+
+    /// The epochs of the open snapshots.
+    std::multiset<uint32_t> snapshot_epochs;
+    /// The newest open snapshot, 0 if there is none. Lets writers skip
+    /// `versions_latch` while no snapshot is open.
+    std::atomic<uint32_t> newest_snapshot{0};
+    /// The node versions that open snapshots may read, per page.
+    std::unordered_map<uint64_t, std::vector<NodeVersion>> versions;
+    /// Pages freed while snapshots were open, with the epoch of the free.
+    std::vector<std::pair<uint32_t, uint64_t>> retired_pages;
+    /// Protects `snapshot_epochs`, `versions` and `retired_pages`.
+    std::mutex versions_latch;
+
+    /// Prepares the exclusively latched node on `page` for a modification:
+    /// keeps a copy if an open snapshot sees its current content, and
+    /// stamps the current epoch into it. Writers are announced in
+    /// `writers`, so the epoch does not change during their operation.
+    void prepare_write(BufferFrame& page, uint64_t pageId) {
+        auto node = reinterpret_cast<Node*>(page.get_data());
+        uint32_t currentEpoch = epoch.load();
+        if (node->epoch == currentEpoch) {
+            return;
+        }
+        uint32_t newest = newest_snapshot.load();
+        if (newest != 0 && newest >= node->epoch) {
+            std::unique_lock lock(versions_latch);
+            /// All open snapshots are older than the current epoch
+            if (snapshot_epochs.lower_bound(node->epoch) != snapshot_epochs.end()) {
+                NodeVersion version{node->epoch, currentEpoch, std::make_unique<std::byte[]>(PageSize)};
+                std::memcpy(version.data.get(), page.get_data(), PageSize);
+                versions[pageId].push_back(std::move(version));
+            }
+        }
+        node->epoch = currentEpoch;
+    }
+
+    /// Copies the content that the page had when the snapshot of
+    /// `snapshotEpoch` was taken into `buffer`.
+    void copy_snapshot_page(uint64_t pageId, uint32_t snapshotEpoch, std::byte* buffer) {
+        while (true) {
+            auto& page = this->buffer_manager.fix_page_optimistic(pageId);
+            auto version = page.read_optimistic();
+            std::memcpy(buffer, page.get_data(), PageSize);
+            bool valid = page.validate(version);
+            this->buffer_manager.unfix_page_optimistic(page);
+            if (valid) {
+                break;
+            }
+        }
+        if (reinterpret_cast<Node*>(buffer)->epoch <= snapshotEpoch) {
+            return;
+        }
+        /// The first writer after the snapshot kept a copy before it
+        /// stamped its epoch
+        std::unique_lock lock(versions_latch);
+        auto pageVersions = versions.find(pageId);
+        if (pageVersions != versions.end()) {
+            for (auto& version : pageVersions->second) {
+                if (version.from <= snapshotEpoch && snapshotEpoch < version.to) {
+                    std::memcpy(buffer, version.data.get(), PageSize);
+                    return;
+                }
+            }
+        }
+        throw std::logic_error("snapshot node version is missing");
+    }
+
+    /// Waits until writers of the epoch `announced` may run, i.e. until the
+    /// writers of the older epochs are done.
+    void wait_for_epoch(uint64_t announced) {
+        while (epoch.load() < announced) {
+            std::this_thread::yield();
+        }
+    }
+
+    /// Closes the snapshot of `snapshotEpoch`, drops the node versions that
+    /// no open snapshot sees anymore and reuses the pages that no open
+    /// snapshot may read anymore.
+    void release_snapshot(uint32_t snapshotEpoch) {
+        uint32_t oldest;
+        {
+            std::unique_lock lock(versions_latch);
+            snapshot_epochs.erase(snapshot_epochs.find(snapshotEpoch));
+            newest_snapshot.store(snapshot_epochs.empty() ? 0 : *snapshot_epochs.rbegin());
+            oldest = snapshot_epochs.empty() ? std::numeric_limits<uint32_t>::max() : *snapshot_epochs.begin();
+            auto seen = [&](const NodeVersion& version) {
+                auto it = snapshot_epochs.lower_bound(version.from);
+                return it != snapshot_epochs.end() && *it < version.to;
+            };
+            for (auto it = versions.begin(); it != versions.end();) {
+                auto& pageVersions = it->second;
+                pageVersions.erase(std::remove_if(pageVersions.begin(), pageVersions.end(),
+                                                  [&](const NodeVersion& version) { return !seen(version); }),
+                                   pageVersions.end());
+                it = pageVersions.empty() ? versions.erase(it) : std::next(it);
+            }
+        }
+        reuse_retired_pages(oldest);
+    }
+
+    /// Adds the retired pages that were freed in or before the epoch
+    /// `oldest` to the free list. A page freed in an epoch is only seen by
+    /// snapshots before that epoch.
+    void reuse_retired_pages(uint32_t oldest) {
+        std::vector<uint64_t> pageIds;
+        {
+            std::unique_lock lock(versions_latch);
+            auto retained = std::partition(retired_pages.begin(), retired_pages.end(),
+                                           [&](const auto& retired) { return retired.first > oldest; });
+            for (auto it = retained; it != retired_pages.end(); it++) {
+                pageIds.push_back(it->second);
+            }
+            retired_pages.erase(retained, retired_pages.end());
+        }
+        for (auto pageId : pageIds) {
+            auto& page = this->buffer_manager.fix_page(pageId, true);
+            push_free_page(*reinterpret_cast<FreeNode*>(page.get_data()), pageId);
+            this->buffer_manager.unfix_page(page, true);
+        }
+    }
+
+    /// Links the free node on `pageId` into the free list.
+    void push_free_page(FreeNode& node, uint64_t pageId) {
+        std::unique_lock lock(free_pages_latch);
+        node.next_free = free_pages.empty() ? kInvalidPageId : free_pages.back();
+        free_pages.push_back(pageId);
+    }
+
+    /// Asks the buffer manager to load the sibling leaf `pageId`, if the
+    /// leaf has one.
+    void prefetch_leaf(uint64_t pageId) {
+        if (pageId != kInvalidPageId) {
+            buffer_manager.prefetch_page(pageId);
+        }
+    }
+
+    /// Copies the page into `buffer` if it holds a leaf.
+    /// @return false if the page was modified during the copy or is no leaf.
+    bool copy_page(uint64_t pageId, std::byte* buffer) {
+        auto& page = this->buffer_manager.fix_page_optimistic(pageId);
+        auto version = page.read_optimistic();
+        std::memcpy(buffer, page.get_data(), PageSize);
+        bool valid = page.validate(version) && reinterpret_cast<Node*>(buffer)->is_leaf();
+        this->buffer_manager.unfix_page_optimistic(page);
+        return valid;
+    }
+
+    /// Copies the leaf that covers `key` into `buffer`.
+    /// @return the page id of the leaf or `kInvalidPageId` if the tree is empty.
+    uint64_t copy_leaf(const KeyT &key, std::byte* buffer) {
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                return kInvalidPageId;
+            }
+            if (!descend(key, pageId, page, version, nullptr)) {
+                continue;
+            }
+            std::memcpy(buffer, page->get_data(), PageSize);
+            bool valid = page->validate(version);
+            this->buffer_manager.unfix_page_optimistic(*page);
+            if (valid) {
+                return pageId;
+            }
+        }
+    }
+
+    /// Copies the leftmost or the rightmost leaf into `buffer`.
+    /// @return the page id of the leaf or `kInvalidPageId` if the tree is empty.
+    uint64_t copy_outer_leaf(bool rightmost, std::byte* buffer) {
+        while (true) {
+            uint64_t pageId;
+            BufferFrame* page;
+            uint64_t version;
+            if (!fix_root(pageId, page, version)) {
+                return kInvalidPageId;
+            }
+            bool valid = true;
+            while (valid && !reinterpret_cast<Node*>(page->get_data())->is_leaf()) {
+                auto innerNode = reinterpret_cast<InnerNode*>(page->get_data());
+                uint32_t count = innerNode->count;
+                if (count == 0 || count > InnerNode::kCapacity) {
+                    valid = false;
+                    break;
+                }
+                uint64_t childPageId = innerNode->children[rightmost ? count - 1 : 0];
+                if (!page->validate(version)) {
+                    valid = false;
+                    break;
+                }
+                auto& childPage = this->buffer_manager.fix_page_optimistic(childPageId);
+                auto childVersion = childPage.read_optimistic();
+                valid = page->validate(version);
+                this->buffer_manager.unfix_page_optimistic(*page);
+                pageId = childPageId;
+                page = &childPage;
+                version = childVersion;
+            }
+            if (valid) {
+                std::memcpy(buffer, page->get_data(), PageSize);
+                valid = page->validate(version) && reinterpret_cast<Node*>(buffer)->is_leaf();
+            }
+            this->buffer_manager.unfix_page_optimistic(*page);
+            if (valid) {
+                return pageId;
+            }
+        }
+    }
+
+    /// Builds the inner nodes above one level of a bulk load on a fresh
+    /// range of page ids. The children are spread evenly, so that the last
+    /// node does not end up with a single child.
+    /// @param[in] level    The largest key and the page of every node of the
+    ///                     level below.
+    /// @return the largest key and the page of every new node.
+    std::vector<std::pair<KeyT, uint64_t>> build_inner_level(const std::vector<std::pair<KeyT, uint64_t>> &level,
+                                                             uint16_t height, uint32_t innerFill, size_t threads) {
+        size_t numNodes = (level.size() + innerFill - 1) / innerFill;
+        uint64_t firstPageId = next_page_id.fetch_add(numNodes);
+        std::vector<std::pair<KeyT, uint64_t>> parentLevel(numNodes);
+        size_t perNode = level.size() / numNodes;
+        size_t remainder = level.size() % numNodes;
+        parallel_for(numNodes, numNodes >= threads ? threads : 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                size_t child = i * perNode + std::min(i, remainder);
+                size_t count = perNode + (i < remainder);
+                uint64_t pageId = segment_page(firstPageId + i);
+                auto& innerPage = this->buffer_manager.fix_page(pageId, true);
+                std::memset(innerPage.get_data(), 0, PageSize);
+                auto innerNode = new (innerPage.get_data()) InnerNode();
+                innerNode->level = height;
+                for (size_t j = 0; j < count; j++, child++) {
+                    if (j + 1 < count) {
+                        innerNode->keys[j] = level[child].first;
                     }
-                    if (innerNode->parentPageId) {
-                        /// get the parent node of the current node
-                        auto& parentNodePage = this->buffer_manager.fix_page(*innerNode->parentPageId, true);
-                        auto parentNode = reinterpret_cast<Node *>(parentNodePage.get_data());
-                        auto parentInnerNode = static_cast<InnerNode *>(parentNode);
-                        parentInnerNode->insert(separatorKey, newInnerNodePageId);
-                        newInnerNode->parentPageId = *innerNode->parentPageId;
-                        /// move to next node
-                        if (parentInnerNode->lower_bound(key).second) {
-                            /// go to rhs child
-                            currentNodePageId = parentInnerNode->children[parentInnerNode->count - 1];
-                        } else {
-                            /// go to lhs child
-                            currentNodePageId = parentInnerNode->children[parentInnerNode->lower_bound(key).first];
-                        }
-                        this->buffer_manager.unfix_page(parentNodePage, true);
-                    } else {
-                        /// root has new page id
-                        this->root = this->next_page_id;
-                        this->next_page_id++;
-                        auto& newRootNodePage = this->buffer_manager.fix_page(*this->root, true);
-                        auto newRootNode = reinterpret_cast<Node *>(newRootNodePage.get_data());
-                        auto newRootInnerNode = static_cast<InnerNode *>(newRootNode);
-                        rootLevel++;
-                        newRootInnerNode->level = rootLevel;
-                        /// add first key
-                        newRootInnerNode->keys[0] = separatorKey;
-                        /// add children to first key
-                        newRootInnerNode->children[0] = currentNodePageId;
-                        newRootInnerNode->children[1] = newInnerNodePageId;
-                        /// increase children number
-                        newRootInnerNode->count += 2;
-                        /// set parent page id for both inner nodes
-                        innerNode->parentPageId = *this->root;
-                        newInnerNode->parentPageId = *this->root;
-                        this->buffer_manager.unfix_page(newRootNodePage, true);
-                        if (!newRootInnerNode->lower_bound(key).second) {
-                            /// go to rhs child
-                            currentNodePageId = newRootInnerNode->children[newRootInnerNode->count - 1];
-                        } else {
-                            /// go to lhs child
-                            currentNodePageId = newRootInnerNode->children[newRootInnerNode->lower_bound(key).first];
-                        }
+                    innerNode->children[j] = level[child].second;
+                }
+                innerNode->count = static_cast<uint16_t>(count);
+                innerNode->update_index();
+                parentLevel[i] = {level[child - 1].first, pageId};
+                this->buffer_manager.unfix_page(innerPage, true);
+            }
+        });
+        return parentLevel;
+    }
+
+    /// Calls `function(begin, end)` for `threads` contiguous parts of
+    /// [0, count), the calling thread takes the first part. Rethrows the
+    /// first exception of any part.
+    static void parallel_for(size_t count, size_t threads, const std::function<void(size_t, size_t)> &function) {
+        threads = std::max<size_t>(std::min(threads, count), 1);
+        std::vector<std::exception_ptr> errors(threads);
+        auto run = [&](size_t part) {
+            try {
+                function(count * part / threads, count * (part + 1) / threads);
+            } catch (...) {
+                errors[part] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t part = 1; part < threads; part++) {
+            workers.emplace_back(run, part);
+        }
+        run(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    /// Marks the level of pages that are in `free_pages`.
+    static constexpr uint16_t kFreeLevel = std::numeric_limits<uint16_t>::max();
+
+    /// Returns the buffer manager page id of a page of the segment.
+    uint64_t segment_page(uint64_t pageId) const {
+        return (static_cast<uint64_t>(this->segment_id) << 48) | pageId;
+    }
+
+    uint64_t meta_page_id() const { return segment_page(0); }
+
+    /// Writes the meta page. Requires `root_latch`.
+    void write_meta() {
+        MetaPage meta;
+        std::memset(&meta, 0, sizeof(meta));
+        meta.magic = kMetaMagic;
+        meta.page_size = PageSize;
+        meta.key_size = sizeof(KeyT);
+        meta.value_size = sizeof(ValueT);
+        meta.root = root.load();
+        meta.root_level = rootLevel;
+        meta.leaf_layout = LeafLayoutT::kId;
+        meta.inner_layout = InnerLayoutT::kId;
+        meta.epoch = epoch.load();
+        meta.next_page_id = next_page_id.load();
+        {
+            std::unique_lock lock(free_pages_latch);
+            meta.free_pages_head = free_pages.empty() ? kInvalidPageId : free_pages.back();
+        }
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), true);
+        std::memcpy(metaPage.get_data(), &meta, sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, true);
+    }
+
+    /// Initializes an empty leaf as root if the tree has no root yet.
+    void create_root() {
+        std::unique_lock lock(root_latch);
+        if (root.load() != kInvalidPageId) {
+            return;
+        }
+        auto rootPageId = allocate_page();
+        auto& rootPage = this->buffer_manager.fix_page(rootPageId, true);
+        std::memset(rootPage.get_data(), 0, PageSize);
+        new (rootPage.get_data()) LeafNode();
+        reinterpret_cast<Node*>(rootPage.get_data())->epoch = epoch.load();
+        this->buffer_manager.unfix_page(rootPage, true);
+        rootLevel = 0;
+        root.store(rootPageId);
+        write_meta();
+    }
+
+    /// Fixes the root optimistically.
+    /// @return false if the tree is empty.
+    bool fix_root(uint64_t& pageId, BufferFrame*& page, uint64_t& version) {
+        while (true) {
+            pageId = root.load();
+            if (pageId == kInvalidPageId) {
+                return false;
+            }
+            page = &this->buffer_manager.fix_page_optimistic(pageId);
+            version = page->read_optimistic();
+            /// Once the version is taken, a root split has to latch this page
+            if (root.load() == pageId) {
+                return true;
+            }
+            this->buffer_manager.unfix_page_optimistic(*page);
+        }
+    }
+
+    /// Returns the positions of the keys in key order. Equal keys keep their
+    /// order.
+    static std::vector<uint32_t> sorted_order(const std::vector<KeyT> &keys) {
+        std::vector<uint32_t> order(keys.size());
+        const ComparatorT comparator = ComparatorT();
+        if (std::is_sorted(keys.begin(), keys.end(), comparator)) {
+            std::iota(order.begin(), order.end(), 0);
+            return order;
+        }
+        /// Sorting the keys together with their positions avoids the random
+        /// accesses of sorting positions by the keys they refer to.
+        std::vector<std::pair<KeyT, uint32_t>> entries(keys.size());
+        for (uint32_t i = 0; i < keys.size(); i++) {
+            entries[i] = {keys[i], i};
+        }
+        std::sort(entries.begin(), entries.end(), [&](const auto& a, const auto& b) {
+            return comparator(a.first, b.first) || (!comparator(b.first, a.first) && a.second < b.second);
+        });
+        for (uint32_t i = 0; i < keys.size(); i++) {
+            order[i] = entries[i].second;
+        }
+        return order;
+    }
+
+    /// Number of leaves that `search_leaves()` prefetches at once.
+    static constexpr uint32_t kLeafGroupSize = 8;
+
+    /// Searches the keys of a batch in the leaves below an optimistically
+    /// fixed inner node of level 1, from position `next` in `order` on and
+    /// as long as the keys are covered by the node. A root leaf is searched
+    /// like a single leaf below a parent.
+    /// The leaves are visited in groups of `kLeafGroupSize`. The leaves of a
+    /// group are fixed first and their headers and the middle of their keys
+    /// are prefetched before the first one is searched, so that the loads
+    /// from the different pages overlap instead of stalling one after the
+    /// other.
+    /// @return false if a node changed and the search has to restart at
+    ///         position `next`. The keys before it are done.
+    bool search_leaves(BufferFrame& page, uint64_t version, const std::optional<KeyT>& upper,
+                       const std::vector<KeyT>& keys, const std::vector<uint32_t>& order, size_t& next,
+                       std::vector<std::optional<ValueT>>& values) {
+        const ComparatorT comparator = ComparatorT();
+        /// A leaf of the current group and the keys in [begin, end) of
+        /// `order` that it covers.
+        struct LeafProbe {
+            BufferFrame* page;
+            uint64_t version;
+            size_t end;
+        };
+        LeafProbe probes[kLeafGroupSize];
+        auto node = reinterpret_cast<Node*>(page.get_data());
+        auto covered = [&](const std::optional<KeyT>& bound, size_t position) {
+            return position < order.size() && !(bound && comparator(*bound, keys[order[position]]));
+        };
+        while (covered(upper, next)) {
+            uint32_t numProbes = 0;
+            if (node->is_leaf()) {
+                size_t end = next;
+                while (covered(upper, end)) {
+                    end++;
+                }
+                probes[numProbes++] = {&page, version, end};
+            } else {
+                auto innerNode = static_cast<InnerNode*>(node);
+                uint32_t count = innerNode->count;
+                if (count == 0 || count > InnerNode::kCapacity) {
+                    return false;
+                }
+                uint64_t leafPageIds[kLeafGroupSize];
+                size_t end = next;
+                while (numProbes < kLeafGroupSize && covered(upper, end)) {
+                    auto [index, found] = innerNode->lower_bound(keys[order[end]]);
+                    leafPageIds[numProbes] = innerNode->children[found ? index : count - 1];
+                    auto leafUpper = found ? std::optional<KeyT>(innerNode->keys[index]) : upper;
+                    while (covered(leafUpper, end)) {
+                        end++;
                     }
-                    this->buffer_manager.unfix_page(newInnerNodePage, true);
-                } else {
-                    /// if key is greater than any of the keys in the inner node go to last children
-                    if (!innerNode->lower_bound(key).second) {
-                        /// go to rhs child
-                        currentNodePageId = innerNode->children[innerNode->count - 1];
-                    } else {
-                        /// go to lhs child
-                        currentNodePageId = innerNode->children[innerNode->lower_bound(key).first];
+                    probes[numProbes++].end = end;
+                }
+                if (!page.validate(version)) {
+                    return false;
+                }
+                for (uint32_t i = 0; i < numProbes; i++) {
+                    probes[i].page = &this->buffer_manager.fix_page_optimistic(leafPageIds[i]);
+                    probes[i].version = probes[i].page->read_optimistic();
+                    __builtin_prefetch(probes[i].page->get_data());
+                }
+                if (!page.validate(version)) {
+                    for (uint32_t i = 0; i < numProbes; i++) {
+                        this->buffer_manager.unfix_page_optimistic(*probes[i].page);
                     }
+                    return false;
                 }
-                this->buffer_manager.unfix_page(currentPage, true);
-            } else {
-                auto leafNode = static_cast<LeafNode*>(currentNode);
-                /// check if there is space for the key
-                if (leafNode->count < leafNode->kCapacity) {
-                    leafNode->insert(key, value);
-                    this->buffer_manager.unfix_page(currentPage, true);
-                    KeyInserted = true;
-                } else {
-                    /// create new leaf node
-                    auto newLeafPageId = this->next_page_id;
-                    this->next_page_id++;
-                    auto& newLeafPage = this->buffer_manager.fix_page(newLeafPageId, true);
-                    KeyT separatorKey = leafNode->split(reinterpret_cast<std::byte *>(newLeafPage.get_data()));
-                    auto newNode = reinterpret_cast<Node*>(newLeafPage.get_data());
-                    auto newLeafNode = static_cast<LeafNode*>(newNode);
-                    /// add new key if separatorKey is not lower than key add to lhs, else add to rhs
-                    const ComparatorT comparator = ComparatorT();
-                    if(comparator(separatorKey, key)) {
-                        newLeafNode->insert(key, value);
+            }
+            for (uint32_t i = 0; i < numProbes; i++) {
+                auto leafNode = reinterpret_cast<LeafNode*>(probes[i].page->get_data());
+                uint32_t count = std::min<uint32_t>(leafNode->count, LeafNode::kCapacity);
+                __builtin_prefetch(leafNode->entries.search_hint(count));
+            }
+            for (uint32_t i = 0; i < numProbes; i++) {
+                auto& probe = probes[i];
+                auto leafNode = reinterpret_cast<LeafNode*>(probe.page->get_data());
+                bool valid = leafNode->is_leaf();
+                uint32_t count = std::min<uint32_t>(leafNode->count, LeafNode::kCapacity);
+                uint32_t index = 0;
+                for (size_t position = next; valid && position < probe.end; position++) {
+                    const KeyT& key = keys[order[position]];
+                    index = leafNode->entries.lower_bound(index, count, key);
+                    if (index < count && !comparator(key, leafNode->key(index))) {
+                        values[order[position]] = leafNode->value(index);
                     } else {
-                        leafNode->insert(key, value);
+                        values[order[position]].reset();
                     }
-                    if (leafNode->parentPageId) {
-                        /// add separatorKey into existing parent node
-                        auto& parentNodePage = this->buffer_manager.fix_page(*leafNode->parentPageId, true);
-                        auto parentNode = reinterpret_cast<Node *>(parentNodePage.get_data());
-                        auto parentInnerNode = static_cast<InnerNode *>(parentNode);
-                        parentInnerNode->insert(separatorKey, newLeafPageId);
-                        newLeafNode->parentPageId = *leafNode->parentPageId;
-                        this->buffer_manager.unfix_page(parentNodePage, true);
-                    } else {
-                        /// root has new page id
-                        this->root = this->next_page_id;
-                        this->next_page_id++;
-                        auto& newRootNodePage = this->buffer_manager.fix_page(*this->root, true);
-                        auto new_inner_root_node = reinterpret_cast<Node *>(newRootNodePage.get_data());
-                        auto newRootNode = static_cast<InnerNode *>(new_inner_root_node);
-                        rootLevel++;
-                        newRootNode->level = rootLevel;
-                        /// add first key
-                        newRootNode->keys[0] = separatorKey;
-                        /// add children to first key
-                        newRootNode->children[0] = currentNodePageId;
-                        newRootNode->children[1] = newLeafPageId;
-                        /// increase children number
-                        newRootNode->count += 2;
-                        /// set parent page id for both leaf nodes
-                        leafNode->parentPageId = *this->root;
-                        newLeafNode->parentPageId = *this->root;
-                        this->buffer_manager.unfix_page(newLeafPage, true);
-                        this->buffer_manager.unfix_page(newRootNodePage, true);
+                }
+                valid = probe.page->validate(probe.version) && valid;
+                if (!node->is_leaf()) {
+                    this->buffer_manager.unfix_page_optimistic(*probe.page);
+                }
+                if (!valid) {
+                    for (uint32_t j = i + 1; j < numProbes; j++) {
+                        this->buffer_manager.unfix_page_optimistic(*probes[j].page);
                     }
-                    this->buffer_manager.unfix_page(currentPage, true);
-                    KeyInserted = true;
+                    return false;
+                }
+                next = probe.end;
+            }
+        }
+        return true;
+    }
+
+    /// The optimistically fixed parent of the current node of a descent.
+    struct Parent {
+        uint64_t pageId = kInvalidPageId;
+        BufferFrame* page = nullptr;
+        uint64_t version = 0;
+    };
+
+    /// Descends optimistically from the fixed page `pageId` to the leaf for
+    /// `key`. When `parent` is given, the parent of the returned page stays
+    /// fixed and nodes on the way are restructured eagerly: full inner nodes
+    /// are split for an insert, underfull inner nodes are rebalanced for an
+    /// erase. Otherwise only the leaf stays fixed. When `upper` is given, it
+    /// receives the smallest separator above the leaf, or nullopt for the
+    /// rightmost leaf: every key up to it belongs to the same leaf.
+    /// @return false if the descent has to restart, all pages are unfixed then.
+    bool descend(const KeyT &key, uint64_t& pageId, BufferFrame*& page, uint64_t& version, Parent* parent,
+                 bool forInsert = true, std::optional<KeyT>* upper = nullptr) {
+        if (upper) {
+            upper->reset();
+        }
+        while (true) {
+            auto node = reinterpret_cast<Node*>(page->get_data());
+            bool isLeaf = node->is_leaf();
+            if (!isLeaf && parent) {
+                auto count = static_cast<InnerNode*>(node)->count;
+                if (forInsert && count == InnerNode::kCapacity) {
+                    split(page, version, pageId, *parent);
+                    return false;
+                }
+                if (!forInsert && parent->page && count <= InnerNode::kMinCount) {
+                    rebalance(page, version, pageId, *parent);
+                    return false;
+                }
+            }
+            if (isLeaf) {
+                if (node->count > LeafNode::kCapacity || !page->validate(version)) {
+                    release(page, parent);
+                    return false;
+                }
+                return true;
+            }
+            uint32_t count = node->count;
+            if (count == 0 || count > InnerNode::kCapacity) {
+                /// Torn read of a node that is being modified
+                release(page, parent);
+                return false;
+            }
+            auto innerNode = static_cast<InnerNode*>(node);
+            auto [index, found] = innerNode->lower_bound(key);
+            auto childPageId = innerNode->children[found ? index : count - 1];
+            if (upper && found) {
+                *upper = innerNode->keys[index];
+            }
+            if (!page->validate(version)) {
+                release(page, parent);
+                return false;
+            }
+            auto& childPage = this->buffer_manager.fix_page_optimistic(childPageId);
+            auto childVersion = childPage.read_optimistic();
+            if (!page->validate(version)) {
+                this->buffer_manager.unfix_page_optimistic(childPage);
+                release(page, parent);
+                return false;
+            }
+            if (parent) {
+                if (parent->page) {
+                    this->buffer_manager.unfix_page_optimistic(*parent->page);
+                }
+                parent->pageId = pageId;
+                parent->page = page;
+                parent->version = version;
+            } else {
+                this->buffer_manager.unfix_page_optimistic(*page);
+            }
+            pageId = childPageId;
+            page = &childPage;
+            version = childVersion;
+        }
+    }
+
+    /// Unfixes the optimistically fixed page and its parent.
+    void release(BufferFrame* page, Parent* parent) {
+        this->buffer_manager.unfix_page_optimistic(*page);
+        if (parent && parent->page) {
+            this->buffer_manager.unfix_page_optimistic(*parent->page);
+            parent->page = nullptr;
+        }
+    }
+
+    /// Splits the optimistically fixed, full node on `page` and inserts the
+    /// separator into its parent, or creates a new root. The parent is not
+    /// full, otherwise it would have been split on the way down. Unfixes both
+    /// pages, also when a version check fails and nothing is split.
+    void split(BufferFrame* page, uint64_t version, uint64_t pageId, const Parent& parent) {
+        BufferFrame* parentPage = parent.page;
+        uint64_t parentVersion = parent.version;
+        std::unique_lock<std::mutex> rootLock;
+        if (parentPage) {
+            if (!parentPage->upgrade_optimistic(parentVersion)) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                this->buffer_manager.unfix_page_optimistic(*parentPage);
+                return;
+            }
+        } else {
+            rootLock = std::unique_lock(root_latch);
+            if (root.load() != pageId) {
+                this->buffer_manager.unfix_page_optimistic(*page);
+                return;
+            }
+        }
+        if (!page->upgrade_optimistic(version)) {
+            this->buffer_manager.unfix_page_optimistic(*page);
+            if (parentPage) {
+                this->buffer_manager.unfix_page(*parentPage, false);
+            }
+            return;
+        }
+        if (parentPage) {
+            prepare_write(*parentPage, parent.pageId);
+        }
+        prepare_write(*page, pageId);
+        auto node = reinterpret_cast<Node*>(page->get_data());
+        auto newPageId = allocate_page();
+        auto& newPage = this->buffer_manager.fix_page(newPageId, true);
+        std::memset(newPage.get_data(), 0, PageSize);
+        KeyT separatorKey;
+        if (node->is_leaf()) {
+            auto leafNode = static_cast<LeafNode*>(node);
+            auto newLeafNode = new (newPage.get_data()) LeafNode();
+            separatorKey = leafNode->split(reinterpret_cast<std::byte*>(newLeafNode));
+            /// link the new leaf in right of the split one, sibling latches
+            /// are always taken from left to right
+            newLeafNode->prev_leaf = pageId;
+            newLeafNode->next_leaf = leafNode->next_leaf;
+            if (leafNode->next_leaf != kInvalidPageId) {
+                auto& nextPage = this->buffer_manager.fix_page(leafNode->next_leaf, true);
+                prepare_write(nextPage, leafNode->next_leaf);
+                reinterpret_cast<LeafNode*>(nextPage.get_data())->prev_leaf = newPageId;
+                this->buffer_manager.unfix_page(nextPage, true);
+            }
+            leafNode->next_leaf = newPageId;
+        } else {
+            auto newInnerNode = new (newPage.get_data()) InnerNode();
+            separatorKey = static_cast<InnerNode*>(node)->split(reinterpret_cast<std::byte*>(newInnerNode));
+        }
+        reinterpret_cast<Node*>(newPage.get_data())->epoch = epoch.load();
+        if (parentPage) {
+            auto parentInnerNode = reinterpret_cast<InnerNode*>(parentPage->get_data());
+            parentInnerNode->insert(separatorKey, newPageId);
+            this->buffer_manager.unfix_page(*parentPage, true);
+        } else {
+            /// root has new page id
+            auto newRootPageId = allocate_page();
+            auto& newRootPage = this->buffer_manager.fix_page(newRootPageId, true);
+            std::memset(newRootPage.get_data(), 0, PageSize);
+            auto newRootNode = new (newRootPage.get_data()) InnerNode();
+            newRootNode->level = node->level + 1;
+            newRootNode->keys[0] = separatorKey;
+            newRootNode->children[0] = pageId;
+            newRootNode->children[1] = newPageId;
+            newRootNode->count = 2;
+            newRootNode->epoch = epoch.load();
+            newRootNode->update_index();
+            rootLevel = newRootNode->level;
+            this->buffer_manager.unfix_page(newRootPage, true);
+            root.store(newRootPageId);
+            write_meta();
+        }
+        this->buffer_manager.unfix_page(newPage, true);
+        this->buffer_manager.unfix_page(*page, true);
+    }
+
+    /// Rebalances the optimistically fixed, underfull node on `page` with a
+    /// sibling: both nodes are merged if the result leaves room for inserts,
+    /// otherwise entries are moved so that both are equally full. The parent
+    /// is not underfull, otherwise it would have been rebalanced on the way
+    /// down. Latches are taken from the parent down and from left to right.
+    /// Unfixes all pages, also when a version check fails and nothing is
+    /// changed.
+    void rebalance(BufferFrame* page, uint64_t version, uint64_t pageId, const Parent& parent) {
+        std::unique_lock<std::mutex> rootLock;
+        if (root.load() == parent.pageId) {
+            /// the root may collapse
+            rootLock = std::unique_lock(root_latch);
+        }
+        if ((rootLock.owns_lock() && root.load() != parent.pageId) || !parent.page->upgrade_optimistic(parent.version)) {
+            this->buffer_manager.unfix_page_optimistic(*page);
+            this->buffer_manager.unfix_page_optimistic(*parent.page);
+            return;
+        }
+        auto parentNode = reinterpret_cast<InnerNode*>(parent.page->get_data());
+        uint32_t index = 0;
+        while (index < parentNode->count && parentNode->children[index] != pageId) {
+            index++;
+        }
+        if (index == parentNode->count || parentNode->count == 1) {
+            this->buffer_manager.unfix_page_optimistic(*page);
+            this->buffer_manager.unfix_page(*parent.page, false);
+            return;
+        }
+        uint32_t leftIndex = index + 1 < parentNode->count ? index : index - 1;
+        bool pageIsLeft = leftIndex == index;
+        uint64_t siblingPageId = parentNode->children[pageIsLeft ? leftIndex + 1 : leftIndex];
+        auto& siblingPage = this->buffer_manager.fix_page_optimistic(siblingPageId);
+        auto siblingVersion = siblingPage.read_optimistic();
+        BufferFrame* leftPage = pageIsLeft ? page : &siblingPage;
+        BufferFrame* rightPage = pageIsLeft ? &siblingPage : page;
+        uint64_t leftPageId = pageIsLeft ? pageId : siblingPageId;
+        uint64_t rightPageId = pageIsLeft ? siblingPageId : pageId;
+        if (!leftPage->upgrade_optimistic(pageIsLeft ? version : siblingVersion)) {
+            this->buffer_manager.unfix_page_optimistic(*leftPage);
+            this->buffer_manager.unfix_page_optimistic(*rightPage);
+            this->buffer_manager.unfix_page(*parent.page, false);
+            return;
+        }
+        if (!rightPage->upgrade_optimistic(pageIsLeft ? siblingVersion : version)) {
+            this->buffer_manager.unfix_page(*leftPage, false);
+            this->buffer_manager.unfix_page_optimistic(*rightPage);
+            this->buffer_manager.unfix_page(*parent.page, false);
+            return;
+        }
+        prepare_write(*parent.page, parent.pageId);
+        prepare_write(*leftPage, leftPageId);
+        prepare_write(*rightPage, rightPageId);
+        bool merged;
+        if (reinterpret_cast<Node*>(leftPage->get_data())->is_leaf()) {
+            auto leftNode = reinterpret_cast<LeafNode*>(leftPage->get_data());
+            auto rightNode = reinterpret_cast<LeafNode*>(rightPage->get_data());
+            merged = leftNode->count + rightNode->count <= LeafNode::kMergeCount;
+            if (merged) {
+                leftNode->merge(*rightNode);
+                leftNode->next_leaf = rightNode->next_leaf;
+                if (rightNode->next_leaf != kInvalidPageId) {
+                    auto& nextPage = this->buffer_manager.fix_page(rightNode->next_leaf, true);
+                    prepare_write(nextPage, rightNode->next_leaf);
+                    reinterpret_cast<LeafNode*>(nextPage.get_data())->prev_leaf = leftPageId;
+                    this->buffer_manager.unfix_page(nextPage, true);
                 }
+            } else {
+                parentNode->keys[leftIndex] = leftNode->balance(*rightNode);
+                parentNode->update_index();
+            }
+        } else {
+            auto leftNode = reinterpret_cast<InnerNode*>(leftPage->get_data());
+            auto rightNode = reinterpret_cast<InnerNode*>(rightPage->get_data());
+            merged = leftNode->count + rightNode->count <= InnerNode::kMergeCount;
+            if (merged) {
+                leftNode->merge(*rightNode, parentNode->keys[leftIndex]);
+            } else {
+                parentNode->keys[leftIndex] = leftNode->balance(*rightNode, parentNode->keys[leftIndex]);
+                parentNode->update_index();
             }
         }
+        this->buffer_manager.unfix_page(*leftPage, true);
+        if (!merged) {
+            this->buffer_manager.unfix_page(*rightPage, true);
+            this->buffer_manager.unfix_page(*parent.page, true);
+            return;
+        }
+        free_page(*rightPage, rightPageId);
+        parentNode->remove(leftIndex);
+        if (rootLock.owns_lock() && parentNode->count == 1) {
+            /// the merged node is the only child of the root => it becomes the root
+            root.store(leftPageId);
+            rootLevel--;
+            free_page(*parent.page, parent.pageId);
+            write_meta();
+            return;
+        }
+        this->buffer_manager.unfix_page(*parent.page, true);
     }
 };
 
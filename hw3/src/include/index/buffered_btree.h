@@ -0,0 +1,468 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "buffer/buffer_manager.h"
+#include "index/node_search.h"
+#include "storage/segment.h"
+
+namespace buzzdb {
+
+/// Write-optimized B+-tree in the style of a Bε-tree. Every inner node
+/// reserves most of its page for a buffer of pending inserts and erases,
+/// called messages, and uses the rest for about the square root of the
+/// children a B+-tree node would have. An insert or erase only adds a
+/// message to the root. When a buffer is full, the messages for the child
+/// that receives the most of them are moved down in one batch, so every page
+/// write below the root carries many messages instead of one. Lookups check
+/// the buffers on their path, the message closest to the root is the newest
+/// one.
+/// Writers are serialized by a tree latch, readers share it. Leaves that
+/// become empty through erases are kept. Like `BTree`, the first page of the
+/// segment is a meta page, so the tree can be opened again from its segment.
+template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize>
+struct BufferedBTree : public Segment {
+    /// Marks the absence of a page.
+    static constexpr uint64_t kInvalidPageId = BufferManager::kInvalidPageId;
+
+    /// The kinds of messages.
+    enum MessageType : uint8_t { kInsert = 0, kErase = 1 };
+
+    struct Node {
+        /// The level in the tree, 0 for leaves.
+        uint16_t level;
+        /// The number of children or entries.
+        uint16_t count;
+
+        bool is_leaf() const { return level == 0; }
+    };
+
+    struct LeafNode: public Node {
+        static constexpr uint32_t kCapacity = (PageSize - sizeof(Node)) / (sizeof(KeyT) + sizeof(ValueT));
+
+        KeyT keys[kCapacity];
+        ValueT values[kCapacity];
+    };
+
+    /// Returns the largest number whose square is at most `n`.
+    static constexpr size_t isqrt(size_t n) {
+        size_t root = 0;
+        while ((root + 1) * (root + 1) <= n) {
+            root++;
+        }
+        return root;
+    }
+
+    /// The number of children of an inner node before it is split.
+    static constexpr uint32_t kFanout = std::max<size_t>(isqrt(PageSize / (sizeof(KeyT) + sizeof(uint64_t))), 4);
+    /// Flushing a batch to a leaf adds at most one leaf, so an inner node
+    /// holds one child more than its fanout until its parent splits it.
+    static constexpr uint32_t kChildCapacity = kFanout + 1;
+    /// The number of messages in the buffer of an inner node.
+    static constexpr uint32_t kMessageCapacity =
+        (PageSize - 2 * sizeof(Node) - kChildCapacity * (sizeof(KeyT) + sizeof(uint64_t))) /
+        (sizeof(KeyT) + sizeof(ValueT) + sizeof(uint8_t));
+
+    static_assert(kMessageCapacity >= 2, "inner nodes need room for messages");
+    static_assert(kMessageCapacity <= LeafNode::kCapacity, "a batch must split a leaf at most once");
+
+    struct InnerNode: public Node {
+        /// The number of buffered messages.
+        uint16_t message_count;
+        /// The separators, child `i` holds the keys up to `keys[i]`.
+        KeyT keys[kChildCapacity];
+        uint64_t children[kChildCapacity];
+        /// The buffered messages, sorted by key, at most one per key.
+        KeyT message_keys[kMessageCapacity];
+        ValueT message_values[kMessageCapacity];
+        uint8_t message_types[kMessageCapacity];
+
+        /// Returns the index of the child that covers `key`.
+        uint32_t child_index(const KeyT &key) const {
+            return node_lower_bound<KeyT, ComparatorT>(keys, this->count - 1, key);
+        }
+
+        /// Returns the index of the first message that is not less than `key`.
+        uint32_t message_index(const KeyT &key) const {
+            return node_lower_bound<KeyT, ComparatorT>(message_keys, message_count, key);
+        }
+
+        /// Inserts a message or replaces the message for the same key.
+        void add_message(const KeyT &key, const ValueT &value, uint8_t type) {
+            const ComparatorT comparator = ComparatorT();
+            uint32_t index = message_index(key);
+            if (index == message_count || comparator(key, message_keys[index])) {
+                move_messages(index, index + 1, message_count - index);
+                message_count++;
+            }
+            message_keys[index] = key;
+            message_values[index] = value;
+            message_types[index] = type;
+        }
+
+        /// Moves `count` messages from position `from` to position `to`.
+        void move_messages(uint32_t from, uint32_t to, uint32_t count) {
+            std::memmove(&message_keys[to], &message_keys[from], sizeof(KeyT) * count);
+            std::memmove(&message_values[to], &message_values[from], sizeof(ValueT) * count);
+            std::memmove(&message_types[to], &message_types[from], count);
+        }
+
+        /// Inserts a separator and the child right of it after child `index`.
+        void insert_child(uint32_t index, const KeyT &key, uint64_t child) {
+            std::memmove(&keys[index + 1], &keys[index], sizeof(KeyT) * (this->count - 1 - index));
+            std::memmove(&children[index + 2], &children[index + 1], sizeof(uint64_t) * (this->count - 1 - index));
+            keys[index] = key;
+            children[index + 1] = child;
+            this->count++;
+        }
+    };
+
+    static_assert(sizeof(InnerNode) <= PageSize, "inner nodes must fit into a page");
+    static_assert(sizeof(LeafNode) <= PageSize, "leaf nodes must fit into a page");
+
+    /// The first page of the segment. It describes the tree, so that the
+    /// tree can be opened again from its segment.
+    struct MetaPage {
+        /// `kMetaMagic` once the page was written.
+        uint64_t magic;
+        /// The layout of the tree, checked when the tree is opened.
+        uint32_t page_size;
+        uint16_t key_size;
+        uint16_t value_size;
+        /// The root, `kInvalidPageId` while the tree is empty.
+        uint64_t root;
+        /// The next page number that was never used.
+        uint64_t next_page_id;
+    };
+
+    /// Identifies the meta page of a `BufferedBTree`.
+    static constexpr uint64_t kMetaMagic = 0x45525446425a5542;  // "BUZBFTRE"
+
+    /// The root, `kInvalidPageId` while the tree is empty.
+    std::atomic<uint64_t> root{kInvalidPageId};
+    /// Serializes writers, readers share it.
+    std::shared_mutex tree_latch;
+    /// Next page number within the segment. Page 0 is the meta page.
+    std::atomic<uint64_t> next_page_id{1};
+
+    /// The entries of a leaf merged with a batch of messages, before they
+    /// are split. A batch holds at most a leaf's capacity of messages.
+    struct MergeBuffer {
+        KeyT keys[2 * LeafNode::kCapacity];
+        ValueT values[2 * LeafNode::kCapacity];
+    };
+    /// Scratch space of `apply()`, protected by `tree_latch`.
+    std::unique_ptr<MergeBuffer> merge_buffer = std::make_unique<MergeBuffer>();
+
+    /// Constructor. Opens the tree that is stored on the segment, or
+    /// initializes an empty tree if the segment holds none. Throws
+    /// `std::invalid_argument` if the segment holds a tree with other key or
+    /// value types or another page size.
+    BufferedBTree(uint16_t segment_id, BufferManager &buffer_manager)
+        : Segment(segment_id, buffer_manager) {
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), false);
+        MetaPage meta;
+        std::memcpy(&meta, metaPage.get_data(), sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, false);
+        if (meta.magic != kMetaMagic) {
+            write_meta();
+            return;
+        }
+        if (meta.page_size != PageSize || meta.key_size != sizeof(KeyT) || meta.value_size != sizeof(ValueT)) {
+            throw std::invalid_argument("segment holds a B+-tree with a different layout");
+        }
+        root.store(meta.root);
+        next_page_id.store(meta.next_page_id);
+    }
+
+    /// Destructor. Writes the meta page, the buffer manager writes it back.
+    ~BufferedBTree() {
+        std::unique_lock lock(tree_latch);
+        write_meta();
+    }
+
+    /// Lookup an entry in the tree. Pending messages on the path take
+    /// precedence over the leaf.
+    /// @param[in] key      The key that should be searched.
+    std::optional<ValueT> lookup(const KeyT &key) {
+        const ComparatorT comparator = ComparatorT();
+        std::shared_lock lock(tree_latch);
+        uint64_t pageId = root.load();
+        if (pageId == kInvalidPageId) {
+            return std::nullopt;
+        }
+        while (true) {
+            auto& page = this->buffer_manager.fix_page(pageId, false);
+            auto node = reinterpret_cast<Node*>(page.get_data());
+            if (node->is_leaf()) {
+                auto leafNode = static_cast<LeafNode*>(node);
+                uint32_t index = node_lower_bound<KeyT, ComparatorT>(leafNode->keys, leafNode->count, key);
+                std::optional<ValueT> value;
+                if (index < leafNode->count && !comparator(key, leafNode->keys[index])) {
+                    value = leafNode->values[index];
+                }
+                this->buffer_manager.unfix_page(page, false);
+                return value;
+            }
+            auto innerNode = static_cast<InnerNode*>(node);
+            uint32_t index = innerNode->message_index(key);
+            if (index < innerNode->message_count && !comparator(key, innerNode->message_keys[index])) {
+                std::optional<ValueT> value;
+                if (innerNode->message_types[index] == kInsert) {
+                    value = innerNode->message_values[index];
+                }
+                this->buffer_manager.unfix_page(page, false);
+                return value;
+            }
+            pageId = innerNode->children[innerNode->child_index(key)];
+            this->buffer_manager.unfix_page(page, false);
+        }
+    }
+
+    /// Inserts a new entry into the tree or replaces the value of an
+    /// existing one.
+    /// @param[in] key      The key that should be inserted.
+    /// @param[in] value    The value that should be inserted.
+    void insert(const KeyT &key, const ValueT &value) {
+        add_message(key, value, kInsert);
+    }
+
+    /// Erase an entry in the tree, if it exists.
+    /// @param[in] key      The key that should be erased.
+    void erase(const KeyT &key) {
+        add_message(key, ValueT(), kErase);
+    }
+
+    private:
+    uint64_t meta_page_id() const { return static_cast<uint64_t>(this->segment_id) << 48; }
+
+    /// Writes the meta page. Requires `tree_latch` unless the tree is being
+    /// constructed.
+    void write_meta() {
+        MetaPage meta;
+        std::memset(&meta, 0, sizeof(meta));
+        meta.magic = kMetaMagic;
+        meta.page_size = PageSize;
+        meta.key_size = sizeof(KeyT);
+        meta.value_size = sizeof(ValueT);
+        meta.root = root.load();
+        meta.next_page_id = next_page_id.load();
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), true);
+        std::memcpy(metaPage.get_data(), &meta, sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, true);
+    }
+
+    /// Returns a new page id of the segment.
+    uint64_t allocate_page() {
+        return (static_cast<uint64_t>(this->segment_id) << 48) | next_page_id.fetch_add(1);
+    }
+
+    /// Adds a message to the root, or applies it to a root leaf.
+    void add_message(const KeyT &key, const ValueT &value, uint8_t type) {
+        std::unique_lock lock(tree_latch);
+        if (root.load() == kInvalidPageId) {
+            auto rootPageId = allocate_page();
+            auto& rootPage = this->buffer_manager.fix_page(rootPageId, true);
+            std::memset(rootPage.get_data(), 0, PageSize);
+            this->buffer_manager.unfix_page(rootPage, true);
+            root.store(rootPageId);
+            write_meta();
+        }
+        while (true) {
+            uint64_t rootPageId = root.load();
+            auto& rootPage = this->buffer_manager.fix_page(rootPageId, true);
+            auto node = reinterpret_cast<Node*>(rootPage.get_data());
+            if (node->is_leaf()) {
+                auto split = apply(*static_cast<LeafNode*>(node), &key, &value, &type, 1);
+                if (split) {
+                    grow(rootPageId, node->level, split->first, split->second);
+                }
+                this->buffer_manager.unfix_page(rootPage, true);
+                return;
+            }
+            auto innerNode = static_cast<InnerNode*>(node);
+            if (innerNode->message_count == kMessageCapacity) {
+                flush(*innerNode, 1);
+            }
+            if (innerNode->count > kFanout) {
+                auto [separator, rightPageId] = split(*innerNode);
+                grow(rootPageId, node->level, separator, rightPageId);
+                this->buffer_manager.unfix_page(rootPage, true);
+                continue;
+            }
+            innerNode->add_message(key, value, type);
+            this->buffer_manager.unfix_page(rootPage, true);
+            return;
+        }
+    }
+
+    /// Creates a new root above the old root and the node that was split off
+    /// it.
+    void grow(uint64_t leftPageId, uint16_t level, const KeyT &separator, uint64_t rightPageId) {
+        auto newRootPageId = allocate_page();
+        auto& newRootPage = this->buffer_manager.fix_page(newRootPageId, true);
+        std::memset(newRootPage.get_data(), 0, PageSize);
+        auto newRoot = reinterpret_cast<InnerNode*>(newRootPage.get_data());
+        newRoot->level = level + 1;
+        newRoot->count = 2;
+        newRoot->keys[0] = separator;
+        newRoot->children[0] = leftPageId;
+        newRoot->children[1] = rightPageId;
+        this->buffer_manager.unfix_page(newRootPage, true);
+        root.store(newRootPageId);
+        write_meta();
+    }
+
+    /// Moves batches of messages from `node` to its children until the
+    /// buffer has room for `room` messages or the node has no room for
+    /// another child and has to be split by its parent first.
+    void flush(InnerNode& node, uint32_t room) {
+        while (node.message_count + room > kMessageCapacity && node.count <= kFanout) {
+            /// Find the child that receives the most messages, the messages
+            /// of a child are consecutive.
+            uint32_t bestChild = 0;
+            uint32_t bestBegin = 0;
+            uint32_t bestEnd = 0;
+            uint32_t begin = 0;
+            for (uint32_t child = 0; child < node.count && begin < node.message_count; child++) {
+                uint32_t end = child + 1 == node.count
+                    ? node.message_count
+                    : begin + node_lower_bound<KeyT, ComparatorT>(&node.message_keys[begin], node.message_count - begin, node.keys[child]);
+                /// Messages equal to the separator belong to this child
+                while (end < node.message_count && child + 1 < node.count && !ComparatorT()(node.keys[child], node.message_keys[end])) {
+                    end++;
+                }
+                if (end - begin > bestEnd - bestBegin) {
+                    bestChild = child;
+                    bestBegin = begin;
+                    bestEnd = end;
+                }
+                begin = end;
+            }
+            uint32_t batchSize = bestEnd - bestBegin;
+            auto& childPage = this->buffer_manager.fix_page(node.children[bestChild], true);
+            auto childNode = reinterpret_cast<Node*>(childPage.get_data());
+            if (childNode->is_leaf()) {
+                auto split = apply(*static_cast<LeafNode*>(childNode), &node.message_keys[bestBegin],
+                                   &node.message_values[bestBegin], &node.message_types[bestBegin], batchSize);
+                if (split) {
+                    node.insert_child(bestChild, split->first, split->second);
+                }
+            } else {
+                auto childInnerNode = static_cast<InnerNode*>(childNode);
+                if (childInnerNode->message_count + batchSize > kMessageCapacity) {
+                    flush(*childInnerNode, batchSize);
+                }
+                if (childInnerNode->count > kFanout) {
+                    /// The child has to be split before it takes more messages,
+                    /// they may belong to either half.
+                    auto [separator, rightPageId] = split(*childInnerNode);
+                    node.insert_child(bestChild, separator, rightPageId);
+                    this->buffer_manager.unfix_page(childPage, true);
+                    continue;
+                }
+                for (uint32_t i = bestBegin; i < bestEnd; i++) {
+                    childInnerNode->add_message(node.message_keys[i], node.message_values[i], node.message_types[i]);
+                }
+            }
+            this->buffer_manager.unfix_page(childPage, true);
+            node.move_messages(bestEnd, bestBegin, node.message_count - bestEnd);
+            node.message_count -= batchSize;
+        }
+    }
+
+    /// Splits an inner node in half, its messages go with the children they
+    /// belong to.
+    /// @return the separator and the page id of the new right node.
+    std::pair<KeyT, uint64_t> split(InnerNode& node) {
+        auto rightPageId = allocate_page();
+        auto& rightPage = this->buffer_manager.fix_page(rightPageId, true);
+        std::memset(rightPage.get_data(), 0, PageSize);
+        auto rightNode = reinterpret_cast<InnerNode*>(rightPage.get_data());
+        uint32_t leftCount = (node.count + 1) / 2;
+        uint32_t rightCount = node.count - leftCount;
+        KeyT separator = node.keys[leftCount - 1];
+        rightNode->level = node.level;
+        rightNode->count = rightCount;
+        std::memcpy(rightNode->keys, &node.keys[leftCount], sizeof(KeyT) * (rightCount - 1));
+        std::memcpy(rightNode->children, &node.children[leftCount], sizeof(uint64_t) * rightCount);
+        node.count = leftCount;
+        /// Messages up to the separator stay left
+        uint32_t messages = node.message_index(separator);
+        if (messages < node.message_count && !ComparatorT()(separator, node.message_keys[messages])) {
+            messages++;
+        }
+        uint32_t rightMessages = node.message_count - messages;
+        std::memcpy(rightNode->message_keys, &node.message_keys[messages], sizeof(KeyT) * rightMessages);
+        std::memcpy(rightNode->message_values, &node.message_values[messages], sizeof(ValueT) * rightMessages);
+        std::memcpy(rightNode->message_types, &node.message_types[messages], rightMessages);
+        rightNode->message_count = rightMessages;
+        node.message_count = messages;
+        this->buffer_manager.unfix_page(rightPage, true);
+        return {separator, rightPageId};
+    }
+
+    /// Applies sorted messages to a leaf. If the entries do not fit, the
+    /// upper half moves to a new leaf.
+    /// @return the separator and the page id of the new leaf, if any.
+    std::optional<std::pair<KeyT, uint64_t>> apply(LeafNode& leaf, const KeyT* keys, const ValueT* values,
+                                                   const uint8_t* types, uint32_t count) {
+        const ComparatorT comparator = ComparatorT();
+        KeyT* mergedKeys = merge_buffer->keys;
+        ValueT* mergedValues = merge_buffer->values;
+        uint32_t mergedCount = 0;
+        uint32_t i = 0;
+        uint32_t j = 0;
+        while (i < leaf.count || j < count) {
+            if (j == count || (i < leaf.count && comparator(leaf.keys[i], keys[j]))) {
+                mergedKeys[mergedCount] = leaf.keys[i];
+                mergedValues[mergedCount] = leaf.values[i];
+                mergedCount++;
+                i++;
+                continue;
+            }
+            /// The message replaces an entry with the same key
+            if (i < leaf.count && !comparator(keys[j], leaf.keys[i])) {
+                i++;
+            }
+            if (types[j] == kInsert) {
+                mergedKeys[mergedCount] = keys[j];
+                mergedValues[mergedCount] = values[j];
+                mergedCount++;
+            }
+            j++;
+        }
+        if (mergedCount <= LeafNode::kCapacity) {
+            std::copy(mergedKeys, mergedKeys + mergedCount, leaf.keys);
+            std::copy(mergedValues, mergedValues + mergedCount, leaf.values);
+            leaf.count = mergedCount;
+            return std::nullopt;
+        }
+        uint32_t leftCount = mergedCount / 2;
+        uint32_t rightCount = mergedCount - leftCount;
+        auto rightPageId = allocate_page();
+        auto& rightPage = this->buffer_manager.fix_page(rightPageId, true);
+        std::memset(rightPage.get_data(), 0, PageSize);
+        auto rightLeaf = reinterpret_cast<LeafNode*>(rightPage.get_data());
+        std::copy(mergedKeys + leftCount, mergedKeys + mergedCount, rightLeaf->keys);
+        std::copy(mergedValues + leftCount, mergedValues + mergedCount, rightLeaf->values);
+        rightLeaf->count = rightCount;
+        this->buffer_manager.unfix_page(rightPage, true);
+        std::copy(mergedKeys, mergedKeys + leftCount, leaf.keys);
+        std::copy(mergedValues, mergedValues + leftCount, leaf.values);
+        leaf.count = leftCount;
+        return std::make_pair(leaf.keys[leftCount - 1], rightPageId);
+    }
+};
+
+}  // namespace buzzdb
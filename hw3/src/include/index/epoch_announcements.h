@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+namespace buzzdb {
+
+/// Tracks the operations that run in each epoch, so that a thread can
+/// advance the epoch and wait until every operation that started in an
+/// older epoch is done, e.g. before it frees nodes those operations may
+/// still read. Operations announce themselves in one of a fixed number of
+/// slots, chosen once per thread, that each fill a cache line, so threads
+/// that only announce operations do not write to a shared cache line.
+/// Every slot counts the operations of the current and of the previous
+/// epoch apart. Is thread-safe, but `advance()` must not run concurrently
+/// with itself.
+class EpochAnnouncements {
+ public:
+    /// Announces an operation for as long as it lives.
+    class Announcement {
+     public:
+        explicit Announcement(EpochAnnouncements& announcements)
+            : announcements(announcements), epoch(announcements.enter()) {}
+
+        ~Announcement() { announcements.exit(epoch); }
+
+        Announcement(const Announcement&) = delete;
+        Announcement& operator=(const Announcement&) = delete;
+
+        /// Returns the epoch the operation runs in.
+        uint64_t get_epoch() const { return epoch; }
+
+     private:
+        EpochAnnouncements& announcements;
+        const uint64_t epoch;
+    };
+
+    /// Constructor.
+    /// @param[in] epoch The first epoch.
+    explicit EpochAnnouncements(uint64_t epoch = 0) : epoch(epoch) {}
+
+    EpochAnnouncements(const EpochAnnouncements&) = delete;
+    EpochAnnouncements& operator=(const EpochAnnouncements&) = delete;
+
+    /// Returns the current epoch.
+    uint64_t get_epoch() const { return epoch.load(); }
+
+    /// Sets the current epoch. No operation may be announced meanwhile.
+    void set_epoch(uint64_t new_epoch) { epoch.store(new_epoch); }
+
+    /// Announces an operation in the current epoch.
+    /// @return the epoch, which must be passed to `exit()`.
+    uint64_t enter() {
+        auto& slot = slots[slot_index()];
+        while (true) {
+            uint64_t current = epoch.load();
+            slot.active[current & 1].fetch_add(1);
+            if (epoch.load() == current) {
+                return current;
+            }
+            /// The epoch advanced meanwhile, `advance()` may have missed the
+            /// announcement
+            slot.active[current & 1].fetch_sub(1);
+        }
+    }
+
+    /// Ends an operation announced by `enter()` on the same thread.
+    void exit(uint64_t announced) {
+        slots[slot_index()].active[announced & 1].fetch_sub(1);
+    }
+
+    /// Advances the epoch and waits until all operations that were
+    /// announced in older epochs have ended.
+    /// @return the new epoch.
+    uint64_t advance() {
+        uint64_t previous = epoch.fetch_add(1);
+        /// The previous `advance()` waited for the epoch before `previous`,
+        /// so the counters of its parity only hold operations of `previous`
+        for (auto& slot : slots) {
+            while (slot.active[previous & 1].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+        return previous + 1;
+    }
+
+ private:
+    /// The number of slots, threads beyond it share slots.
+    static constexpr size_t kSlots = 64;
+
+    struct alignas(64) Slot {
+        /// The running operations of the even and of the odd epochs.
+        std::atomic<uint64_t> active[2] = {};
+    };
+
+    /// Returns the slot of the calling thread.
+    static size_t slot_index() {
+        static std::atomic<size_t> next_index{0};
+        thread_local size_t index = next_index.fetch_add(1) % kSlots;
+        return index;
+    }
+
+    std::atomic<uint64_t> epoch;
+    Slot slots[kSlots];
+};
+
+}  // namespace buzzdb
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+#include "index/node_search.h"
+
+namespace buzzdb {
+
+/// Layout policies for the entries of B+-tree leaves. A policy provides
+/// `Entries`, which a leaf node stores after its header and which holds the
+/// keys and values. The number of entries is kept in the node header and
+/// passed to every call. `kCapacity` is the most entries that fit into the
+/// given number of bytes, `kMinCapacity` the number that fits whatever the
+/// keys are; merged leaves never hold more than that. `has_room()` tells
+/// whether a key can be inserted without a split. `kId` is recorded in the
+/// meta page of a tree.
+
+/// Plain sorted arrays of keys and values.
+struct FlatLeafLayout {
+    static constexpr uint16_t kId = 0;
+
+    template<typename KeyT, typename ValueT, typename ComparatorT, size_t Bytes>
+    struct Entries {
+        static constexpr uint32_t kCapacity = Bytes / (sizeof(KeyT) + sizeof(ValueT));
+        static constexpr uint32_t kMinCapacity = kCapacity;
+
+        /// The keys.
+        KeyT keys[kCapacity];
+
+        /// The values.
+        ValueT values[kCapacity];
+
+        /// The number of entries that fit.
+        uint32_t capacity() const { return kCapacity; }
+
+        bool has_room(uint32_t count, const KeyT&) const { return count < kCapacity; }
+
+        KeyT key(uint32_t index) const { return keys[index]; }
+
+        ValueT& value(uint32_t index) { return values[index]; }
+        const ValueT& value(uint32_t index) const { return values[index]; }
+
+        /// Returns the first position in [from, count) whose key is not less
+        /// than `key`, or `count`.
+        uint32_t lower_bound(uint32_t from, uint32_t count, const KeyT &key) const {
+            return from + node_lower_bound<KeyT, ComparatorT>(keys + from, count - from, key);
+        }
+
+        /// Address to prefetch before the entries are searched.
+        const void* search_hint(uint32_t count) const { return &keys[count / 2]; }
+
+        void insert(uint32_t index, uint32_t count, const KeyT &key, const ValueT &value) {
+            std::memmove(&keys[index + 1], &keys[index], sizeof(KeyT) * (count - index));
+            std::memmove(&values[index + 1], &values[index], sizeof(ValueT) * (count - index));
+            keys[index] = key;
+            values[index] = value;
+        }
+
+        void erase(uint32_t index, uint32_t count) {
+            std::memmove(&keys[index], &keys[index + 1], sizeof(KeyT) * (count - 1 - index));
+            std::memmove(&values[index], &values[index + 1], sizeof(ValueT) * (count - 1 - index));
+        }
+
+        /// Replaces all entries, the keys must fit, see `fits()`.
+        void assign(const KeyT* newKeys, const ValueT* newValues, uint32_t count) {
+            std::copy(newKeys, newKeys + count, keys);
+            std::copy(newValues, newValues + count, values);
+        }
+
+        /// Whether sorted keys fit into one leaf.
+        static bool fits(const KeyT*, uint32_t count) { return count <= kCapacity; }
+
+        /// Moves the upper half of the entries to the empty `right`.
+        /// @return the largest key that stays.
+        KeyT split(uint16_t& count, Entries& right, uint16_t& rightCount) {
+            uint32_t leftCount = (count + 1) / 2;
+            rightCount = count - leftCount;
+            std::memcpy(right.keys, &keys[leftCount], sizeof(KeyT) * rightCount);
+            std::memcpy(right.values, &values[leftCount], sizeof(ValueT) * rightCount);
+            count = leftCount;
+            return keys[leftCount - 1];
+        }
+
+        /// Appends all entries of the right sibling.
+        void merge(uint16_t& count, const Entries& right, uint16_t rightCount) {
+            std::memcpy(&keys[count], right.keys, sizeof(KeyT) * rightCount);
+            std::memcpy(&values[count], right.values, sizeof(ValueT) * rightCount);
+            count += rightCount;
+        }
+
+        /// Moves entries to or from the right sibling so that both hold the
+        /// same number.
+        /// @return the largest key that stays.
+        KeyT balance(uint16_t& count, Entries& right, uint16_t& rightCount) {
+            uint32_t leftCount = (count + rightCount) / 2;
+            if (count > leftCount) {
+                uint32_t moved = count - leftCount;
+                std::memmove(&right.keys[moved], right.keys, sizeof(KeyT) * rightCount);
+                std::memmove(&right.values[moved], right.values, sizeof(ValueT) * rightCount);
+                std::memcpy(right.keys, &keys[leftCount], sizeof(KeyT) * moved);
+                std::memcpy(right.values, &values[leftCount], sizeof(ValueT) * moved);
+                rightCount += moved;
+            } else {
+                uint32_t moved = leftCount - count;
+                std::memcpy(&keys[count], right.keys, sizeof(KeyT) * moved);
+                std::memcpy(&values[count], right.values, sizeof(ValueT) * moved);
+                std::memmove(right.keys, &right.keys[moved], sizeof(KeyT) * (rightCount - moved));
+                std::memmove(right.values, &right.values[moved], sizeof(ValueT) * (rightCount - moved));
+                rightCount -= moved;
+            }
+            count = leftCount;
+            return keys[leftCount - 1];
+        }
+    };
+};
+
+/// Frame-of-reference encoding for unsigned 64 bit keys in ascending order,
+/// for dense keys like generated ids and timestamps. A leaf stores a base
+/// and every key as a 32 bit offset from it, so that about a third more
+/// entries fit with 8 byte values; the offsets are searched with the same
+/// vector instructions as plain keys. A leaf whose keys span more than the
+/// 32 bit range of an offset falls back to plain keys. Leaves are encoded
+/// again whenever they are split, merged or balanced.
+struct FrameOfReferenceLeafLayout {
+    static constexpr uint16_t kId = 1;
+
+    template<typename KeyT, typename ValueT, typename ComparatorT, size_t Bytes>
+    struct Entries {
+        static_assert(std::is_unsigned_v<KeyT> && sizeof(KeyT) == 8, "keys must be unsigned 64 bit integers");
+        static_assert(std::is_same_v<ComparatorT, std::less<KeyT>> || std::is_same_v<ComparatorT, std::less<>>,
+                      "keys must be in ascending order");
+        static_assert(alignof(ValueT) <= alignof(uint64_t), "values must not need more than 8 byte alignment");
+
+        using Offset = uint32_t;
+
+        static constexpr Offset kMaxOffset = std::numeric_limits<Offset>::max();
+        /// The bytes behind the base and the encoding.
+        static constexpr size_t kDataBytes = Bytes - 2 * sizeof(uint64_t);
+
+        /// Returns where the values start behind `count` keys of `keySize`
+        /// bytes.
+        static constexpr size_t values_offset(size_t count, size_t keySize) {
+            return (count * keySize + alignof(ValueT) - 1) / alignof(ValueT) * alignof(ValueT);
+        }
+
+        static constexpr uint32_t capacity_for(size_t keySize) {
+            auto count = static_cast<uint32_t>(kDataBytes / (keySize + sizeof(ValueT)));
+            while (count != 0 && values_offset(count, keySize) + count * sizeof(ValueT) > kDataBytes) {
+                count--;
+            }
+            return count;
+        }
+
+        static constexpr uint32_t kCapacity = capacity_for(sizeof(Offset));
+        /// The capacity of a leaf with plain keys.
+        static constexpr uint32_t kPlainCapacity = capacity_for(sizeof(KeyT));
+        static constexpr uint32_t kMinCapacity = kPlainCapacity;
+
+        /// The most entries that two leaves hold together. `split()`,
+        /// `merge()` and `balance()` decode the entries into arrays of this
+        /// size on the stack.
+        static constexpr uint32_t kMaxDecoded = 2 * kCapacity;
+
+        /// Splitting a full leaf, or balancing an underfull leaf with a full
+        /// sibling, must leave halves that fit even with plain keys.
+        static_assert(kPlainCapacity >= (kCapacity + kCapacity / 4 + 1) / 2 + 1,
+                      "values are too small for frame-of-reference keys");
+
+        /// The smallest key is at least the base, and all keys are at most
+        /// `kMaxOffset` above it.
+        KeyT base = 0;
+        /// Whether the keys are offsets, otherwise they are plain keys.
+        uint32_t packed = 1;
+        uint32_t padding = 0;
+        /// Keys followed by values.
+        alignas(uint64_t) std::byte data[kDataBytes];
+
+        uint32_t capacity() const { return packed ? kCapacity : kPlainCapacity; }
+
+        bool has_room(uint32_t count, const KeyT &key) const {
+            if (packed && in_frame(count, key)) {
+                return count < kCapacity;
+            }
+            return count < kPlainCapacity;
+        }
+
+        /// Optimistic readers may see a position of the other encoding, so
+        /// positions of plain keys are clamped.
+        KeyT key(uint32_t index) const {
+            if (packed) {
+                return base + offsets()[index];
+            }
+            return plain_keys()[std::min(index, kPlainCapacity - 1)];
+        }
+
+        ValueT& value(uint32_t index) {
+            if (packed) {
+                return values_of(true)[index];
+            }
+            return values_of(false)[std::min(index, kPlainCapacity - 1)];
+        }
+
+        const ValueT& value(uint32_t index) const {
+            return const_cast<Entries*>(this)->value(index);
+        }
+
+        uint32_t lower_bound(uint32_t from, uint32_t count, const KeyT &key) const {
+            if (!packed) {
+                count = std::min(count, kPlainCapacity);
+                from = std::min(from, count);
+                return from + node_lower_bound<KeyT, ComparatorT>(plain_keys() + from, count - from, key);
+            }
+            if (key < base) {
+                return from;
+            }
+            if (key - base > kMaxOffset) {
+                return count;
+            }
+            auto offset = static_cast<Offset>(key - base);
+            return from + node_lower_bound<Offset, std::less<Offset>>(offsets() + from, count - from, offset);
+        }
+
+        const void* search_hint(uint32_t count) const {
+            return packed ? static_cast<const void*>(&offsets()[count / 2]) : &plain_keys()[count / 2];
+        }
+
+        /// Inserts at `index`, `has_room()` must hold. A key outside the
+        /// frame moves the base down or switches to plain keys.
+        void insert(uint32_t index, uint32_t count, const KeyT &key, const ValueT &value) {
+            if (packed && !in_frame(count, key)) {
+                unpack(count);
+            }
+            if (!packed) {
+                KeyT* keys = plain_keys();
+                ValueT* values = values_of(false);
+                std::memmove(&keys[index + 1], &keys[index], sizeof(KeyT) * (count - index));
+                std::memmove(&values[index + 1], &values[index], sizeof(ValueT) * (count - index));
+                keys[index] = key;
+                values[index] = value;
+                return;
+            }
+            Offset* offsets = this->offsets();
+            ValueT* values = values_of(true);
+            if (count == 0) {
+                base = key;
+            } else if (key < base) {
+                auto shift = static_cast<Offset>(base - key);
+                for (uint32_t i = 0; i < count; i++) {
+                    offsets[i] += shift;
+                }
+                base = key;
+            }
+            std::memmove(&offsets[index + 1], &offsets[index], sizeof(Offset) * (count - index));
+            std::memmove(&values[index + 1], &values[index], sizeof(ValueT) * (count - index));
+            offsets[index] = static_cast<Offset>(key - base);
+            values[index] = value;
+        }
+
+        void erase(uint32_t index, uint32_t count) {
+            ValueT* values = values_of(packed);
+            if (packed) {
+                std::memmove(&offsets()[index], &offsets()[index + 1], sizeof(Offset) * (count - 1 - index));
+            } else {
+                std::memmove(&plain_keys()[index], &plain_keys()[index + 1], sizeof(KeyT) * (count - 1 - index));
+            }
+            std::memmove(&values[index], &values[index + 1], sizeof(ValueT) * (count - 1 - index));
+        }
+
+        /// Replaces all entries with the most compact encoding that holds
+        /// them. The keys must fit into a leaf, see `fits()`.
+        void assign(const KeyT* keys, const ValueT* values, uint32_t count) {
+            if (count == 0 || (count <= kCapacity && keys[count - 1] - keys[0] <= kMaxOffset)) {
+                encode_packed(keys, values, count);
+            } else {
+                encode_plain(keys, values, count);
+            }
+        }
+
+        /// Whether sorted keys fit into one leaf.
+        static bool fits(const KeyT* keys, uint32_t count) {
+            return count <= kPlainCapacity || (count <= kCapacity && keys[count - 1] - keys[0] <= kMaxOffset);
+        }
+
+        KeyT split(uint16_t& count, Entries& right, uint16_t& rightCount) {
+            KeyT keys[kMaxDecoded];
+            ValueT values[kMaxDecoded];
+            decode(0, count, keys, values);
+            uint32_t leftCount = (count + 1) / 2;
+            rightCount = count - leftCount;
+            right.assign(&keys[leftCount], &values[leftCount], rightCount);
+            assign(keys, values, leftCount);
+            count = leftCount;
+            return keys[leftCount - 1];
+        }
+
+        void merge(uint16_t& count, const Entries& right, uint16_t rightCount) {
+            KeyT keys[kMaxDecoded];
+            ValueT values[kMaxDecoded];
+            decode(0, count, keys, values);
+            right.decode(0, rightCount, &keys[count], &values[count]);
+            count += rightCount;
+            assign(keys, values, count);
+        }
+
+        KeyT balance(uint16_t& count, Entries& right, uint16_t& rightCount) {
+            uint32_t total = count + rightCount;
+            KeyT keys[kMaxDecoded];
+            ValueT values[kMaxDecoded];
+            decode(0, count, keys, values);
+            right.decode(0, rightCount, &keys[count], &values[count]);
+            uint32_t leftCount = total / 2;
+            rightCount = total - leftCount;
+            right.assign(&keys[leftCount], &values[leftCount], rightCount);
+            assign(keys, values, leftCount);
+            count = leftCount;
+            return keys[leftCount - 1];
+        }
+
+        private:
+        Offset* offsets() { return reinterpret_cast<Offset*>(data); }
+        const Offset* offsets() const { return reinterpret_cast<const Offset*>(data); }
+
+        KeyT* plain_keys() { return reinterpret_cast<KeyT*>(data); }
+        const KeyT* plain_keys() const { return reinterpret_cast<const KeyT*>(data); }
+
+        ValueT* values_of(bool isPacked) {
+            return reinterpret_cast<ValueT*>(
+                data + (isPacked ? values_offset(kCapacity, sizeof(Offset)) : values_offset(kPlainCapacity, sizeof(KeyT))));
+        }
+        const ValueT* values_of(bool isPacked) const {
+            return const_cast<Entries*>(this)->values_of(isPacked);
+        }
+
+        /// Whether the packed entries and `key` fit into one frame.
+        bool in_frame(uint32_t count, const KeyT &key) const {
+            if (count == 0) {
+                return true;
+            }
+            KeyT last = base + offsets()[count - 1];
+            return std::max(key, last) - std::min(key, base) <= kMaxOffset;
+        }
+
+        /// Switches packed entries to plain keys in place. The values move
+        /// first, to behind the room of `kPlainCapacity` plain keys, then the
+        /// offsets are widened from the back so that none is overwritten
+        /// before it is read.
+        void unpack(uint32_t count) {
+            static_assert(sizeof(KeyT) >= sizeof(Offset), "plain keys are at least as wide as offsets");
+            std::memmove(values_of(false), values_of(true), sizeof(ValueT) * count);
+            for (uint32_t i = count; i-- > 0;) {
+                Offset offset;
+                std::memcpy(&offset, &data[i * sizeof(Offset)], sizeof(offset));
+                KeyT key = base + offset;
+                std::memcpy(&data[i * sizeof(KeyT)], &key, sizeof(key));
+            }
+            packed = 0;
+        }
+
+        /// Copies the entries in [from, from + count) into the arrays.
+        void decode(uint32_t from, uint32_t count, KeyT* keys, ValueT* values) const {
+            for (uint32_t i = 0; i < count; i++) {
+                keys[i] = key(from + i);
+            }
+            std::copy(values_of(packed) + from, values_of(packed) + from + count, values);
+        }
+
+        void encode_packed(const KeyT* keys, const ValueT* values, uint32_t count) {
+            packed = 1;
+            base = count == 0 ? 0 : keys[0];
+            for (uint32_t i = 0; i < count; i++) {
+                offsets()[i] = static_cast<Offset>(keys[i] - base);
+            }
+            std::copy(values, values + count, values_of(true));
+        }
+
+        void encode_plain(const KeyT* keys, const ValueT* values, uint32_t count) {
+            packed = 0;
+            std::copy(keys, keys + count, plain_keys());
+            std::copy(values, values + count, values_of(false));
+        }
+    };
+};
+
+}  // namespace buzzdb
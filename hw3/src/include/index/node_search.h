@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace buzzdb {
+
+namespace node_search {
+
+/// Whether keys of type `KeyT` ordered by `ComparatorT` are compared with
+/// vector instructions: 32 and 64 bit integers in ascending order.
+template<typename KeyT, typename ComparatorT>
+constexpr bool kVectorized = std::is_integral_v<KeyT> && (sizeof(KeyT) == 4 || sizeof(KeyT) == 8) &&
+                             (std::is_same_v<ComparatorT, std::less<KeyT>> || std::is_same_v<ComparatorT, std::less<>>);
+
+/// Number of keys the binary search narrows the range down to before the
+/// remaining keys are compared all at once. One cache line of keys.
+template<typename KeyT>
+constexpr uint32_t kWindow = 64 / sizeof(KeyT);
+
+/// Returns how many of the `count` keys are less than `key`.
+template<typename KeyT>
+uint32_t count_less(const KeyT* keys, uint32_t count, KeyT key) {
+    uint32_t less = 0;
+    uint32_t i = 0;
+#if defined(__AVX512F__)
+    if constexpr (sizeof(KeyT) == 8) {
+        auto needle = _mm512_set1_epi64(static_cast<int64_t>(key));
+        for (; i + 8 <= count; i += 8) {
+            auto values = _mm512_loadu_si512(&keys[i]);
+            __mmask8 mask;
+            if constexpr (std::is_signed_v<KeyT>) {
+                mask = _mm512_cmplt_epi64_mask(values, needle);
+            } else {
+                mask = _mm512_cmplt_epu64_mask(values, needle);
+            }
+            less += __builtin_popcount(mask);
+        }
+    } else {
+        auto needle = _mm512_set1_epi32(static_cast<int32_t>(key));
+        for (; i + 16 <= count; i += 16) {
+            auto values = _mm512_loadu_si512(&keys[i]);
+            __mmask16 mask;
+            if constexpr (std::is_signed_v<KeyT>) {
+                mask = _mm512_cmplt_epi32_mask(values, needle);
+            } else {
+                mask = _mm512_cmplt_epu32_mask(values, needle);
+            }
+            less += __builtin_popcount(mask);
+        }
+    }
+#elif defined(__AVX2__)
+    /// AVX2 only compares signed integers, unsigned keys are shifted into
+    /// the signed range by flipping their sign bit.
+    if constexpr (sizeof(KeyT) == 8) {
+        auto bias = _mm256_set1_epi64x(std::is_signed_v<KeyT> ? 0 : INT64_MIN);
+        auto needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), bias);
+        for (; i + 4 <= count; i += 4) {
+            auto values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&keys[i])), bias);
+            auto mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, values)));
+            less += __builtin_popcount(mask);
+        }
+    } else {
+        auto bias = _mm256_set1_epi32(std::is_signed_v<KeyT> ? 0 : INT32_MIN);
+        auto needle = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(key)), bias);
+        for (; i + 8 <= count; i += 8) {
+            auto values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&keys[i])), bias);
+            auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, values)));
+            less += __builtin_popcount(mask);
+        }
+    }
+#endif
+    /// Remaining keys, and all keys without vector instructions. Counting
+    /// instead of stopping at the first key that is not less keeps the loop
+    /// free of data-dependent branches.
+    for (; i < count; i++) {
+        less += keys[i] < key;
+    }
+    return less;
+}
+
+}  // namespace node_search
+
+/// Returns the index of the first of the `count` sorted keys that is not
+/// less than `key`, or `count` if there is none.
+/// Uses a branchless binary search. For integral keys in ascending order the
+/// search stops at `kWindow` keys and compares them with vector instructions
+/// when the code is compiled for AVX2 or AVX-512.
+template<typename KeyT, typename ComparatorT>
+uint32_t node_lower_bound(const KeyT* keys, uint32_t count, const KeyT &key) {
+    const ComparatorT comparator = ComparatorT();
+    const KeyT* base = keys;
+    uint32_t n = count;
+    if constexpr (node_search::kVectorized<KeyT, ComparatorT>) {
+        while (n > node_search::kWindow<KeyT>) {
+            uint32_t half = n / 2;
+            base = comparator(base[half - 1], key) ? base + half : base;
+            n -= half;
+        }
+        return static_cast<uint32_t>(base - keys) + node_search::count_less(base, n, key);
+    } else {
+        while (n > 1) {
+            uint32_t half = n / 2;
+            base = comparator(base[half - 1], key) ? base + half : base;
+            n -= half;
+        }
+        return static_cast<uint32_t>(base - keys) + (n == 1 && comparator(*base, key));
+    }
+}
+
+/// Layout policies for the keys of B+-tree inner nodes. A policy provides
+/// the number of keys and children that fit into a given number of bytes
+/// and an `Index` that the inner node derives from. The index is rebuilt by
+/// `update()` whenever the keys change and speeds up `find()`, which
+/// returns the same position as `node_lower_bound()`. `kId` identifies the
+/// policy together with its parameters and is recorded in the meta page of
+/// a tree.
+
+/// Plain sorted keys, searched directly.
+struct FlatInnerLayout {
+    static constexpr uint32_t kId = 0;
+
+    template<typename KeyT>
+    static constexpr uint32_t capacity(size_t bytes) {
+        return bytes / (sizeof(KeyT) + sizeof(uint64_t));
+    }
+
+    template<typename KeyT, typename ComparatorT, uint32_t Capacity>
+    struct Index {
+        void update(const KeyT*, uint32_t) {}
+
+        uint32_t find(const KeyT* keys, uint32_t numKeys, const KeyT &key) const {
+            return node_lower_bound<KeyT, ComparatorT>(keys, numKeys, key);
+        }
+    };
+};
+
+/// Sorted keys plus an in-page index of every `Stride`-th key. A search
+/// first looks up the block of `Stride` keys in the small index, which stays
+/// in a few cache lines even for large pages, and then searches only that
+/// block instead of probing the whole key array.
+template<uint32_t Stride = 16>
+struct SampledInnerLayout {
+    static_assert(Stride >= 2, "a block must hold more than one key");
+    static_assert(Stride <= 0xffff, "the stride must fit into the low half of kId");
+
+    static constexpr uint32_t kId = (1u << 16) | Stride;
+
+    template<typename KeyT>
+    static constexpr uint32_t capacity(size_t bytes) {
+        /// Reserve a word for padding between the index and the keys
+        bytes -= sizeof(uint64_t);
+        auto count = static_cast<uint32_t>(bytes / (sizeof(KeyT) + sizeof(uint64_t)));
+        while (count != 0 && std::max<uint32_t>(count / Stride, 1) * sizeof(KeyT) + count * (sizeof(KeyT) + sizeof(uint64_t)) > bytes) {
+            count--;
+        }
+        return count;
+    }
+
+    template<typename KeyT, typename ComparatorT, uint32_t Capacity>
+    struct Index {
+        /// The last key of every complete block.
+        KeyT samples[std::max<uint32_t>(Capacity / Stride, 1)];
+
+        void update(const KeyT* keys, uint32_t numKeys) {
+            for (uint32_t i = 0; i < numKeys / Stride; i++) {
+                samples[i] = keys[i * Stride + Stride - 1];
+            }
+        }
+
+        uint32_t find(const KeyT* keys, uint32_t numKeys, const KeyT &key) const {
+            uint32_t numSamples = numKeys / Stride;
+            uint32_t block = node_lower_bound<KeyT, ComparatorT>(samples, numSamples, key);
+            uint32_t first = block * Stride;
+            uint32_t count = std::min(numKeys - first, Stride);
+            return first + node_lower_bound<KeyT, ComparatorT>(&keys[first], count, key);
+        }
+    };
+};
+
+}  // namespace buzzdb
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+#include "index/btree.h"
+
+namespace buzzdb {
+
+/// Non-unique index on a B+-tree, e.g. a secondary index on a column with
+/// duplicates. Every key maps to the sorted set of its values, e.g. tuple
+/// ids, which is stored as a posting list: inside the leaf entry while it is
+/// small, on a chain of overflow pages once it outgrows the entry. Both
+/// store the values delta-encoded as varints, so close values take about a
+/// byte each.
+/// All values of a key are read from its leaf and its overflow pages. The
+/// leaf latch protects the overflow pages: readers hold it shared and
+/// writers exclusively while they access the chain.
+template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize>
+struct PostingBTree {
+    static_assert(std::is_integral_v<ValueT> && std::is_unsigned_v<ValueT>,
+                  "posting lists delta-encode unsigned integers");
+
+    /// Bytes of a posting list that are stored in the leaf entry.
+    static constexpr uint32_t kInlineSize = 24;
+
+    /// The value of a key in the underlying tree.
+    struct PostingList {
+        /// The number of values.
+        uint32_t count;
+        /// Bytes of `data` in use while the values are inline.
+        uint16_t size;
+        /// Whether the values are on overflow pages, `data` holds the id of
+        /// the first page then.
+        uint16_t overflow;
+        /// The encoded values or the first overflow page.
+        uint8_t data[kInlineSize];
+    };
+
+    using Tree = BTree<KeyT, PostingList, ComparatorT, PageSize>;
+
+    /// Marks overflow pages, so that they are never taken for nodes.
+    static constexpr uint16_t kOverflowLevel = std::numeric_limits<uint16_t>::max() - 1;
+
+    struct OverflowHeader: public Tree::Node {
+        /// The next page of the list, `kInvalidPageId` for the last one.
+        uint64_t next;
+        /// The largest value on the page.
+        ValueT max_value;
+        /// Bytes of `data` in use.
+        uint32_t size;
+
+        OverflowHeader() : Tree::Node(kOverflowLevel, 0), next(Tree::kInvalidPageId), max_value(0), size(0) {}
+    };
+
+    /// A page of a posting list. The `count` of the node header is the
+    /// number of values on the page, the first one is encoded in full.
+    struct OverflowPage: public OverflowHeader {
+        static constexpr uint32_t kCapacity = PageSize - sizeof(OverflowHeader);
+
+        uint8_t data[kCapacity];
+    };
+
+    static_assert(sizeof(OverflowPage) <= PageSize, "overflow pages must fit into a page");
+
+    /// Constructor.
+    PostingBTree(uint16_t segment_id, BufferManager &buffer_manager)
+        : tree(segment_id, buffer_manager), buffer_manager(buffer_manager) {}
+
+    /// Adds a value to the posting list of a key. Adding a value that the
+    /// list already contains has no effect.
+    /// @param[in] key      The key.
+    /// @param[in] value    The value that should be added.
+    void insert(const KeyT &key, const ValueT &value) {
+        tree.update(key, [&](PostingList& list, bool found) {
+            if (!found) {
+                std::memset(&list, 0, sizeof(list));
+            }
+            add(list, value);
+            return true;
+        });
+    }
+
+    /// Removes a value from the posting list of a key, a key without values
+    /// is removed from the tree.
+    /// @param[in] key      The key.
+    /// @param[in] value    The value that should be removed.
+    /// @return whether the value was found.
+    bool erase(const KeyT &key, const ValueT &value) {
+        bool removed = false;
+        tree.update(key, [&](PostingList& list, bool found) {
+            removed = found && remove(list, value);
+            return found && list.count > 0;
+        });
+        return removed;
+    }
+
+    /// Removes a key and all its values.
+    /// @param[in] key      The key.
+    void erase(const KeyT &key) {
+        tree.update(key, [&](PostingList& list, bool found) {
+            if (found && list.overflow) {
+                free_chain(first_page(list));
+            }
+            return false;
+        });
+    }
+
+    /// Calls `callback` with the values of a key in ascending order until it
+    /// returns false. The leaf of the key stays latched shared meanwhile, so
+    /// `callback` must not modify the index.
+    /// @param[in] key      The key.
+    /// @param[in] callback Receives the values.
+    /// @return whether the key was found.
+    bool for_each(const KeyT &key, const std::function<bool(const ValueT&)> &callback) {
+        return tree.read(key, [&](const PostingList& list) {
+            std::vector<ValueT> values;
+            if (!list.overflow) {
+                decode(list.data, list.count, values);
+                for (auto& value : values) {
+                    if (!callback(value)) {
+                        return;
+                    }
+                }
+                return;
+            }
+            for (uint64_t pageId = first_page(list); pageId != Tree::kInvalidPageId;) {
+                auto& page = buffer_manager.fix_page(pageId, false);
+                auto overflowPage = reinterpret_cast<OverflowPage*>(page.get_data());
+                values.clear();
+                decode(overflowPage->data, overflowPage->count, values);
+                pageId = overflowPage->next;
+                buffer_manager.unfix_page(page, false);
+                for (auto& value : values) {
+                    if (!callback(value)) {
+                        return;
+                    }
+                }
+            }
+        });
+    }
+
+    /// Returns the values of a key in ascending order.
+    /// @param[in] key      The key.
+    std::vector<ValueT> lookup(const KeyT &key) {
+        std::vector<ValueT> values;
+        for_each(key, [&](const ValueT& value) {
+            values.push_back(value);
+            return true;
+        });
+        return values;
+    }
+
+    /// Returns the number of values of a key.
+    /// @param[in] key      The key.
+    uint32_t count(const KeyT &key) {
+        uint32_t count = 0;
+        tree.read(key, [&](const PostingList& list) { count = list.count; });
+        return count;
+    }
+
+    /// The tree that maps each key to its posting list.
+    Tree tree;
+
+    private:
+    BufferManager& buffer_manager;
+
+    /// Largest size of an encoded value.
+    static constexpr uint32_t kMaxVarintSize = (sizeof(ValueT) * 8 + 6) / 7;
+
+    /// Writes `value` as a varint to `out`.
+    /// @return the number of bytes written.
+    static uint32_t encode_varint(uint64_t value, uint8_t* out) {
+        uint32_t size = 0;
+        while (value >= 0x80) {
+            out[size++] = static_cast<uint8_t>(value) | 0x80;
+            value >>= 7;
+        }
+        out[size++] = static_cast<uint8_t>(value);
+        return size;
+    }
+
+    /// Encodes sorted values, the first one in full and every other one as
+    /// the difference to its predecessor.
+    /// @return the number of bytes written, or more than `capacity` if the
+    ///         values do not fit, `out` is then left partially written.
+    static uint32_t encode(const ValueT* values, uint32_t count, uint8_t* out, uint32_t capacity) {
+        uint8_t buffer[kMaxVarintSize];
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t length = encode_varint(i == 0 ? values[0] : values[i] - values[i - 1], buffer);
+            if (size + length > capacity) {
+                return capacity + 1;
+            }
+            std::memcpy(out + size, buffer, length);
+            size += length;
+        }
+        return size;
+    }
+
+    /// Appends `count` encoded values to `values`.
+    static void decode(const uint8_t* in, uint32_t count, std::vector<ValueT>& values) {
+        uint64_t previous = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t delta = 0;
+            for (uint32_t shift = 0;; shift += 7) {
+                uint8_t byte = *in++;
+                delta |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            previous = i == 0 ? delta : previous + delta;
+            values.push_back(static_cast<ValueT>(previous));
+        }
+    }
+
+    static uint64_t first_page(const PostingList& list) {
+        uint64_t pageId;
+        std::memcpy(&pageId, list.data, sizeof(pageId));
+        return pageId;
+    }
+
+    static void set_first_page(PostingList& list, uint64_t pageId) {
+        std::memcpy(list.data, &pageId, sizeof(pageId));
+    }
+
+    /// Writes sorted values to an overflow page.
+    /// @return whether they fit, the page is left partially written if not.
+    static bool write_page(OverflowPage& page, const ValueT* values, uint32_t count) {
+        uint32_t size = encode(values, count, page.data, OverflowPage::kCapacity);
+        if (size > OverflowPage::kCapacity) {
+            return false;
+        }
+        page.size = size;
+        page.count = count;
+        page.max_value = values[count - 1];
+        return true;
+    }
+
+    /// Returns a new, empty overflow page, fixed exclusively.
+    BufferFrame& new_page(uint64_t& pageId) {
+        pageId = tree.allocate_page();
+        auto& page = buffer_manager.fix_page(pageId, true);
+        std::memset(page.get_data(), 0, PageSize);
+        new (page.get_data()) OverflowPage();
+        return page;
+    }
+
+    /// Adds a value to a posting list.
+    void add(PostingList& list, const ValueT &value) {
+        std::vector<ValueT> values;
+        if (!list.overflow) {
+            decode(list.data, list.count, values);
+            auto position = std::lower_bound(values.begin(), values.end(), value);
+            if (position != values.end() && *position == value) {
+                return;
+            }
+            values.insert(position, value);
+            uint8_t data[kInlineSize];
+            uint32_t size = encode(values.data(), values.size(), data, kInlineSize);
+            if (size <= kInlineSize) {
+                std::memcpy(list.data, data, size);
+                list.size = size;
+                list.count++;
+                return;
+            }
+            /// The list moves to an overflow page
+            uint64_t pageId;
+            auto& page = new_page(pageId);
+            write_page(*reinterpret_cast<OverflowPage*>(page.get_data()), values.data(), values.size());
+            buffer_manager.unfix_page(page, true);
+            list.overflow = 1;
+            list.size = 0;
+            set_first_page(list, pageId);
+            list.count++;
+            return;
+        }
+        /// Find the first page whose largest value is not less than the value,
+        /// or the last page
+        uint64_t pageId = first_page(list);
+        auto page = &buffer_manager.fix_page(pageId, true);
+        auto overflowPage = reinterpret_cast<OverflowPage*>(page->get_data());
+        while (overflowPage->max_value < value && overflowPage->next != Tree::kInvalidPageId) {
+            pageId = overflowPage->next;
+            auto& nextPage = buffer_manager.fix_page(pageId, true);
+            buffer_manager.unfix_page(*page, false);
+            page = &nextPage;
+            overflowPage = reinterpret_cast<OverflowPage*>(page->get_data());
+        }
+        decode(overflowPage->data, overflowPage->count, values);
+        auto position = std::lower_bound(values.begin(), values.end(), value);
+        if (position != values.end() && *position == value) {
+            buffer_manager.unfix_page(*page, false);
+            return;
+        }
+        values.insert(position, value);
+        list.count++;
+        if (write_page(*overflowPage, values.data(), values.size())) {
+            buffer_manager.unfix_page(*page, true);
+            return;
+        }
+        /// Split the page, the upper half moves to a new page after it
+        uint32_t leftCount = values.size() / 2;
+        uint64_t newPageId;
+        auto& newPage = new_page(newPageId);
+        auto newOverflowPage = reinterpret_cast<OverflowPage*>(newPage.get_data());
+        write_page(*newOverflowPage, values.data() + leftCount, values.size() - leftCount);
+        newOverflowPage->next = overflowPage->next;
+        write_page(*overflowPage, values.data(), leftCount);
+        overflowPage->next = newPageId;
+        buffer_manager.unfix_page(newPage, true);
+        buffer_manager.unfix_page(*page, true);
+    }
+
+    /// Removes a value from a posting list.
+    /// @return whether the value was found.
+    bool remove(PostingList& list, const ValueT &value) {
+        std::vector<ValueT> values;
+        if (!list.overflow) {
+            decode(list.data, list.count, values);
+            auto position = std::lower_bound(values.begin(), values.end(), value);
+            if (position == values.end() || *position != value) {
+                return false;
+            }
+            values.erase(position);
+            list.size = encode(values.data(), values.size(), list.data, kInlineSize);
+            list.count--;
+            return true;
+        }
+        BufferFrame* previousPage = nullptr;
+        uint64_t pageId = first_page(list);
+        auto page = &buffer_manager.fix_page(pageId, true);
+        auto overflowPage = reinterpret_cast<OverflowPage*>(page->get_data());
+        while (overflowPage->max_value < value && overflowPage->next != Tree::kInvalidPageId) {
+            if (previousPage) {
+                buffer_manager.unfix_page(*previousPage, false);
+            }
+            previousPage = page;
+            pageId = overflowPage->next;
+            page = &buffer_manager.fix_page(pageId, true);
+            overflowPage = reinterpret_cast<OverflowPage*>(page->get_data());
+        }
+        decode(overflowPage->data, overflowPage->count, values);
+        auto position = std::lower_bound(values.begin(), values.end(), value);
+        bool found = position != values.end() && *position == value;
+        if (found) {
+            values.erase(position);
+            list.count--;
+            if (!values.empty()) {
+                merge_next(*overflowPage, values);
+                buffer_manager.unfix_page(*page, true);
+            } else {
+                /// Unlink the empty page
+                if (previousPage) {
+                    reinterpret_cast<OverflowPage*>(previousPage->get_data())->next = overflowPage->next;
+                } else {
+                    set_first_page(list, overflowPage->next);
+                }
+                tree.free_page(*page, pageId);
+            }
+        } else {
+            buffer_manager.unfix_page(*page, false);
+        }
+        if (previousPage) {
+            buffer_manager.unfix_page(*previousPage, found && values.empty());
+        }
+        if (found && list.count > 0 && list.count <= kInlineSize) {
+            move_inline(list);
+        }
+        return found;
+    }
+
+    /// Writes the remaining values of an overflow page and merges the next
+    /// page of the chain into it if the values of both fit into one page.
+    void merge_next(OverflowPage& overflowPage, std::vector<ValueT>& values) {
+        uint32_t count = values.size();
+        uint64_t nextPageId = overflowPage.next;
+        if (nextPageId != Tree::kInvalidPageId) {
+            auto& nextPage = buffer_manager.fix_page(nextPageId, true);
+            auto nextOverflowPage = reinterpret_cast<OverflowPage*>(nextPage.get_data());
+            decode(nextOverflowPage->data, nextOverflowPage->count, values);
+            if (write_page(overflowPage, values.data(), values.size())) {
+                overflowPage.next = nextOverflowPage->next;
+                tree.free_page(nextPage, nextPageId);
+                return;
+            }
+            buffer_manager.unfix_page(nextPage, false);
+        }
+        [[maybe_unused]] bool fits = write_page(overflowPage, values.data(), count);
+        assert(fits);
+    }
+
+    /// Moves the values of a list with a single overflow page back into the
+    /// leaf entry if they fit.
+    void move_inline(PostingList& list) {
+        uint64_t pageId = first_page(list);
+        auto& page = buffer_manager.fix_page(pageId, true);
+        auto overflowPage = reinterpret_cast<OverflowPage*>(page.get_data());
+        if (overflowPage->next != Tree::kInvalidPageId || overflowPage->size > kInlineSize) {
+            buffer_manager.unfix_page(page, false);
+            return;
+        }
+        std::memcpy(list.data, overflowPage->data, overflowPage->size);
+        list.size = overflowPage->size;
+        list.overflow = 0;
+        tree.free_page(page, pageId);
+    }
+
+    /// Frees all pages of a chain.
+    void free_chain(uint64_t pageId) {
+        while (pageId != Tree::kInvalidPageId) {
+            auto& page = buffer_manager.fix_page(pageId, true);
+            uint64_t next = reinterpret_cast<OverflowPage*>(page.get_data())->next;
+            tree.free_page(page, pageId);
+            pageId = next;
+        }
+    }
+};
+
+}  // namespace buzzdb
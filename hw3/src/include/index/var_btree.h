@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+#include "buffer/buffer_manager.h"
+#include "storage/segment.h"
+
+namespace buzzdb {
+
+/// B+-tree index for variable-length byte string keys, e.g. CHAR16 strings
+/// or order-preserving encodings of composite keys. Keys are compared like
+/// `std::string_view`, i.e. bytewise and unsigned.
+///
+/// Nodes are slotted pages: a header, an array of fixed-size slots that
+/// grows forward and a heap of key bytes and payloads that grows backward
+/// from the end of the page. To raise the fanout
+/// - every node stores a lower and an upper fence key that bound all of its
+///   keys, and their common prefix is stored once instead of in every key,
+/// - separators that move into inner nodes on a leaf split are truncated to
+///   the shortest string that still separates both leaves,
+/// - every slot holds the first four bytes of its key (after the prefix) as
+///   an integer "head", so most comparisons of a search do not touch the
+///   heap.
+///
+/// The first page of the segment is a meta page, the root is always the
+/// second page. Readers couple shared
+/// latches from the root down. Writers do the same and latch only the leaf
+/// exclusively. When the leaf is full, the insert restarts with exclusive
+/// latches and splits full nodes eagerly on the way down. Erased keys free
+/// their space in the leaf, underfull nodes are not merged.
+template<typename ValueT, size_t PageSize>
+struct VarBTree : public Segment {
+    static_assert(std::is_trivially_copyable_v<ValueT>, "values are copied into pages bytewise");
+    static_assert(PageSize <= 65536, "slots address the page with 16 bit offsets");
+
+    struct Slot {
+        /// Offset of the key suffix, followed by the payload.
+        uint16_t offset;
+        /// Length of the key suffix, i.e. the key without the node prefix.
+        uint16_t key_length;
+        /// The first bytes of the key suffix in big-endian order.
+        uint32_t head;
+    };
+
+    struct Node {
+        /// The level in the tree, 0 for leaves.
+        uint16_t level;
+        /// The number of slots.
+        uint16_t count;
+        /// Length of the prefix that all keys of the node share.
+        uint16_t prefix_length;
+        /// Whether the node has an upper fence, the rightmost nodes do not.
+        uint16_t has_upper_fence;
+        uint16_t lower_fence_offset;
+        uint16_t lower_fence_length;
+        uint16_t upper_fence_offset;
+        uint16_t upper_fence_length;
+        /// Start of the heap.
+        uint32_t heap_begin;
+        /// Bytes of the heap that are in use, erased entries leave gaps.
+        uint32_t heap_used;
+        /// Inner nodes: the child for keys greater than all separators.
+        /// Leaves: the next leaf, `kInvalidPageId` for the last one.
+        uint64_t upper;
+
+        Slot* slots() { return reinterpret_cast<Slot*>(this + 1); }
+
+        char* page() { return reinterpret_cast<char*>(this); }
+
+        bool is_leaf() const { return level == 0; }
+
+        std::string_view lower_fence() { return {page() + lower_fence_offset, lower_fence_length}; }
+
+        std::optional<std::string_view> upper_fence() {
+            if (!has_upper_fence) {
+                return std::nullopt;
+            }
+            return std::string_view(page() + upper_fence_offset, upper_fence_length);
+        }
+
+        std::string_view prefix() { return lower_fence().substr(0, prefix_length); }
+
+        std::string_view key_suffix(uint32_t index) {
+            return {page() + slots()[index].offset, slots()[index].key_length};
+        }
+
+        char* payload(uint32_t index) { return page() + slots()[index].offset + slots()[index].key_length; }
+
+        uint64_t child(uint32_t index) {
+            if (index == count) {
+                return upper;
+            }
+            uint64_t child;
+            std::memcpy(&child, payload(index), sizeof(child));
+            return child;
+        }
+
+        void set_child(uint32_t index, uint64_t child) {
+            if (index == count) {
+                upper = child;
+            } else {
+                std::memcpy(payload(index), &child, sizeof(child));
+            }
+        }
+
+        ValueT value(uint32_t index) {
+            ValueT value;
+            std::memcpy(&value, payload(index), sizeof(value));
+            return value;
+        }
+
+        /// Copies the full key of an entry into `buffer`.
+        std::string_view full_key(uint32_t index, char* buffer) {
+            std::memcpy(buffer, page() + lower_fence_offset, prefix_length);
+            auto suffix = key_suffix(index);
+            std::memcpy(buffer + prefix_length, suffix.data(), suffix.size());
+            return {buffer, prefix_length + suffix.size()};
+        }
+
+        /// Free bytes between the slots and the heap.
+        uint32_t free_space() { return heap_begin - sizeof(Node) - count * sizeof(Slot); }
+
+        /// Free bytes after the erased entries were removed from the heap.
+        uint32_t free_space_after_compaction() { return PageSize - sizeof(Node) - count * sizeof(Slot) - heap_used; }
+
+        /// Initializes an empty node with the given fences.
+        void init(uint16_t new_level, std::string_view lower, std::optional<std::string_view> upper_fence_key) {
+            level = new_level;
+            count = 0;
+            heap_begin = PageSize;
+            heap_used = 0;
+            upper = kInvalidPageId;
+            lower_fence_offset = store(lower);
+            lower_fence_length = lower.size();
+            has_upper_fence = upper_fence_key.has_value();
+            upper_fence_length = upper_fence_key ? upper_fence_key->size() : 0;
+            upper_fence_offset = upper_fence_key ? store(*upper_fence_key) : 0;
+            /// Keys between the fences share the fences' common prefix. The
+            /// rightmost nodes have no upper bound and therefore no prefix.
+            prefix_length = upper_fence_key ? common_prefix(lower, *upper_fence_key) : 0;
+        }
+
+        /// Returns the index of the first key that is not less than `key`
+        /// and whether it is equal to `key`.
+        std::pair<uint32_t, bool> lower_bound(std::string_view key) {
+            auto nodePrefix = prefix();
+            if (key.compare(0, nodePrefix.size(), nodePrefix) != 0) {
+                /// Only happens for keys outside of the fences
+                return {key < nodePrefix ? 0 : count, false};
+            }
+            key.remove_prefix(nodePrefix.size());
+            uint32_t keyHead = head(key);
+            uint32_t first = 0;
+            uint32_t n = count;
+            while (n > 0) {
+                uint32_t half = n / 2;
+                int cmp = compare(first + half, key, keyHead);
+                if (cmp < 0) {
+                    first += half + 1;
+                    n -= half + 1;
+                } else if (cmp > 0) {
+                    n = half;
+                } else {
+                    return {first + half, true};
+                }
+            }
+            return {first, false};
+        }
+
+        /// Compares the key of slot `index` with a key suffix.
+        int compare(uint32_t index, std::string_view key, uint32_t keyHead) {
+            auto& slot = slots()[index];
+            if (slot.head != keyHead) {
+                return slot.head < keyHead ? -1 : 1;
+            }
+            /// Heads are equal, so is the start of both keys. The full
+            /// comparison decides keys that are shorter than a head.
+            return key_suffix(index).compare(key);
+        }
+
+        /// Whether an entry with the key and a payload of `payload_size`
+        /// fits, possibly after compaction.
+        bool has_space_for(std::string_view key, size_t payload_size) {
+            return free_space_after_compaction() >= sizeof(Slot) + key.size() - prefix_length + payload_size;
+        }
+
+        /// Inserts an entry at `index`. The entry must fit.
+        void insert_at(uint32_t index, std::string_view key, const void* payload, size_t payload_size) {
+            key.remove_prefix(prefix_length);
+            size_t entrySize = key.size() + payload_size;
+            if (free_space() < sizeof(Slot) + entrySize) {
+                compact();
+            }
+            std::memmove(&slots()[index + 1], &slots()[index], sizeof(Slot) * (count - index));
+            heap_begin -= entrySize;
+            heap_used += entrySize;
+            std::memcpy(page() + heap_begin, key.data(), key.size());
+            std::memcpy(page() + heap_begin + key.size(), payload, payload_size);
+            slots()[index] = {static_cast<uint16_t>(heap_begin), static_cast<uint16_t>(key.size()), head(key)};
+            count++;
+        }
+
+        /// Removes the entry at `index`.
+        void remove_at(uint32_t index, size_t payload_size) {
+            heap_used -= slots()[index].key_length + payload_size;
+            std::memmove(&slots()[index], &slots()[index + 1], sizeof(Slot) * (count - index - 1));
+            count--;
+        }
+
+        /// Rewrites the heap without the gaps left by erased entries.
+        void compact() {
+            alignas(Node) char buffer[PageSize];
+            auto copy = reinterpret_cast<Node*>(buffer);
+            std::memcpy(buffer, page(), PageSize);
+            heap_begin = PageSize;
+            heap_used = 0;
+            lower_fence_offset = store(copy->lower_fence());
+            if (has_upper_fence) {
+                upper_fence_offset = store(*copy->upper_fence());
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t size = entry_size(copy, i);
+                heap_begin -= size;
+                heap_used += size;
+                std::memcpy(page() + heap_begin, copy->page() + copy->slots()[i].offset, size);
+                slots()[i].offset = heap_begin;
+            }
+        }
+
+        private:
+        /// Size of the key suffix and the payload of an entry.
+        uint32_t entry_size(Node* node, uint32_t index) {
+            return node->slots()[index].key_length + (node->is_leaf() ? sizeof(ValueT) : sizeof(uint64_t));
+        }
+
+        /// Copies bytes to the heap and returns their offset.
+        uint16_t store(std::string_view bytes) {
+            if (bytes.empty()) {
+                return heap_begin;
+            }
+            heap_begin -= bytes.size();
+            heap_used += bytes.size();
+            std::memcpy(page() + heap_begin, bytes.data(), bytes.size());
+            return heap_begin;
+        }
+    };
+
+    /// Marks the absence of a page.
+    static constexpr uint64_t kInvalidPageId = BufferManager::kInvalidPageId;
+
+    /// The longest key that can be inserted. Nodes hold at least four
+    /// entries plus their fences.
+    static constexpr size_t kMaxKeySize = (PageSize - sizeof(Node)) / 8;
+
+    /// The first page of the segment. It describes the tree, so that the
+    /// tree can be opened again from its segment.
+    struct MetaPage {
+        /// `kMetaMagic` once the page was written.
+        uint64_t magic;
+        /// The layout of the tree, checked when the tree is opened.
+        uint32_t page_size;
+        uint32_t value_size;
+        /// The next page number that was never used.
+        uint64_t next_page_id;
+    };
+
+    /// Identifies the meta page of a `VarBTree`.
+    static constexpr uint64_t kMetaMagic = 0x45455254565a5542;  // "BUZVTREE"
+
+    /// Next page id within the segment. Page 0 is the meta page, page 1 the
+    /// root.
+    std::atomic<uint64_t> next_page_id{2};
+
+    /// Constructor. Opens the tree that is stored on the segment, or
+    /// initializes an empty tree if the segment holds none. Throws
+    /// `std::invalid_argument` if the segment holds a tree with another
+    /// value type or page size.
+    VarBTree(uint16_t segment_id, BufferManager &buffer_manager)
+        : Segment(segment_id, buffer_manager) {
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), false);
+        MetaPage meta;
+        std::memcpy(&meta, metaPage.get_data(), sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, false);
+        if (meta.magic == kMetaMagic) {
+            if (meta.page_size != PageSize || meta.value_size != sizeof(ValueT)) {
+                throw std::invalid_argument("segment holds a B+-tree with a different layout");
+            }
+            next_page_id.store(meta.next_page_id);
+            return;
+        }
+        auto& rootPage = this->buffer_manager.fix_page(root_page_id(), true);
+        reinterpret_cast<Node*>(rootPage.get_data())->init(0, {}, std::nullopt);
+        this->buffer_manager.unfix_page(rootPage, true);
+        write_meta();
+    }
+
+    /// Destructor. Writes the meta page, the buffer manager writes it back.
+    ~VarBTree() {
+        write_meta();
+    }
+
+    /// Lookup an entry in the tree.
+    /// @param[in] key      The key that should be searched.
+    std::optional<ValueT> lookup(std::string_view key) {
+        auto page = &fix_leaf(key, false);
+        auto node = reinterpret_cast<Node*>(page->get_data());
+        std::optional<ValueT> value;
+        auto [index, found] = node->lower_bound(key);
+        if (found) {
+            value = node->value(index);
+        }
+        this->buffer_manager.unfix_page(*page, false);
+        return value;
+    }
+
+    /// Inserts a new entry into the tree or replaces the value of an
+    /// existing one. Throws `std::invalid_argument` for keys that are longer
+    /// than `kMaxKeySize`.
+    /// @param[in] key      The key that should be inserted.
+    /// @param[in] value    The value that should be inserted.
+    void insert(std::string_view key, const ValueT &value) {
+        if (key.size() > kMaxKeySize) {
+            throw std::invalid_argument("key is too long");
+        }
+        while (true) {
+            auto& page = fix_leaf(key, true);
+            auto node = reinterpret_cast<Node*>(page.get_data());
+            auto [index, found] = node->lower_bound(key);
+            if (found) {
+                std::memcpy(node->payload(index), &value, sizeof(value));
+                this->buffer_manager.unfix_page(page, true);
+                return;
+            }
+            if (node->has_space_for(key, sizeof(ValueT))) {
+                node->insert_at(index, key, &value, sizeof(value));
+                this->buffer_manager.unfix_page(page, true);
+                return;
+            }
+            this->buffer_manager.unfix_page(page, false);
+            split_path(key);
+        }
+    }
+
+    /// Erase an entry in the tree.
+    /// @param[in] key      The key that should be erased.
+    /// @return whether the key was found.
+    bool erase(std::string_view key) {
+        auto& page = fix_leaf(key, true);
+        auto node = reinterpret_cast<Node*>(page.get_data());
+        auto [index, found] = node->lower_bound(key);
+        if (found) {
+            node->remove_at(index, sizeof(ValueT));
+        }
+        this->buffer_manager.unfix_page(page, found);
+        return found;
+    }
+
+    /// Calls `callback` with every entry whose key is in [from, to], in key
+    /// order, until the callback returns false. Leaves are visited from left
+    /// to right with latch coupling.
+    void scan(std::string_view from, std::string_view to,
+              const std::function<bool(std::string_view, const ValueT&)> &callback) {
+        auto keyBuffer = std::make_unique<char[]>(kMaxKeySize);
+        auto page = &fix_leaf(from, false);
+        auto node = reinterpret_cast<Node*>(page->get_data());
+        uint32_t index = node->lower_bound(from).first;
+        while (true) {
+            for (; index < node->count; index++) {
+                auto key = node->full_key(index, keyBuffer.get());
+                if (key > to || !callback(key, node->value(index))) {
+                    this->buffer_manager.unfix_page(*page, false);
+                    return;
+                }
+            }
+            if (node->upper == kInvalidPageId) {
+                this->buffer_manager.unfix_page(*page, false);
+                return;
+            }
+            auto& nextPage = this->buffer_manager.fix_page(segment_page(node->upper), false);
+            this->buffer_manager.unfix_page(*page, false);
+            page = &nextPage;
+            node = reinterpret_cast<Node*>(page->get_data());
+            index = 0;
+        }
+    }
+
+    /// Returns the number of levels of the tree.
+    uint16_t get_height() {
+        auto& rootPage = this->buffer_manager.fix_page(root_page_id(), false);
+        uint16_t height = reinterpret_cast<Node*>(rootPage.get_data())->level + 1;
+        this->buffer_manager.unfix_page(rootPage, false);
+        return height;
+    }
+
+    private:
+    /// Returns the buffer manager page id of a page of the segment.
+    uint64_t segment_page(uint64_t pageId) const {
+        return (static_cast<uint64_t>(this->segment_id) << 48) | pageId;
+    }
+
+    uint64_t meta_page_id() const { return segment_page(0); }
+
+    uint64_t root_page_id() const { return segment_page(1); }
+
+    /// Writes the meta page.
+    void write_meta() {
+        MetaPage meta;
+        std::memset(&meta, 0, sizeof(meta));
+        meta.magic = kMetaMagic;
+        meta.page_size = PageSize;
+        meta.value_size = sizeof(ValueT);
+        meta.next_page_id = next_page_id.load();
+        auto& metaPage = this->buffer_manager.fix_page(meta_page_id(), true);
+        std::memcpy(metaPage.get_data(), &meta, sizeof(meta));
+        this->buffer_manager.unfix_page(metaPage, true);
+    }
+
+    /// Descends to the leaf for `key` with shared latch coupling and latches
+    /// the leaf shared or exclusively.
+    BufferFrame& fix_leaf(std::string_view key, bool exclusive) {
+        while (true) {
+            /// The root is the only node that can change from a leaf to an
+            /// inner node, its level is checked again under the right latch.
+            auto page = &this->buffer_manager.fix_page(root_page_id(), false);
+            auto node = reinterpret_cast<Node*>(page->get_data());
+            if (node->is_leaf()) {
+                if (!exclusive) {
+                    return *page;
+                }
+                this->buffer_manager.unfix_page(*page, false);
+                page = &this->buffer_manager.fix_page(root_page_id(), true);
+                node = reinterpret_cast<Node*>(page->get_data());
+                if (node->is_leaf()) {
+                    return *page;
+                }
+                this->buffer_manager.unfix_page(*page, false);
+                continue;
+            }
+            while (true) {
+                auto childPageId = node->child(node->lower_bound(key).first);
+                bool childIsLeaf = node->level == 1;
+                auto& childPage = this->buffer_manager.fix_page(segment_page(childPageId), exclusive && childIsLeaf);
+                this->buffer_manager.unfix_page(*page, false);
+                page = &childPage;
+                node = reinterpret_cast<Node*>(page->get_data());
+                if (childIsLeaf) {
+                    return *page;
+                }
+            }
+        }
+    }
+
+    /// The space an entry needs in the worst case.
+    static constexpr size_t kMaxEntrySize = sizeof(Slot) + kMaxKeySize + std::max(sizeof(ValueT), sizeof(uint64_t));
+
+    /// Descends to the leaf for `key` with exclusive latch coupling and
+    /// splits every node on the way that may not have room for another
+    /// entry, so that the parent of a split node always has room for the
+    /// separator.
+    void split_path(std::string_view key) {
+        auto page = &this->buffer_manager.fix_page(root_page_id(), true);
+        auto node = reinterpret_cast<Node*>(page->get_data());
+        if (node->free_space_after_compaction() < kMaxEntrySize) {
+            split_root(*node);
+        }
+        while (!node->is_leaf()) {
+            uint32_t index = node->lower_bound(key).first;
+            uint64_t childPageId = node->child(index);
+            auto& childPage = this->buffer_manager.fix_page(segment_page(childPageId), true);
+            auto child = reinterpret_cast<Node*>(childPage.get_data());
+            bool modified = false;
+            if (child->free_space_after_compaction() < kMaxEntrySize) {
+                split(*child, childPageId, *node, index);
+                modified = true;
+            }
+            this->buffer_manager.unfix_page(*page, modified);
+            /// After a split the key may belong to the new right node, which
+            /// is found again from the parent on the next restart.
+            if (modified) {
+                this->buffer_manager.unfix_page(childPage, true);
+                return;
+            }
+            page = &childPage;
+            node = child;
+        }
+        this->buffer_manager.unfix_page(*page, true);
+    }
+
+    /// Returns the length of the common prefix of two strings.
+    static uint16_t common_prefix(std::string_view a, std::string_view b) {
+        uint16_t length = 0;
+        while (length < a.size() && length < b.size() && a[length] == b[length]) {
+            length++;
+        }
+        return length;
+    }
+
+    /// Returns the first four bytes of a key suffix in big-endian order,
+    /// padded with zero bytes.
+    static uint32_t head(std::string_view key) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; i++) {
+            value <<= 8;
+            if (i < key.size()) {
+                value |= static_cast<uint8_t>(key[i]);
+            }
+        }
+        return value;
+    }
+
+    /// Returns the shortest separator `s` with `left <= s < right`.
+    static std::string_view shortest_separator(std::string_view left, std::string_view right) {
+        uint16_t length = common_prefix(left, right);
+        /// A prefix of `right` that is one byte longer than the common
+        /// prefix is greater than `left`, but only less than `right` if it is
+        /// a proper prefix.
+        if (length + 1u < right.size()) {
+            return right.substr(0, length + 1);
+        }
+        return left;
+    }
+
+    /// Copies the entries [from, to) of `source` into the empty node `target`.
+    static void copy_entries(Node& source, uint32_t from, uint32_t to, Node& target, char* keyBuffer) {
+        size_t payloadSize = source.is_leaf() ? sizeof(ValueT) : sizeof(uint64_t);
+        for (uint32_t i = from; i < to; i++) {
+            auto key = source.full_key(i, keyBuffer);
+            target.insert_at(target.count, key, source.payload(i), payloadSize);
+        }
+    }
+
+    /// Splits the node into a left half that is built in a scratch buffer
+    /// and copied back, and a right half on a new page. Returns the
+    /// separator in `separatorBuffer`.
+    std::string_view split_node(Node& node, uint64_t& rightPageId, BufferFrame*& rightPage, std::byte* leftBuffer,
+                                char* separatorBuffer, char* keyBuffer) {
+        uint32_t middle = node.count / 2;
+        std::string_view separator;
+        if (node.is_leaf()) {
+            /// Left keeps [0, middle], the separator lies between the two
+            /// halves and is as short as possible. It is either `left` or a
+            /// prefix of `right`.
+            auto left = node.full_key(middle, separatorBuffer);
+            auto right = node.full_key(middle + 1, keyBuffer);
+            auto shortest = shortest_separator(left, right);
+            std::memmove(separatorBuffer, shortest.data(), shortest.size());
+            separator = {separatorBuffer, shortest.size()};
+        } else {
+            /// The separator at `middle` moves up, its child becomes the
+            /// upper child of the left half.
+            separator = node.full_key(middle, separatorBuffer);
+        }
+        rightPageId = next_page_id.fetch_add(1);
+        rightPage = &this->buffer_manager.fix_page(segment_page(rightPageId), true);
+        auto rightNode = reinterpret_cast<Node*>(rightPage->get_data());
+        auto leftNode = reinterpret_cast<Node*>(leftBuffer);
+        leftNode->init(node.level, node.lower_fence(), separator);
+        rightNode->init(node.level, separator, node.upper_fence());
+        if (node.is_leaf()) {
+            copy_entries(node, 0, middle + 1, *leftNode, keyBuffer);
+            copy_entries(node, middle + 1, node.count, *rightNode, keyBuffer);
+            rightNode->upper = node.upper;
+            leftNode->upper = rightPageId;
+        } else {
+            copy_entries(node, 0, middle, *leftNode, keyBuffer);
+            copy_entries(node, middle + 1, node.count, *rightNode, keyBuffer);
+            leftNode->upper = node.child(middle);
+            rightNode->upper = node.upper;
+        }
+        return separator;
+    }
+
+    /// Splits the exclusively latched, non-root node that is the child at
+    /// `index` of the exclusively latched `parent`.
+    void split(Node& node, uint64_t pageId, Node& parent, uint32_t index) {
+        alignas(Node) std::byte leftBuffer[PageSize];
+        char separatorBuffer[kMaxKeySize];
+        char keyBuffer[kMaxKeySize];
+        uint64_t rightPageId;
+        BufferFrame* rightPage;
+        auto separator = split_node(node, rightPageId, rightPage, leftBuffer, separatorBuffer, keyBuffer);
+        std::memcpy(&node, leftBuffer, PageSize);
+        /// The parent entry of the node now points to the right half, the
+        /// separator in front of it to the left half.
+        parent.set_child(index, rightPageId);
+        parent.insert_at(index, separator, &pageId, sizeof(pageId));
+        this->buffer_manager.unfix_page(*rightPage, true);
+    }
+
+    /// Splits the exclusively latched root. The root stays on its page and
+    /// becomes the parent of two new nodes.
+    void split_root(Node& root) {
+        alignas(Node) std::byte leftBuffer[PageSize];
+        char separatorBuffer[kMaxKeySize];
+        char keyBuffer[kMaxKeySize];
+        uint64_t rightPageId;
+        BufferFrame* rightPage;
+        auto separator = split_node(root, rightPageId, rightPage, leftBuffer, separatorBuffer, keyBuffer);
+        uint64_t leftPageId = next_page_id.fetch_add(1);
+        auto& leftPage = this->buffer_manager.fix_page(segment_page(leftPageId), true);
+        std::memcpy(leftPage.get_data(), leftBuffer, PageSize);
+        this->buffer_manager.unfix_page(leftPage, true);
+        this->buffer_manager.unfix_page(*rightPage, true);
+        uint16_t level = root.level + 1;
+        root.init(level, {}, std::nullopt);
+        root.insert_at(0, separator, &leftPageId, sizeof(leftPageId));
+        root.upper = rightPageId;
+    }
+};
+
+}  // namespace buzzdb
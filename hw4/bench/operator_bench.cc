@@ -0,0 +1,231 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/options.h"
+#include "operators/operators.h"
+
+/// Throughput of `Select`, `Projection`, `HashJoin` and `HashAggregation`
+/// in tuple-at-a-time execution with `next()` and in vectorized execution
+/// with `next_batch()`. Both runs of a query must produce the same result,
+/// the benchmark fails otherwise.
+///
+/// Usage: operator_bench [--option=value ...]
+///   --tuples=N           tuples of the input table (default 4000000)
+///   --keys=N             distinct join and group keys (default 1000)
+///   --selectivity=X      fraction of tuples that pass the select (default 0.1)
+///   --seed=N             seed of the random number generator (default 42)
+///
+/// The table has the attributes (key INT64, value INT64, name CHAR16). The
+/// join builds over a table with one tuple (key, payload) per key.
+
+namespace {
+
+using buzzdb::operators::Batch;
+using buzzdb::operators::Char16;
+using buzzdb::operators::Operator;
+using buzzdb::operators::Register;
+
+struct Options {
+    size_t tuples = 4000000;
+    size_t keys = 1000;
+    double selectivity = 0.1;
+    uint64_t seed = 42;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    buzzdb::bench::OptionParser parser;
+    parser.add("tuples", options.tuples);
+    parser.add("keys", options.keys);
+    parser.add("selectivity", options.selectivity);
+    parser.add("seed", options.seed);
+    parser.parse(argc, argv);
+    parser.require(options.tuples > 0 && options.keys > 0, "tuples and keys must be positive");
+    parser.require(options.selectivity >= 0.0 && options.selectivity <= 1.0, "selectivity must be in [0, 1]");
+    return options;
+}
+
+/// An in-memory table in columnar form that produces its tuples with both
+/// `next()` and `next_batch()`.
+class Table : public Operator {
+    public:
+    explicit Table(std::vector<Batch::Column> columns) : columns(std::move(columns)) {}
+
+    void open() override {
+        position = 0;
+        regs.resize(columns.size());
+    }
+
+    bool next() override {
+        if (position == size()) {
+            return false;
+        }
+        for (size_t i = 0; i < columns.size(); i++) {
+            regs[i] = columns[i].get(position);
+        }
+        position++;
+        return true;
+    }
+
+    bool next_batch(Batch& batch) override {
+        size_t count = std::min(Batch::kCapacity, size() - position);
+        batch.columns.resize(columns.size());
+        for (size_t i = 0; i < columns.size(); i++) {
+            auto& column = batch.columns[i];
+            column.reset(columns[i].type);
+            if (column.type == Register::Type::INT64) {
+                column.ints.assign(columns[i].ints.begin() + position, columns[i].ints.begin() + position + count);
+            } else {
+                column.strings.assign(columns[i].strings.begin() + position,
+                                      columns[i].strings.begin() + position + count);
+            }
+        }
+        batch.size = count;
+        position += count;
+        return count != 0;
+    }
+
+    void close() override {}
+
+    std::vector<Register*> get_output() override {
+        std::vector<Register*> output;
+        for (auto& reg : regs) {
+            output.push_back(&reg);
+        }
+        return output;
+    }
+
+    private:
+    size_t size() const {
+        return columns[0].type == Register::Type::INT64 ? columns[0].ints.size() : columns[0].strings.size();
+    }
+
+    std::vector<Batch::Column> columns;
+    std::vector<Register> regs;
+    size_t position = 0;
+};
+
+/// The number of result tuples and the sum of their `INT64` attributes.
+struct Result {
+    uint64_t tuples = 0;
+    int64_t checksum = 0;
+
+    bool operator==(const Result& other) const {
+        return tuples == other.tuples && checksum == other.checksum;
+    }
+};
+
+Result run_tuples(Operator& op) {
+    Result result;
+    op.open();
+    auto regs = op.get_output();
+    while (op.next()) {
+        result.tuples++;
+        for (auto* reg : regs) {
+            if (reg->get_type() == Register::Type::INT64) {
+                result.checksum += reg->as_int();
+            }
+        }
+    }
+    op.close();
+    return result;
+}
+
+Result run_batches(Operator& op) {
+    Result result;
+    Batch batch;
+    op.open();
+    while (op.next_batch(batch)) {
+        result.tuples += batch.size;
+        for (auto& column : batch.columns) {
+            if (column.type == Register::Type::INT64) {
+                for (auto value : column.ints) {
+                    result.checksum += value;
+                }
+            }
+        }
+    }
+    op.close();
+    return result;
+}
+
+/// Runs the query in both execution modes and prints their throughput in
+/// input tuples per second.
+void measure(const char* name, size_t input_tuples, const std::function<void(const std::function<Result(Operator&)>&)>& query) {
+    double seconds[2];
+    Result results[2];
+    for (int mode = 0; mode < 2; mode++) {
+        auto begin = std::chrono::steady_clock::now();
+        query([&](Operator& op) {
+            results[mode] = mode == 0 ? run_tuples(op) : run_batches(op);
+            return results[mode];
+        });
+        seconds[mode] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    if (!(results[0] == results[1])) {
+        std::cerr << name << ": the execution modes produce different results" << std::endl;
+        std::exit(1);
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << name << ": result_tuples=" << results[0].tuples
+              << " tuple_at_a_time_per_s=" << input_tuples / seconds[0]
+              << " vectorized_per_s=" << input_tuples / seconds[1]
+              << " speedup=" << seconds[0] / seconds[1] << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    using buzzdb::operators::HashAggregation;
+    using buzzdb::operators::HashJoin;
+    using buzzdb::operators::Projection;
+    using buzzdb::operators::Select;
+
+    Options options = parse_options(argc, argv);
+    std::mt19937_64 random(options.seed);
+    std::vector<Batch::Column> columns(3);
+    columns[2].reset(Register::Type::CHAR16);
+    const char* names[] = {"alpha___________", "bravo___________", "charlie_________", "delta___________"};
+    for (size_t i = 0; i < options.tuples; i++) {
+        columns[0].ints.push_back(static_cast<int64_t>(random() % options.keys));
+        columns[1].ints.push_back(static_cast<int64_t>(random() % 1000000));
+        columns[2].strings.push_back(Char16::from_string(names[random() % 4]));
+    }
+    std::vector<Batch::Column> dimension(2);
+    for (size_t key = 0; key < options.keys; key++) {
+        dimension[0].ints.push_back(static_cast<int64_t>(key));
+        dimension[1].ints.push_back(static_cast<int64_t>(key * 7));
+    }
+    Table table(columns);
+    Table dimension_table(dimension);
+    std::cout << "tuples=" << options.tuples << " keys=" << options.keys
+              << " selectivity=" << options.selectivity << "\n";
+
+    auto threshold = static_cast<int64_t>(options.selectivity * 1000000);
+    measure("select", options.tuples, [&](const auto& run) {
+        Select select(table, Select::PredicateAttributeInt64{1, threshold, Select::PredicateType::LT});
+        run(select);
+    });
+    measure("projection", options.tuples, [&](const auto& run) {
+        Projection projection(table, {2, 0});
+        run(projection);
+    });
+    measure("hash_join", options.tuples, [&](const auto& run) {
+        HashJoin join(dimension_table, table, 0, 0);
+        run(join);
+    });
+    measure("hash_aggregation", options.tuples, [&](const auto& run) {
+        HashAggregation aggregation(table, {0}, {{HashAggregation::AggrFunc::SUM, 1},
+                                                 {HashAggregation::AggrFunc::COUNT, 0},
+                                                 {HashAggregation::AggrFunc::MIN, 1}});
+        run(aggregation);
+    });
+    return 0;
+}
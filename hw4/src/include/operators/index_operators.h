@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "index/btree.h"
+#include "operators/operators.h"
+
+namespace buzzdb {
+namespace operators {
+
+/// The key and value types of an index.
+template<typename TreeT>
+struct IndexTraits;
+
+template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize, typename InnerLayoutT,
+         typename LeafLayoutT>
+struct IndexTraits<BTree<KeyT, ValueT, ComparatorT, PageSize, InnerLayoutT, LeafLayoutT>> {
+    using Key = KeyT;
+    using Value = ValueT;
+
+    static_assert(std::is_integral_v<KeyT> && std::is_integral_v<ValueT>,
+                  "index operators read integer keys and values");
+
+    /// The keys that an `INT64` attribute can hold.
+    static constexpr int64_t kMinKey = static_cast<int64_t>(std::numeric_limits<KeyT>::min());
+    static constexpr int64_t kMaxKey =
+        static_cast<uint64_t>(std::numeric_limits<KeyT>::max()) > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())
+            ? std::numeric_limits<int64_t>::max()
+            : static_cast<int64_t>(std::numeric_limits<KeyT>::max());
+
+    /// Converts an `INT64` attribute to a key.
+    /// @return false if no key has this value.
+    static bool to_key(int64_t value, KeyT& key) {
+        if (value < kMinKey || value > kMaxKey) {
+            return false;
+        }
+        key = static_cast<KeyT>(value);
+        return true;
+    }
+};
+
+/// Reads the entries of a `BTree` whose keys are in a range, in key order.
+/// Each tuple has two `INT64` attributes: the key and the value, e.g. the
+/// row id of a table that is indexed on the key. Keys and values must fit
+/// into an `int64_t`. The range is searched in the tree, so only the
+/// matching entries are read.
+template<typename TreeT>
+class IndexScan : public Operator {
+    private:
+    using Traits = IndexTraits<TreeT>;
+    using KeyT = typename Traits::Key;
+
+    TreeT& tree;
+    /// The range of keys [from, to], empty if `from > to`.
+    int64_t from;
+    int64_t to;
+    std::optional<typename TreeT::Cursor> cursor;
+    KeyT last_key;
+    std::vector<Register> output_regs;
+
+    public:
+    /// Scans the keys in [from, to].
+    IndexScan(TreeT& tree, int64_t from, int64_t to) : tree(tree), from(from), to(to) {}
+
+    /// Scans the keys for which `key P constant` holds, where P is given by
+    /// `predicate_type`. `NE` is no range and must be evaluated by a
+    /// `Select` on a full scan instead, it throws `std::invalid_argument`.
+    IndexScan(TreeT& tree, Select::PredicateType predicate_type, int64_t constant)
+        : tree(tree), from(std::numeric_limits<int64_t>::min()), to(std::numeric_limits<int64_t>::max()) {
+        if (predicate_type == Select::PredicateType::NE) {
+            throw std::invalid_argument("an index scan cannot evaluate NE");
+        }
+        switch (predicate_type) {
+            case Select::PredicateType::EQ:
+                from = to = constant;
+                break;
+            case Select::PredicateType::LT:
+                if (constant == std::numeric_limits<int64_t>::min()) {
+                    from = 0;
+                    to = -1;
+                } else {
+                    to = constant - 1;
+                }
+                break;
+            case Select::PredicateType::LE:
+                to = constant;
+                break;
+            case Select::PredicateType::GT:
+                if (constant == std::numeric_limits<int64_t>::max()) {
+                    from = 0;
+                    to = -1;
+                } else {
+                    from = constant + 1;
+                }
+                break;
+            case Select::PredicateType::GE:
+                from = constant;
+                break;
+            default:
+                __builtin_unreachable();
+        }
+    }
+
+    ~IndexScan() override = default;
+
+    void open() override {
+        output_regs.resize(2);
+        /// Clamp the range to the keys of the tree
+        from = std::max(from, Traits::kMinKey);
+        to = std::min(to, Traits::kMaxKey);
+        if (from <= to) {
+            last_key = static_cast<KeyT>(to);
+            cursor.emplace(tree.lower_bound(static_cast<KeyT>(from)));
+        }
+    }
+
+    bool next() override {
+        if (!cursor || !cursor->valid()) {
+            return false;
+        }
+        KeyT key = cursor->key();
+        if (last_key < key) {
+            return false;
+        }
+        output_regs[0] = Register::from_int(static_cast<int64_t>(key));
+        output_regs[1] = Register::from_int(static_cast<int64_t>(cursor->value()));
+        cursor->next();
+        return true;
+    }
+
+    void close() override {
+        cursor.reset();
+    }
+
+    std::vector<Register*> get_output() override {
+        std::vector<Register*> output;
+        for (auto& reg : output_regs) {
+            output.push_back(&reg);
+        }
+        return output;
+    }
+};
+
+/// Computes the inner equi-join of the input with the entries of a `BTree`:
+/// the `INT64` attribute `attr_index` of every input tuple is looked up as
+/// key. Unlike `HashJoin`, nothing is built, so a selective join reads only
+/// the entries it needs. The output tuples are the input tuple followed by
+/// the key and the value of the entry, as produced by `IndexScan`.
+/// The input is read in batches that are looked up with
+/// `BTree::lookup_batch()`, so probes that fall into the same leaves share
+/// their descents.
+template<typename TreeT>
+class IndexNestedLoopJoin : public UnaryOperator {
+    private:
+    using Traits = IndexTraits<TreeT>;
+    using KeyT = typename Traits::Key;
+    using ValueT = typename Traits::Value;
+
+    /// The number of input tuples that are looked up together.
+    static constexpr size_t kBatchSize = 1024;
+
+    TreeT& tree;
+    const size_t attr_index;
+    std::vector<Register*> input_regs;
+    /// The input tuples of the current batch that can have a match, their
+    /// keys and the lookup results.
+    std::vector<std::vector<Register>> batch;
+    size_t batch_size = 0;
+    std::vector<KeyT> keys;
+    std::vector<std::optional<ValueT>> matches;
+    size_t next_in_batch = 0;
+    std::vector<Register> output_regs;
+
+    /// Reads the next batch from the input and looks it up.
+    /// @return false if the input is exhausted.
+    bool read_batch() {
+        batch_size = 0;
+        next_in_batch = 0;
+        keys.clear();
+        while (batch_size < kBatchSize && input->next()) {
+            KeyT key;
+            /// Tuples whose attribute is no key of the tree have no match
+            if (!Traits::to_key(input_regs[attr_index]->as_int(), key)) {
+                continue;
+            }
+            if (batch.size() == batch_size) {
+                batch.emplace_back(input_regs.size());
+            }
+            for (size_t i = 0; i < input_regs.size(); i++) {
+                batch[batch_size][i] = *input_regs[i];
+            }
+            batch_size++;
+            keys.push_back(key);
+        }
+        if (batch_size == 0) {
+            return false;
+        }
+        matches = tree.lookup_batch(keys);
+        return true;
+    }
+
+    public:
+    IndexNestedLoopJoin(Operator& input, TreeT& tree, size_t attr_index)
+        : UnaryOperator(input), tree(tree), attr_index(attr_index) {}
+
+    ~IndexNestedLoopJoin() override = default;
+
+    void open() override {
+        input->open();
+        input_regs = input->get_output();
+        output_regs.resize(input_regs.size() + 2);
+        keys.reserve(kBatchSize);
+    }
+
+    bool next() override {
+        while (true) {
+            for (; next_in_batch < batch_size; next_in_batch++) {
+                if (!matches[next_in_batch]) {
+                    continue;
+                }
+                auto& tuple = batch[next_in_batch];
+                for (size_t i = 0; i < tuple.size(); i++) {
+                    output_regs[i] = tuple[i];
+                }
+                output_regs[tuple.size()] = Register::from_int(static_cast<int64_t>(keys[next_in_batch]));
+                output_regs[tuple.size() + 1] = Register::from_int(static_cast<int64_t>(*matches[next_in_batch]));
+                next_in_batch++;
+                return true;
+            }
+            if (!read_batch()) {
+                return false;
+            }
+        }
+    }
+
+    void close() override {
+        input->close();
+        batch.clear();
+        batch_size = 0;
+        next_in_batch = 0;
+        keys.clear();
+        matches.clear();
+    }
+
+    std::vector<Register*> get_output() override {
+        std::vector<Register*> output;
+        for (auto& reg : output_regs) {
+            output.push_back(&reg);
+        }
+        return output;
+    }
+};
+
+}  // namespace operators
+}  // namespace buzzdb
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <cassert>
 #include <ostream>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <limits>
 #include <unordered_map>
@@ -17,15 +20,60 @@
 namespace buzzdb {
 namespace operators {
 
+/// A `CHAR16` value: the characters of the string, padded with zeros. Two
+/// values are compared byte-wise, which orders them like their strings.
+struct Char16 {
+    char data[16];
+
+    /// Creates a `Char16` from the first 16 characters of `value`.
+    static Char16 from_string(const std::string& value) {
+        Char16 result;
+        std::memset(result.data, 0, sizeof(result.data));
+        std::memcpy(result.data, value.data(), std::min(value.size(), sizeof(result.data)));
+        return result;
+    }
+
+    /// Returns the string without the padding.
+    std::string to_string() const {
+        return std::string(data, strnlen(data, sizeof(data)));
+    }
+
+    friend bool operator==(const Char16& c1, const Char16& c2) {
+        return std::memcmp(c1.data, c2.data, sizeof(c1.data)) == 0;
+    }
+    friend bool operator<(const Char16& c1, const Char16& c2) {
+        return std::memcmp(c1.data, c2.data, sizeof(c1.data)) < 0;
+    }
+};
+
+/// This can be used to store `Char16` values in an `std::unordered_map` or
+/// `std::unordered_set`.
+struct Char16Hasher {
+    uint64_t operator()(const Char16& c) const {
+        uint64_t words[2];
+        std::memcpy(words, c.data, sizeof(words));
+        return std::hash<uint64_t>{}(words[0] * 0x9e3779b97f4a7c15ull ^ words[1]);
+    }
+};
+
+/// A value of a tuple, either an `INT64` or a `CHAR16`. The value is stored
+/// inline, so registers never allocate and tuples of registers can be copied
+/// with `memcpy`.
 class Register {
-private:
-    std::variant<int64_t, std::string> value;
     public:
-    enum class Type {
+    enum class Type : uint8_t {
         INT64,
         CHAR16
     };
 
+    private:
+    /// The `int64_t` in its first 8 bytes or the `Char16`. Unused bytes are
+    /// zero, so that registers of the same type can be compared and hashed
+    /// by their bytes.
+    alignas(int64_t) Char16 value{};
+    Type type = Type::INT64;
+
+    public:
     Register() = default;
     Register(const Register&) = default;
     Register(Register&&) = default;
@@ -36,11 +84,14 @@ private:
     /// Creates a `Register` from a given `int64_t`.
     static Register from_int(int64_t value);
 
-    /// Creates a `Register` from a given `std::string`. The register must only
-    /// be able to hold fixed size strings of size 16, so `value` must be at
-    /// least 16 characters long.
+    /// Creates a `Register` from a given `std::string`. The register only
+    /// holds fixed size strings of size 16, longer strings are cut off and
+    /// shorter ones are padded with zeros.
     static Register from_string(const std::string& value);
 
+    /// Creates a `Register` from a given `Char16`.
+    static Register from_char16(const Char16& value);
+
     /// Returns the type of the register.
     Type get_type() const;
 
@@ -48,10 +99,15 @@ private:
     /// this register really is an integer.
     int64_t as_int() const;
 
-    /// Returns the `std::string` value for this register. Must only be called
-    /// when this register really is a string.
+    /// Returns the `std::string` value for this register, without the
+    /// padding. Must only be called when this register really is a string.
     std::string as_string() const;
 
+    /// Returns the `Char16` value for this register. Unlike `as_string()`,
+    /// this does not allocate. Must only be called when this register really
+    /// is a string.
+    const Char16& as_char16() const;
+
     /// Returns the hash value for this register.
     uint64_t get_hash() const;
 
@@ -78,6 +134,8 @@ private:
     friend bool operator>=(const Register& r1, const Register& r2);
 };
 
+static_assert(std::is_trivially_copyable_v<Register>, "tuples are copied with memcpy");
+static_assert(sizeof(Register) == 24, "a register is 16 bytes of value and a type tag");
 
 /// This can be used to store registers in an `std::unordered_map` or
 /// `std::unordered_set`. Examples:
@@ -93,15 +151,149 @@ struct RegisterHasher {
 /// This can be used to store vectors of registers (which is how tuples are
 /// represented) in an `std::unordered_map` or `std::unordered_set`. Examples:
 ///
+/// std::unordered_map<std::vector<Register>, int, RegisterVectorHasher> map_from_tuple_to_int;
+/// std::unordered_set<std::vector<Register>, RegisterVectorHasher> set_of_tuples;
 struct RegisterVectorHasher {
     uint64_t operator()(const std::vector<Register>& registers) const {
-    std::string hash_values;
-    for (auto& reg : registers) {
-      uint64_t hash = reg.get_hash();
-      hash_values.append(reinterpret_cast<char*>(&hash), sizeof(hash));
+        /// Combines the hashes like `boost::hash_combine`, so that the order
+        /// of the registers matters
+        uint64_t hash = registers.size();
+        for (auto& reg : registers) {
+            hash ^= reg.get_hash() + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+        }
+        return hash;
     }
-    return std::hash<std::string>{}(hash_values);
-  }
+};
+
+/// Maps `int64_t` keys to `uint32_t` values with open addressing and linear
+/// probing. Used by the hash tables of vectorized execution, where
+/// `std::unordered_map` spends most of the time in its modulo and in
+/// following node pointers.
+class IntMap {
+    public:
+    /// Returns the value of `key` and whether it was inserted with `value`.
+    std::pair<uint32_t*, bool> try_emplace(int64_t key, uint32_t value) {
+        if (2 * (count + 1) > keys.size()) {
+            grow();
+        }
+        size_t slot = slot_of(key);
+        while (used[slot]) {
+            if (keys[slot] == key) {
+                return {&values[slot], false};
+            }
+            slot = (slot + 1) & (keys.size() - 1);
+        }
+        used[slot] = true;
+        keys[slot] = key;
+        values[slot] = value;
+        count++;
+        return {&values[slot], true};
+    }
+
+    /// Returns the value of `key` or nullptr if the key is not in the map.
+    const uint32_t* find(int64_t key) const {
+        if (count == 0) {
+            return nullptr;
+        }
+        for (size_t slot = slot_of(key); used[slot]; slot = (slot + 1) & (keys.size() - 1)) {
+            if (keys[slot] == key) {
+                return &values[slot];
+            }
+        }
+        return nullptr;
+    }
+
+    void clear() {
+        keys.clear();
+        values.clear();
+        used.clear();
+        count = 0;
+        shift = 64;
+    }
+
+    private:
+    size_t slot_of(int64_t key) const {
+        /// Fibonacci hashing, the high bits of the product are the slot
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ull) >> shift);
+    }
+
+    void grow() {
+        std::vector<int64_t> old_keys = std::move(keys);
+        std::vector<uint32_t> old_values = std::move(values);
+        std::vector<uint8_t> old_used = std::move(used);
+        size_t capacity = std::max<size_t>(2 * old_keys.size(), 16);
+        keys.assign(capacity, 0);
+        values.assign(capacity, 0);
+        used.assign(capacity, false);
+        shift = 64 - __builtin_ctzll(capacity);
+        count = 0;
+        for (size_t i = 0; i < old_keys.size(); i++) {
+            if (old_used[i]) {
+                try_emplace(old_keys[i], old_values[i]);
+            }
+        }
+    }
+
+    std::vector<int64_t> keys;
+    std::vector<uint32_t> values;
+    std::vector<uint8_t> used;
+    size_t count = 0;
+    /// 64 - log2 of the number of slots.
+    unsigned shift = 64;
+};
+
+/// Tuples in columnar form for vectorized execution, see
+/// `Operator::next_batch()`. Every attribute is a column that stores the
+/// values of all tuples in a typed array.
+struct Batch {
+    /// The maximum number of tuples in a batch.
+    static constexpr size_t kCapacity = 1024;
+
+    /// The values of one attribute. Only the array of `type` is used and it
+    /// holds one value per tuple.
+    struct Column {
+        Register::Type type = Register::Type::INT64;
+        std::vector<int64_t> ints;
+        std::vector<Char16> strings;
+
+        /// Removes all values and sets the type.
+        void reset(Register::Type new_type) {
+            type = new_type;
+            ints.clear();
+            strings.clear();
+        }
+
+        /// Appends the value at `row` of `column`, which has the same type.
+        void append(const Column& column, size_t row) {
+            if (type == Register::Type::INT64) {
+                ints.push_back(column.ints[row]);
+            } else {
+                strings.push_back(column.strings[row]);
+            }
+        }
+
+        /// Returns the value at `row` as register.
+        Register get(size_t row) const {
+            return type == Register::Type::INT64 ? Register::from_int(ints[row])
+                                                 : Register::from_char16(strings[row]);
+        }
+    };
+
+    std::vector<Column> columns;
+    /// The number of tuples.
+    size_t size = 0;
+
+    /// Removes all tuples, the columns keep their types.
+    void clear() {
+        for (auto& column : columns) {
+            column.reset(column.type);
+        }
+        size = 0;
+    }
+
+    /// Keeps only the tuples at the positions in `selection`, which are in
+    /// ascending order.
+    void select(const std::vector<uint32_t>& selection);
 };
 
 class Operator {
@@ -115,6 +307,15 @@ class Operator {
     /// available.
     virtual bool next() = 0;
 
+    /// Vectorized execution: replaces the content of `batch` with the next
+    /// tuples, at most `Batch::kCapacity` of them. Returns false when no
+    /// tuples are left, `batch` is empty then. Between `open()` and
+    /// `close()`, an operator is either driven by `next()` or by
+    /// `next_batch()`. The default implementation collects the tuples of
+    /// `next()`, so that every operator can be the input of a vectorized
+    /// one.
+    virtual bool next_batch(Batch& batch);
+
     /// Destroys the operator.
     virtual void close() = 0;
 
@@ -163,11 +364,15 @@ class Projection : public UnaryOperator {
     private:
     std::vector<size_t> attr_indexes;
 
+    /// The columns of the output batch, reused between batches.
+    std::vector<Batch::Column> projected_columns;
+
     public:
     Projection(Operator& input, std::vector<size_t> attr_indexes);
     ~Projection() override;
     void open() override;
     bool next() override;
+    bool next_batch(Batch& batch) override;
     void close() override;
     std::vector<Register*> get_output() override;
 };
@@ -216,6 +421,8 @@ class Select : public UnaryOperator {
     std::variant<Register, size_t> right_operand;
     const PredicateType predicate_type;
     std::vector<Register*> input_regs;
+    /// The positions of the qualifying tuples of a batch.
+    std::vector<uint32_t> selection;
 
     public:
     Select(Operator& input, PredicateAttributeInt64 predicate);
@@ -224,6 +431,7 @@ class Select : public UnaryOperator {
     ~Select() override;
     void open() override;
     bool next() override;
+    bool next_batch(Batch& batch) override;
     void close() override;
     std::vector<Register*> get_output() override;
 };
@@ -259,15 +467,39 @@ class HashJoin : public BinaryOperator {
     const size_t attr_index_right;
     bool ht_build = false;
     std::unordered_multimap<Register, std::vector<Register>, RegisterHasher> ht;
+    /// The left tuples that match the current right tuple and are not
+    /// returned yet.
+    std::pair<decltype(ht)::iterator, decltype(ht)::iterator> matches;
     std::vector<Register*> input_regs_left;
     std::vector<Register*> input_regs_right;
     std::vector<Register> output_regs;
 
+    /// Vectorized execution: the left input in columnar form and, per join
+    /// key, its last row. The rows of a key are chained through
+    /// `build_next`.
+    static constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+    std::vector<Batch::Column> build_columns;
+    std::vector<uint32_t> build_next;
+    IntMap int_heads;
+    std::unordered_map<Char16, uint32_t, Char16Hasher> string_heads;
+    /// The current right batch, the position in it and the next left row
+    /// that matches the right tuple at that position.
+    Batch probe;
+    size_t probe_row = 0;
+    uint32_t probe_match = kNoRow;
+    /// The matching left and right rows of the output batch.
+    std::vector<uint32_t> match_left;
+    std::vector<uint32_t> match_right;
+
+    void build_batches();
+    uint32_t find_build_row(size_t row) const;
+
     public:
     HashJoin(Operator& input_left, Operator& input_right, size_t attr_index_left, size_t attr_index_right);
     ~HashJoin() override;
     void open() override;
     bool next() override;
+    bool next_batch(Batch& batch) override;
     void close() override;
     std::vector<Register*> get_output() override;
 };
@@ -296,11 +528,30 @@ class HashAggregation : public UnaryOperator {
     std::unordered_map<std::vector<Register>, std::vector<Register>, RegisterVectorHasher> ht;
     decltype(ht)::iterator output_iterator;
 
+    /// Vectorized execution: the groups are numbered in the order they were
+    /// found. A single `INT64` group attribute is its own key, otherwise the
+    /// key is the bytes of all group attributes.
+    IntMap int_groups;
+    std::unordered_map<std::string, uint32_t> groups;
+    std::string group_key;
+    /// The values of the group attributes and the aggregates, per group.
+    std::vector<Batch::Column> group_columns;
+    std::vector<Batch::Column> aggr_columns;
+    size_t num_groups = 0;
+    size_t next_group = 0;
+    /// The group of every tuple of the current batch.
+    std::vector<uint32_t> row_groups;
+
+    void find_groups(const Batch& batch);
+    void add_group(const Batch& batch, size_t row);
+    void aggregate(const Batch& batch);
+
     public:
     HashAggregation(Operator& input, std::vector<size_t> group_by_attrs, std::vector<AggrFunc> aggr_funcs);
     ~HashAggregation() override;
     void open() override;
     bool next() override;
+    bool next_batch(Batch& batch) override;
     void close() override;
     std::vector<Register*> get_output() override;
 };
@@ -1,7 +1,9 @@
 
 #include "operators/operators.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <functional>
 #include <string>
 #include <unordered_map>
@@ -13,43 +15,70 @@
 namespace buzzdb {
 namespace operators {
 
+namespace {
+
+/// Scrambles the bits of `value`, the finalizer of MurmurHash3.
+uint64_t mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+}  // namespace
+
 Register Register::from_int(int64_t value) {
-  Register reg;
-  reg.value.emplace<0>(value);
-  return reg;
+    Register reg;
+    std::memcpy(reg.value.data, &value, sizeof(value));
+    return reg;
 }
 
-Register Register::from_string(const std::string& value) { 
-  Register reg;
-  reg.value.emplace<1>(value);
-  return reg;
+Register Register::from_string(const std::string& value) {
+    return from_char16(Char16::from_string(value));
+}
+
+Register Register::from_char16(const Char16& value) {
+    Register reg;
+    reg.value = value;
+    reg.type = Type::CHAR16;
+    return reg;
 }
 
 Register::Type Register::get_type() const {
-    if (value.index() == 0) 
-      return Type::INT64;
-    else
-      return Type::CHAR16;
+    return type;
 }
 
 int64_t Register::as_int() const {
-    return std::get<0>(value);
+    assert(type == Type::INT64);
+    int64_t result;
+    std::memcpy(&result, value.data, sizeof(result));
+    return result;
 }
 
 std::string Register::as_string() const {
-    return std::get<1>(value);
+    assert(type == Type::CHAR16);
+    return value.to_string();
+}
+
+const Char16& Register::as_char16() const {
+    assert(type == Type::CHAR16);
+    return value;
 }
 
 uint64_t Register::get_hash() const {
-    return std::hash<decltype(value)>{}(value);
+    uint64_t words[2];
+    std::memcpy(words, value.data, sizeof(words));
+    return mix(words[0] ^ mix(words[1] ^ static_cast<uint64_t>(type)));
 }
 
 bool operator==(const Register& r1, const Register& r2) {
-    return r1.value == r2.value; 
+    return r1.type == r2.type && r1.value == r2.value;
 }
 
 bool operator!=(const Register& r1, const Register& r2) {
-    return r1.value != r2.value; 
+    return !(r1 == r2);
 }
 
 bool operator<(const Register& r1, const Register& r2) {
@@ -58,28 +87,133 @@ bool operator<(const Register& r1, const Register& r2) {
         return r1.as_int() < r2.as_int();
     } else {
         assert(r1.get_type() == Register::Type::CHAR16);
-        return r1.as_string().compare(r2.as_string()) < 0;
+        return r1.value < r2.value;
     }
 }
 
 bool operator<=(const Register& r1, const Register& r2) {
     assert(r1.get_type() == r2.get_type());
-    return r1 < r2 || r1 == r2;
+    return !(r2 < r1);
 }
 
 bool operator>(const Register& r1, const Register& r2) {
-  assert(r1.get_type() == r2.get_type());
-  if (r1.get_type() == Register::Type::INT64) {
-    return r1.as_int() > r2.as_int();
-  } else {
-    assert(r1.get_type() == Register::Type::CHAR16);
-    return r1.as_string().compare(r2.as_string()) > 0;
-  }
+    assert(r1.get_type() == r2.get_type());
+    return r2 < r1;
 }
 
 bool operator>=(const Register& r1, const Register& r2) {
-  assert(r1.get_type() == r2.get_type());
-  return r1 > r2 || r1 == r2;
+    assert(r1.get_type() == r2.get_type());
+    return !(r1 < r2);
+}
+
+namespace {
+
+/// Copies the values at `rows` of `from` into `to`.
+void gather(const Batch::Column& from, const std::vector<uint32_t>& rows, Batch::Column& to) {
+    to.reset(from.type);
+    if (from.type == Register::Type::INT64) {
+        to.ints.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            to.ints[i] = from.ints[rows[i]];
+        }
+    } else {
+        to.strings.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            to.strings[i] = from.strings[rows[i]];
+        }
+    }
+}
+
+/// Copies the values [begin, begin + count) of `from` into `to`.
+void copy_rows(const Batch::Column& from, size_t begin, size_t count, Batch::Column& to) {
+    to.reset(from.type);
+    if (from.type == Register::Type::INT64) {
+        to.ints.assign(from.ints.begin() + begin, from.ints.begin() + begin + count);
+    } else {
+        to.strings.assign(from.strings.begin() + begin, from.strings.begin() + begin + count);
+    }
+}
+
+/// Stores the positions i in [0, size) for which `left[i] P right(i)`
+/// holds in `selection`, where P is given by `predicate_type`.
+template<typename ValueT, typename RightT>
+void select_rows(const ValueT* left, RightT right, size_t size, Select::PredicateType predicate_type,
+                 std::vector<uint32_t>& selection) {
+    selection.resize(size);
+    size_t count = 0;
+    auto run = [&](auto predicate) {
+        for (size_t i = 0; i < size; i++) {
+            /// Every position is written but only kept if the predicate holds,
+            /// so the loop has no branch that depends on the data
+            selection[count] = static_cast<uint32_t>(i);
+            count += predicate(left[i], right(i));
+        }
+    };
+    switch (predicate_type) {
+        case Select::PredicateType::EQ:
+            run([](const ValueT& a, const ValueT& b) { return a == b; });
+            break;
+        case Select::PredicateType::NE:
+            run([](const ValueT& a, const ValueT& b) { return !(a == b); });
+            break;
+        case Select::PredicateType::LT:
+            run([](const ValueT& a, const ValueT& b) { return a < b; });
+            break;
+        case Select::PredicateType::LE:
+            run([](const ValueT& a, const ValueT& b) { return !(b < a); });
+            break;
+        case Select::PredicateType::GT:
+            run([](const ValueT& a, const ValueT& b) { return b < a; });
+            break;
+        case Select::PredicateType::GE:
+            run([](const ValueT& a, const ValueT& b) { return !(a < b); });
+            break;
+        default:
+            __builtin_unreachable();
+    }
+    selection.resize(count);
+}
+
+}  // namespace
+
+void Batch::select(const std::vector<uint32_t>& selection) {
+    for (auto& column : columns) {
+        if (column.type == Register::Type::INT64) {
+            for (size_t i = 0; i < selection.size(); i++) {
+                column.ints[i] = column.ints[selection[i]];
+            }
+            column.ints.resize(selection.size());
+        } else {
+            for (size_t i = 0; i < selection.size(); i++) {
+                column.strings[i] = column.strings[selection[i]];
+            }
+            column.strings.resize(selection.size());
+        }
+    }
+    size = selection.size();
+}
+
+bool Operator::next_batch(Batch& batch) {
+    batch.clear();
+    std::vector<Register*> regs;
+    while (batch.size < Batch::kCapacity && next()) {
+        if (batch.size == 0) {
+            regs = get_output();
+            batch.columns.resize(regs.size());
+            for (size_t i = 0; i < regs.size(); i++) {
+                batch.columns[i].reset(regs[i]->get_type());
+            }
+        }
+        for (size_t i = 0; i < regs.size(); i++) {
+            if (batch.columns[i].type == Register::Type::INT64) {
+                batch.columns[i].ints.push_back(regs[i]->as_int());
+            } else {
+                batch.columns[i].strings.push_back(regs[i]->as_char16());
+            }
+        }
+        batch.size++;
+    }
+    return batch.size != 0;
 }
 
 Print::Print(Operator& input, std::ostream& stream) : UnaryOperator(input), stream(stream) {}
@@ -134,9 +268,30 @@ bool Projection::next() {
   return input->next();
 }
 
+bool Projection::next_batch(Batch& batch) {
+    if (!input->next_batch(batch)) {
+        return false;
+    }
+    projected_columns.resize(attr_indexes.size());
+    /// Columns are moved by their last use and copied by the uses before
+    std::vector<bool> last_use(attr_indexes.size());
+    for (size_t i = 0; i < attr_indexes.size(); i++) {
+        last_use[i] = std::find(attr_indexes.begin() + i + 1, attr_indexes.end(), attr_indexes[i]) == attr_indexes.end();
+        if (!last_use[i]) {
+            projected_columns[i] = batch.columns[attr_indexes[i]];
+        }
+    }
+    for (size_t i = 0; i < attr_indexes.size(); i++) {
+        if (last_use[i]) {
+            std::swap(projected_columns[i], batch.columns[attr_indexes[i]]);
+        }
+    }
+    batch.columns.swap(projected_columns);
+    return true;
+}
+
 void Projection::close() {
   input->close();
-  attr_indexes.clear();
 }
 
 std::vector<Register*> Projection::get_output() {
@@ -144,7 +299,7 @@ std::vector<Register*> Projection::get_output() {
   std::vector<Register*> output;
   size_t i = 0;
   while (i < attr_indexes.size()) {
-    output.push_back(src_regs[i]);
+    output.push_back(src_regs[attr_indexes[i]]);
     i++;
   }
   return output;
@@ -179,10 +334,10 @@ bool Select::next() {
     while (input->next()) {
         bool result = [&]() {
         auto* reg_left = input_regs[attr_index];
-        Register* reg_right;
+        Register* reg_right = nullptr;
         if (right_operand.index() == 0) {
             reg_right = &std::get<0>(right_operand);
-        } else if (right_operand.index() == 1) {
+        } else {
             reg_right = input_regs[std::get<1>(right_operand)];
         }
         if (predicate_type == PredicateType::EQ)
@@ -208,6 +363,41 @@ bool Select::next() {
     return false;
 }
 
+bool Select::next_batch(Batch& batch) {
+    while (input->next_batch(batch)) {
+        const auto& left = batch.columns[attr_index];
+        if (right_operand.index() == 0) {
+            const auto& constant = std::get<0>(right_operand);
+            if (left.type == Register::Type::INT64) {
+                int64_t value = constant.as_int();
+                select_rows(left.ints.data(), [value](size_t) { return value; }, batch.size, predicate_type, selection);
+            } else {
+                const Char16& value = constant.as_char16();
+                select_rows(left.strings.data(), [&value](size_t) { return value; }, batch.size, predicate_type,
+                            selection);
+            }
+        } else {
+            const auto& right = batch.columns[std::get<1>(right_operand)];
+            if (left.type == Register::Type::INT64) {
+                const int64_t* values = right.ints.data();
+                select_rows(left.ints.data(), [values](size_t i) { return values[i]; }, batch.size, predicate_type,
+                            selection);
+            } else {
+                const Char16* values = right.strings.data();
+                select_rows(left.strings.data(), [values](size_t i) { return values[i]; }, batch.size,
+                            predicate_type, selection);
+            }
+        }
+        if (selection.size() != batch.size) {
+            batch.select(selection);
+        }
+        if (batch.size != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void Select::close() {
   input->close(); 
 }
@@ -292,30 +482,122 @@ bool HashJoin::next() {
             }
             ht.emplace(*input_tuple[attr_index_left], reg);
         }
+        ht_build = true;
+        matches = {ht.end(), ht.end()};
     }
-    while (input_right->next()) {
-        const auto it = ht.find(*input_regs_right[attr_index_right]);
-        if (it != ht.end()) {
-            size_t i = 0;
-            while (i < it->second.size()) {
-                output_regs[i] = it->second[i];
-                i++;
+    /// A right tuple is joined with every matching left tuple
+    while (matches.first == matches.second) {
+        if (!input_right->next()) {
+            return false;
+        }
+        matches = ht.equal_range(*input_regs_right[attr_index_right]);
+    }
+    const auto &left_tuple = matches.first->second;
+    ++matches.first;
+    size_t i = 0;
+    while (i < left_tuple.size()) {
+        output_regs[i] = left_tuple[i];
+        i++;
+    }
+    i = 0;
+    while (i < input_regs_right.size()) {
+        output_regs[left_tuple.size() + i] = *input_regs_right[i];
+        i++;
+    }
+    return true;
+}
+
+void HashJoin::build_batches() {
+    Batch batch;
+    build_columns.assign(input_regs_left.size(), Batch::Column());
+    uint32_t rows = 0;
+    while (input_left->next_batch(batch)) {
+        for (size_t i = 0; i < batch.columns.size(); i++) {
+            auto& column = build_columns[i];
+            if (rows == 0) {
+                column.reset(batch.columns[i].type);
             }
-            i = 0;
-            while (i < input_regs_right.size()) {
-                output_regs[it->second.size() + i] = *input_regs_right[i];
-                i++;
+            column.ints.insert(column.ints.end(), batch.columns[i].ints.begin(), batch.columns[i].ints.end());
+            column.strings.insert(column.strings.end(), batch.columns[i].strings.begin(),
+                                  batch.columns[i].strings.end());
+        }
+        const auto& keys = batch.columns[attr_index_left];
+        for (size_t i = 0; i < batch.size; i++) {
+            uint32_t& head = keys.type == Register::Type::INT64
+                                 ? *int_heads.try_emplace(keys.ints[i], kNoRow).first
+                                 : string_heads.try_emplace(keys.strings[i], kNoRow).first->second;
+            build_next.push_back(head);
+            head = rows + static_cast<uint32_t>(i);
+        }
+        rows += static_cast<uint32_t>(batch.size);
+    }
+}
+
+uint32_t HashJoin::find_build_row(size_t row) const {
+    const auto& keys = probe.columns[attr_index_right];
+    if (keys.type == Register::Type::INT64) {
+        auto head = int_heads.find(keys.ints[row]);
+        return head ? *head : kNoRow;
+    }
+    auto it = string_heads.find(keys.strings[row]);
+    return it == string_heads.end() ? kNoRow : it->second;
+}
+
+bool HashJoin::next_batch(Batch& batch) {
+    if (!ht_build) {
+        build_batches();
+        ht_build = true;
+    }
+    while (true) {
+        match_left.clear();
+        match_right.clear();
+        while (match_left.size() < Batch::kCapacity && probe_row < probe.size) {
+            if (probe_match == kNoRow) {
+                probe_match = find_build_row(probe_row);
+                if (probe_match == kNoRow) {
+                    probe_row++;
+                    continue;
+                }
+            }
+            match_left.push_back(probe_match);
+            match_right.push_back(static_cast<uint32_t>(probe_row));
+            probe_match = build_next[probe_match];
+            if (probe_match == kNoRow) {
+                probe_row++;
             }
+        }
+        if (!match_left.empty()) {
+            batch.columns.resize(build_columns.size() + probe.columns.size());
+            for (size_t i = 0; i < build_columns.size(); i++) {
+                gather(build_columns[i], match_left, batch.columns[i]);
+            }
+            for (size_t i = 0; i < probe.columns.size(); i++) {
+                gather(probe.columns[i], match_right, batch.columns[build_columns.size() + i]);
+            }
+            batch.size = match_left.size();
             return true;
         }
+        if (!input_right->next_batch(probe)) {
+            batch.clear();
+            return false;
+        }
+        probe_row = 0;
+        probe_match = kNoRow;
     }
-    return false;
 }
 
 void HashJoin::close() {
     input_left->close();
     input_right->close();
     ht.clear();
+    ht_build = false;
+    build_columns.clear();
+    build_next.clear();
+    int_heads.clear();
+    string_heads.clear();
+    probe.clear();
+    probe_row = 0;
+    probe_match = kNoRow;
 }
 
 std::vector<Register*> HashJoin::get_output() {
@@ -398,9 +680,161 @@ bool HashAggregation::next() {
     }
 }
 
+void HashAggregation::add_group(const Batch& batch, size_t row) {
+    if (num_groups == 0) {
+        group_columns.resize(group_by_attrs.size());
+        for (size_t i = 0; i < group_by_attrs.size(); i++) {
+            group_columns[i].reset(batch.columns[group_by_attrs[i]].type);
+        }
+        aggr_columns.resize(aggr_funcs.size());
+        for (size_t i = 0; i < aggr_funcs.size(); i++) {
+            bool keeps_value = aggr_funcs[i].func == AggrFunc::Func::MIN || aggr_funcs[i].func == AggrFunc::Func::MAX;
+            aggr_columns[i].reset(keeps_value ? batch.columns[aggr_funcs[i].attr_index].type : Register::Type::INT64);
+        }
+    }
+    for (size_t i = 0; i < group_by_attrs.size(); i++) {
+        group_columns[i].append(batch.columns[group_by_attrs[i]], row);
+    }
+    /// The aggregates start like in `next()`, `aggregate()` then adds the row
+    for (size_t i = 0; i < aggr_funcs.size(); i++) {
+        switch (aggr_funcs[i].func) {
+        case AggrFunc::Func::MIN:
+        case AggrFunc::Func::MAX:
+            aggr_columns[i].append(batch.columns[aggr_funcs[i].attr_index], row);
+            break;
+        case AggrFunc::Func::SUM:
+        case AggrFunc::Func::COUNT:
+            aggr_columns[i].ints.push_back(0);
+            break;
+        default:
+            __builtin_unreachable();
+        }
+    }
+    num_groups++;
+}
+
+void HashAggregation::find_groups(const Batch& batch) {
+    row_groups.resize(batch.size);
+    if (group_by_attrs.empty()) {
+        if (num_groups == 0) {
+            add_group(batch, 0);
+        }
+        std::fill(row_groups.begin(), row_groups.end(), 0);
+        return;
+    }
+    if (group_by_attrs.size() == 1 && batch.columns[group_by_attrs[0]].type == Register::Type::INT64) {
+        const auto& values = batch.columns[group_by_attrs[0]].ints;
+        for (size_t row = 0; row < batch.size; row++) {
+            auto [group, inserted] = int_groups.try_emplace(values[row], static_cast<uint32_t>(num_groups));
+            if (inserted) {
+                add_group(batch, row);
+            }
+            row_groups[row] = *group;
+        }
+        return;
+    }
+    for (size_t row = 0; row < batch.size; row++) {
+        group_key.clear();
+        for (const auto attr : group_by_attrs) {
+            const auto& column = batch.columns[attr];
+            if (column.type == Register::Type::INT64) {
+                group_key.append(reinterpret_cast<const char*>(&column.ints[row]), sizeof(int64_t));
+            } else {
+                group_key.append(column.strings[row].data, sizeof(Char16::data));
+            }
+        }
+        auto it = groups.find(group_key);
+        if (it == groups.end()) {
+            it = groups.emplace(group_key, static_cast<uint32_t>(num_groups)).first;
+            add_group(batch, row);
+        }
+        row_groups[row] = it->second;
+    }
+}
+
+void HashAggregation::aggregate(const Batch& batch) {
+    for (size_t i = 0; i < aggr_funcs.size(); i++) {
+        auto& state = aggr_columns[i];
+        if (aggr_funcs[i].func == AggrFunc::Func::COUNT) {
+            for (size_t row = 0; row < batch.size; row++) {
+                state.ints[row_groups[row]]++;
+            }
+            continue;
+        }
+        const auto& column = batch.columns[aggr_funcs[i].attr_index];
+        switch (aggr_funcs[i].func) {
+        case AggrFunc::Func::SUM:
+            for (size_t row = 0; row < batch.size; row++) {
+                state.ints[row_groups[row]] += column.ints[row];
+            }
+            break;
+        case AggrFunc::Func::MIN:
+            if (column.type == Register::Type::INT64) {
+                for (size_t row = 0; row < batch.size; row++) {
+                    auto& value = state.ints[row_groups[row]];
+                    value = std::min(value, column.ints[row]);
+                }
+            } else {
+                for (size_t row = 0; row < batch.size; row++) {
+                    auto& value = state.strings[row_groups[row]];
+                    value = std::min(value, column.strings[row]);
+                }
+            }
+            break;
+        case AggrFunc::Func::MAX:
+            if (column.type == Register::Type::INT64) {
+                for (size_t row = 0; row < batch.size; row++) {
+                    auto& value = state.ints[row_groups[row]];
+                    value = std::max(value, column.ints[row]);
+                }
+            } else {
+                for (size_t row = 0; row < batch.size; row++) {
+                    auto& value = state.strings[row_groups[row]];
+                    value = std::max(value, column.strings[row]);
+                }
+            }
+            break;
+        default:
+            __builtin_unreachable();
+        }
+    }
+}
+
+bool HashAggregation::next_batch(Batch& batch) {
+    if (!seen_input) {
+        while (input->next_batch(batch)) {
+            find_groups(batch);
+            aggregate(batch);
+        }
+        seen_input = true;
+    }
+    size_t count = std::min(Batch::kCapacity, num_groups - next_group);
+    if (count == 0) {
+        batch.clear();
+        return false;
+    }
+    batch.columns.resize(group_columns.size() + aggr_columns.size());
+    for (size_t i = 0; i < group_columns.size(); i++) {
+        copy_rows(group_columns[i], next_group, count, batch.columns[i]);
+    }
+    for (size_t i = 0; i < aggr_columns.size(); i++) {
+        copy_rows(aggr_columns[i], next_group, count, batch.columns[group_columns.size() + i]);
+    }
+    batch.size = count;
+    next_group += count;
+    return true;
+}
+
 void HashAggregation::close() {
     input->close();
     ht.clear();
+    seen_input = false;
+    int_groups.clear();
+    groups.clear();
+    group_columns.clear();
+    aggr_columns.clear();
+    num_groups = 0;
+    next_group = 0;
 }
 
 std::vector<Register*> HashAggregation::get_output() {